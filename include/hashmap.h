@@ -20,6 +20,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+
+#if !defined(HMAP_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#elif !defined(HMAP_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 /*
  * hmap hash table interface
@@ -27,11 +39,150 @@
 
 typedef struct hmap hmap;
 typedef struct hmap_iter hmap_iter;
+typedef struct hmap_opts hmap_opts;
+typedef struct hmap_allocator hmap_allocator;
+typedef struct hmap_counters hmap_counters;
+typedef struct hmap_statistics hmap_statistics;
 
 typedef size_t (*hmap_hash_fn)(hmap *h, void *key);
 typedef int (*hmap_compare_fn)(hmap *h, void *key1, void *key2);
+typedef void* (*hmap_alloc_fn)(void *userdata, size_t size);
+typedef void (*hmap_free_fn)(void *userdata, void *ptr, size_t size);
+
+/* visitor for hmap_foreach and hmap_foreach_range, returns non-zero to stop */
+typedef int (*hmap_visit_fn)(void *ctx, void *key, void *val);
+
+/* predicate for hmap_erase_if and lhmap_erase_if, returns non-zero to erase */
+typedef int (*hmap_pred_fn)(void *ctx, void *key, void *val);
+
+/* folds src_val into dst_val for a key present in both maps of hmap_merge */
+typedef void (*hmap_combine_fn)(void *ctx, void *key, void *dst_val, void *src_val);
+
+/*
+ * replaces the serial rehash when set, returning zero to decline it for
+ * this resize. hashmap_parallel.h installs one with hmap_parallel_resize.
+ */
+typedef int (*hmap_rehash_fn)(hmap *h, size_t new_limit);
+
+struct hmap_iter { hmap *h; size_t idx; size_t stop; };
+
+/*
+ * hmap_allocator supplies table storage for hmap and lhmap. free is passed
+ * the size that was given to alloc. the default uses malloc and free, and
+ * hashmap_alloc.h has arena, cache-line aligned and huge page backends.
+ * allocation failure is not handled, so alloc must not return NULL.
+ */
+struct hmap_allocator
+{
+    hmap_alloc_fn alloc;
+    hmap_free_fn free;
+    void *userdata;
+};
+
+/*
+ * hmap_flag_tags replaces the 2-bit state bitmap with one control byte
+ * per slot holding a 7-bit hash tag or an empty/deleted marker, so that
+ * a whole group of slots is matched with one vector compare and keys are
+ * only compared on tag hits.
+ *
+ * hmap_flag_hashes caches the full hash of each entry in a parallel array
+ * so that resize re-buckets without calling the hasher and probes reject
+ * mismatches with an integer compare before calling compare. it is the
+ * only flag supported by lhmap.
+ *
+ * hmap_flag_robin_hood keeps probe runs ordered by distance from the home
+ * slot and erases with backward shift, so the map never holds tombstones.
+ * it uses the bitmap layout and cannot be combined with hmap_flag_tags.
+ * erase moves entries, so iterators other than the erased one are
+ * invalidated.
+ *
+ * hmap_flag_incremental resizes without rehashing the whole table at once.
+ * the old table is kept alongside the new one and insert, get and erase
+ * each migrate a bounded run of old slots. lookups check both tables, and
+ * a key found in the old table is moved to the new one so the returned
+ * iterator is valid. iteration finishes any migration first. it uses the
+ * bitmap layout and cannot be combined with tags or robin hood.
+ *
+ * hmap_flag_soa stores keys in one dense array and values in another
+ * instead of interleaving them per slot, so probing only touches key
+ * cache lines and the value is read once on a hit. it combines with all
+ * other flags and helps most when values are much larger than keys.
+ *
+ * hmap_flag_indirect stores values out of line in a slab of fixed-size
+ * chunks owned by the map, and each slot holds the key and a 32-bit handle.
+ * resize moves only keys and handles, empty slots cost four bytes instead
+ * of a value, and value pointers stay valid until their own key is erased
+ * or the map is cleared. it combines with all other flags.
+ */
+enum hmap_flags {
+    hmap_flag_none = 0,
+    hmap_flag_tags = 1,
+    hmap_flag_hashes = 2,
+    hmap_flag_robin_hood = 4,
+    hmap_flag_incremental = 8,
+    hmap_flag_soa = 16,
+    hmap_flag_indirect = 32
+};
+
+/*
+ * max_load and min_load are fractions of hmap_load_multiplier. the table
+ * grows when used plus tombstones would exceed max_load and shrinks when
+ * used falls under min_load (zero disables shrinking). min_load must be
+ * at most a quarter of max_load to avoid oscillating.
+ */
+struct hmap_opts
+{
+    void *userdata;
+    size_t key_size;
+    size_t val_size;
+    size_t limit;
+    size_t max_load;
+    size_t min_load;
+    unsigned flags;
+    uint64_t seed;
+    hmap_hash_fn hasher;
+    hmap_compare_fn compare;
+    hmap_allocator allocator;
+};
+
+/* log2 buckets: 0, 1, 2-3, 4-7 and so on, the last holds the rest */
+#define HMAP_STATS_BUCKETS 16
+
+/*
+ * counters kept by hmap and lhmap when built with HMAP_STATS. probe
+ * lengths are histograms of slots stepped past the home slot, or groups
+ * past the home group with hmap_flag_tags, for lookups that hit or miss.
+ * resizes counts rehashes and incremental migrations started, resize_ns
+ * the time spent in them and alloc_bytes the table bytes allocated.
+ */
+struct hmap_counters
+{
+    uint64_t hit_probes[HMAP_STATS_BUCKETS];
+    uint64_t miss_probes[HMAP_STATS_BUCKETS];
+    uint64_t compares;
+    uint64_t resizes;
+    uint64_t resize_ns;
+    uint64_t alloc_bytes;
+};
 
-struct hmap_iter { hmap *h; size_t idx; };
+/*
+ * filled by hmap_stats and lhmap_stats. load and tomb_load are fractions
+ * of hmap_load_multiplier. counters are zero without HMAP_STATS, and the
+ * cluster histogram of runs of non-empty slots is only filled by the
+ * table scan in hmap_stats_scan and lhmap_stats_scan.
+ */
+struct hmap_statistics
+{
+    size_t used;
+    size_t tombs;
+    size_t limit;
+    size_t load;
+    size_t tomb_load;
+    size_t table_bytes;
+    hmap_counters counters;
+    uint64_t clusters[HMAP_STATS_BUCKETS];
+    size_t max_cluster;
+};
 
 static inline size_t hmap_stride(hmap *h);
 static inline hmap_iter hmap_iter_next(hmap_iter iter);
@@ -51,12 +202,39 @@ static inline void hmap_init(hmap *h,
 static inline void hmap_init_ex(hmap *h, void *userdata,
     size_t key_size, size_t val_size, size_t limit,
     hmap_hash_fn hasher, hmap_compare_fn compare);
+static inline hmap_opts hmap_opts_make(size_t key_size, size_t val_size);
+static inline void hmap_init_opts(hmap *h, const hmap_opts *opts);
 static inline void hmap_destroy(hmap *h);
 static inline void hmap_clear(hmap *h);
 static inline hmap_iter hmap_insert(hmap *h, void *key, void *val);
 static inline void* hmap_get(hmap *h, void *key);
 static inline hmap_iter hmap_find(hmap *h, void *key);
 static inline void hmap_erase(hmap *h, void *key);
+static inline hmap_iter hmap_insert_hashed(hmap *h, void *key, void *val, size_t hash);
+static inline void* hmap_get_hashed(hmap *h, void *key, size_t hash);
+static inline hmap_iter hmap_find_hashed(hmap *h, void *key, size_t hash);
+static inline void hmap_erase_hashed(hmap *h, void *key, size_t hash);
+static inline hmap_iter hmap_iter_erase(hmap_iter iter);
+static inline size_t hmap_erase_if(hmap *h, hmap_pred_fn pred, void *ctx);
+static inline void hmap_reserve(hmap *h, size_t count);
+static inline void hmap_shrink_to_fit(hmap *h);
+static inline void hmap_migrate(hmap *h);
+static inline void hmap_find_batch(hmap *h,
+    void *keys, size_t count, hmap_iter *iters);
+static inline void hmap_get_batch(hmap *h,
+    void *keys, size_t count, void **vals);
+static inline hmap_iter hmap_iter_from(hmap *h, size_t idx);
+static inline int hmap_foreach(hmap *h, hmap_visit_fn fn, void *ctx);
+static inline int hmap_foreach_range(hmap *h, size_t begin, size_t end,
+    hmap_visit_fn fn, void *ctx);
+static inline void hmap_union(hmap *dst, hmap *a, hmap *b);
+static inline void hmap_intersect(hmap *dst, hmap *a, hmap *b);
+static inline void hmap_difference(hmap *dst, hmap *a, hmap *b);
+static inline void hmap_merge(hmap *dst, hmap *src,
+    hmap_combine_fn combine, void *ctx);
+static inline void hmap_stats(hmap *h, hmap_statistics *s);
+static inline void hmap_stats_scan(hmap *h, hmap_statistics *s);
+static inline void hmap_stats_reset(hmap *h);
 
 /*
  * lhmap linked hash table interface
@@ -64,12 +242,45 @@ static inline void hmap_erase(hmap *h, void *key);
 
 typedef struct lhmap lhmap;
 typedef struct lhmap_iter lhmap_iter;
+typedef struct lhmap_opts lhmap_opts;
 
 typedef size_t (*lhmap_hash_fn)(lhmap *h, void *key);
 typedef int (*lhmap_compare_fn)(lhmap *h, void *key1, void *key2);
+typedef size_t (*lhmap_cost_fn)(lhmap *h, void *key, void *val);
+typedef void (*lhmap_evict_fn)(lhmap *h, void *key, void *val);
+typedef int (*lhmap_rehash_fn)(lhmap *h, size_t new_limit);
 
 struct lhmap_iter { lhmap *h; size_t idx; };
 
+/*
+ * max_entries and max_bytes bound an lhmap used as an LRU cache, zero
+ * meaning unbounded. inserting a new key when full evicts from the tail,
+ * calling evict first if it is set. with max_entries the table is sized
+ * up front so it never grows once full. each entry is charged cost, or
+ * key_size + val_size if cost is NULL, when its value is stored with
+ * lhmap_insert or lhmap_insert_front or zeroed by lhmap_get, so with
+ * max_bytes values must not be changed through pointers in a way that
+ * changes their cost.
+ */
+struct lhmap_opts
+{
+    void *userdata;
+    size_t key_size;
+    size_t val_size;
+    size_t limit;
+    size_t max_load;
+    size_t min_load;
+    unsigned flags;
+    uint64_t seed;
+    lhmap_hash_fn hasher;
+    lhmap_compare_fn compare;
+    hmap_allocator allocator;
+    size_t max_entries;
+    size_t max_bytes;
+    lhmap_cost_fn cost;
+    lhmap_evict_fn evict;
+};
+
 static inline size_t lhmap_stride(lhmap *h);
 static inline lhmap_iter lhmap_iter_next(lhmap_iter iter);
 static inline void* lhmap_iter_key(lhmap_iter iter);
@@ -88,6 +299,8 @@ static inline void lhmap_init(lhmap *h,
 static inline void lhmap_init_ex(lhmap *h, void *userdata,
     size_t key_size, size_t val_size, size_t limit,
     lhmap_hash_fn hasher, lhmap_compare_fn compare);
+static inline lhmap_opts lhmap_opts_make(size_t key_size, size_t val_size);
+static inline void lhmap_init_opts(lhmap *h, const lhmap_opts *opts);
 static inline void lhmap_destroy(lhmap *h);
 static inline void lhmap_clear(lhmap *h);
 static inline lhmap_iter lhmap_insert(lhmap *h,
@@ -95,18 +308,33 @@ static inline lhmap_iter lhmap_insert(lhmap *h,
 static inline void* lhmap_get(lhmap *h, void *key);
 static inline lhmap_iter lhmap_find(lhmap *h, void *key);
 static inline void lhmap_erase(lhmap *h, void *key);
+static inline lhmap_iter lhmap_iter_erase(lhmap_iter iter);
+static inline size_t lhmap_erase_if(lhmap *h, hmap_pred_fn pred, void *ctx);
+static inline lhmap_iter lhmap_touch(lhmap *h, void *key);
+static inline lhmap_iter lhmap_insert_front(lhmap *h, void *key, void *val);
+static inline int lhmap_evict(lhmap *h);
+static inline size_t lhmap_bytes(lhmap *h);
+static inline void lhmap_reserve(lhmap *h, size_t count);
+static inline void lhmap_shrink_to_fit(lhmap *h);
+static inline void lhmap_find_batch(lhmap *h,
+    void *keys, size_t count, lhmap_iter *iters);
+static inline void lhmap_get_batch(lhmap *h,
+    void *keys, size_t count, void **vals);
+static inline void lhmap_stats(lhmap *h, hmap_statistics *s);
+static inline void lhmap_stats_scan(lhmap *h, hmap_statistics *s);
+static inline void lhmap_stats_reset(lhmap *h);
 
 /*
  * hmap common
  */
 
-typedef enum hmap_bitmap_state hmap_bitmap_state;
 enum hmap_bitmap_state {
     hmap_available = 0,
     hmap_occupied = 1,
     hmap_deleted = 2,
     hmap_recycled = 3
 };
+typedef enum hmap_bitmap_state hmap_bitmap_state;
 
 static const size_t hmap_default_size =    (2<<3);  /* 16 */
 static const size_t hmap_load_factor =     (2<<15); /* 0.5 */
@@ -145,6 +373,326 @@ static inline void hmap_bitmap_clear(uint64_t *bitmap, size_t i, uint64_t value)
 
 static inline int hmap_ispow2(size_t v) { return v && !(v & (v-1)); }
 
+/*
+ * statistics
+ *
+ * with HMAP_STATS defined, hmap and lhmap carry an hmap_counters that is
+ * updated through hmap_stat and hmap_stat_resize. without it the struct
+ * member is absent and both expand to nothing, so the hot paths are the
+ * same as in a build without statistics.
+ */
+
+#if defined(HMAP_STATS)
+#define hmap_stat(h, expr) ((void)((h)->counters.expr))
+#define hmap_stat_resize(h, t0) ((void)((h)->counters.resizes++, \
+    (h)->counters.resize_ns += hmap_stats_clock() - (t0)))
+#else
+#define hmap_stat(h, expr) ((void)0)
+#define hmap_stat_resize(h, t0) ((void)(t0))
+#endif
+
+static inline uint64_t hmap_stats_clock(void)
+{
+#if defined(HMAP_STATS)
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+static inline unsigned hmap_stats_bucket(size_t n)
+{
+    unsigned b = 0;
+    while (n && b < HMAP_STATS_BUCKETS - 1) {
+        n >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/* distance from home to the first available slot, where a miss stops */
+static inline size_t hmap_stats_miss_len(uint64_t *bitmap, size_t mask, size_t home)
+{
+    size_t d = 0;
+    for (size_t i = home; hmap_bitmap_get(bitmap, i) != hmap_available; i = (i+1) & mask) d++;
+    return d;
+}
+
+/* adds a run of len non-empty slots to the cluster histogram */
+static inline void hmap_stats_cluster(hmap_statistics *s, size_t len)
+{
+    if (!len) return;
+    s->clusters[hmap_stats_bucket(len)]++;
+    if (len > s->max_cluster) s->max_cluster = len;
+}
+
+static inline unsigned hmap_ctz64(uint64_t v)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long r; _BitScanForward64(&r, v); return (unsigned)r;
+#elif defined(__GNUC__)
+    return (unsigned)__builtin_ctzll(v);
+#else
+    unsigned r = 0; while (!(v & 1)) { v >>= 1; r++; } return r;
+#endif
+}
+
+#if defined(__GNUC__)
+#define hmap_prefetch(p) __builtin_prefetch(p)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define hmap_prefetch(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define hmap_prefetch(p) ((void)(p))
+#endif
+
+/* spin-wait hint for the concurrent variants */
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define hmap_cpu_relax() _mm_pause()
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define hmap_cpu_relax() __builtin_ia32_pause()
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define hmap_cpu_relax() __asm__ __volatile__("yield")
+#else
+#define hmap_cpu_relax() ((void)0)
+#endif
+
+/* number of lookups grouped by the batch functions */
+#define HMAP_BATCH_WIDTH 16
+
+/*
+ * hmap default hash
+ *
+ * a wyhash-style hash over the full key. keys are consumed in 16 byte
+ * (or 48 byte) blocks, each folded with a 64x64->128 bit multiply. the
+ * seed is mixed into every block so that collisions cannot be precomputed
+ * without knowing the per-map seed.
+ */
+
+static const uint64_t hmap_hash_secret[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+    0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+static inline void hmap_mum(uint64_t *a, uint64_t *b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r; *b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl, lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo; *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t hmap_mix(uint64_t a, uint64_t b)
+{
+    hmap_mum(&a, &b); return a ^ b;
+}
+
+static inline uint64_t hmap_read64(const unsigned char *p)
+{
+    uint64_t v; memcpy(&v, p, 8); return v;
+}
+
+static inline uint64_t hmap_read32(const unsigned char *p)
+{
+    uint32_t v; memcpy(&v, p, 4); return v;
+}
+
+static inline uint64_t hmap_hash_bytes(const void *key, size_t len, uint64_t seed)
+{
+    const unsigned char *p = (const unsigned char*)key;
+    const uint64_t *s = hmap_hash_secret;
+    uint64_t a, b;
+
+    seed ^= hmap_mix(seed ^ s[0], s[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (hmap_read32(p) << 32) | hmap_read32(p + ((len >> 3) << 2));
+            b = (hmap_read32(p + len - 4) << 32) |
+                hmap_read32(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = hmap_mix(hmap_read64(p) ^ s[1], hmap_read64(p + 8) ^ seed);
+                see1 = hmap_mix(hmap_read64(p + 16) ^ s[2], hmap_read64(p + 24) ^ see1);
+                see2 = hmap_mix(hmap_read64(p + 32) ^ s[3], hmap_read64(p + 40) ^ see2);
+                p += 48; i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = hmap_mix(hmap_read64(p) ^ s[1], hmap_read64(p + 8) ^ seed);
+            p += 16; i -= 16;
+        }
+        a = hmap_read64(p + i - 16);
+        b = hmap_read64(p + i - 8);
+    }
+    a ^= s[1]; b ^= seed;
+    hmap_mum(&a, &b);
+    return hmap_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+/* seeds from the wall clock and stack address (randomized by ASLR) */
+static inline uint64_t hmap_random_seed(void)
+{
+    uint64_t t = (uint64_t)time(NULL), local = 0;
+    return hmap_mix(t ^ hmap_hash_secret[2],
+        (uint64_t)(uintptr_t)&local ^ hmap_hash_secret[3]);
+}
+
+/*
+ * hmap control bytes
+ *
+ * a control byte is either hmap_ctrl_empty, hmap_ctrl_deleted, or a full
+ * slot holding the top 7 bits of the hash. slots are probed in aligned
+ * groups of HMAP_GROUP_WIDTH bytes. group match functions return a mask
+ * that is walked with hmap_group_next, which maps the lowest set bit to
+ * the slot offset within the group, and hmap_group_from drops the slots
+ * before an offset. the scalar fallback uses SWAR on a
+ * 64-bit word with one high bit per matching byte.
+ */
+
+enum {
+    hmap_ctrl_empty = 0x80,
+    hmap_ctrl_deleted = 0xfe
+};
+
+#if !defined(HMAP_NO_SIMD) && defined(__AVX2__)
+
+#define HMAP_GROUP_WIDTH 32
+
+static inline uint64_t hmap_group_match(const unsigned char *ctrl, unsigned char c)
+{
+    __m256i g = _mm256_loadu_si256((const __m256i*)ctrl);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(g, _mm256_set1_epi8((char)c)));
+}
+
+static inline uint64_t hmap_group_match_free(const unsigned char *ctrl)
+{
+    __m256i g = _mm256_loadu_si256((const __m256i*)ctrl);
+    return (uint32_t)_mm256_movemask_epi8(g);
+}
+
+static inline uint64_t hmap_group_match_full(const unsigned char *ctrl)
+{
+    __m256i g = _mm256_loadu_si256((const __m256i*)ctrl);
+    return (uint32_t)~_mm256_movemask_epi8(g);
+}
+
+static inline unsigned hmap_group_next(uint64_t mask) { return hmap_ctz64(mask); }
+
+static inline uint64_t hmap_group_from(uint64_t mask, unsigned off)
+{
+    return mask & (~(uint64_t)0 << off);
+}
+
+#elif !defined(HMAP_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+
+#define HMAP_GROUP_WIDTH 16
+
+static inline uint64_t hmap_group_match(const unsigned char *ctrl, unsigned char c)
+{
+    __m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)c)));
+}
+
+static inline uint64_t hmap_group_match_free(const unsigned char *ctrl)
+{
+    __m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+    return (uint32_t)_mm_movemask_epi8(g);
+}
+
+static inline uint64_t hmap_group_match_full(const unsigned char *ctrl)
+{
+    __m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+    return (uint16_t)~_mm_movemask_epi8(g);
+}
+
+static inline unsigned hmap_group_next(uint64_t mask) { return hmap_ctz64(mask); }
+
+static inline uint64_t hmap_group_from(uint64_t mask, unsigned off)
+{
+    return mask & (~(uint64_t)0 << off);
+}
+
+#else
+
+#define HMAP_GROUP_WIDTH 8
+
+static const uint64_t hmap_swar_lsb = 0x0101010101010101ull;
+static const uint64_t hmap_swar_low = 0x7f7f7f7f7f7f7f7full;
+static const uint64_t hmap_swar_msb = 0x8080808080808080ull;
+
+static inline uint64_t hmap_group_load(const unsigned char *ctrl)
+{
+    return (uint64_t)ctrl[0]       | (uint64_t)ctrl[1] << 8  |
+           (uint64_t)ctrl[2] << 16 | (uint64_t)ctrl[3] << 24 |
+           (uint64_t)ctrl[4] << 32 | (uint64_t)ctrl[5] << 40 |
+           (uint64_t)ctrl[6] << 48 | (uint64_t)ctrl[7] << 56;
+}
+
+/* sets the high bit of each byte that is zero, without false positives */
+static inline uint64_t hmap_swar_zero(uint64_t x)
+{
+    return ~(((x & hmap_swar_low) + hmap_swar_low) | x | hmap_swar_low);
+}
+
+static inline uint64_t hmap_group_match(const unsigned char *ctrl, unsigned char c)
+{
+    return hmap_swar_zero(hmap_group_load(ctrl) ^ (hmap_swar_lsb * c));
+}
+
+static inline uint64_t hmap_group_match_free(const unsigned char *ctrl)
+{
+    return hmap_group_load(ctrl) & hmap_swar_msb;
+}
+
+static inline uint64_t hmap_group_match_full(const unsigned char *ctrl)
+{
+    return ~hmap_group_load(ctrl) & hmap_swar_msb;
+}
+
+static inline unsigned hmap_group_next(uint64_t mask) { return hmap_ctz64(mask) >> 3; }
+
+static inline uint64_t hmap_group_from(uint64_t mask, unsigned off)
+{
+    return mask & (~(uint64_t)0 << (off << 3));
+}
+
+#endif
+
+static inline uint64_t hmap_group_match_empty(const unsigned char *ctrl)
+{
+    return hmap_group_match(ctrl, hmap_ctrl_empty);
+}
+
+static inline unsigned char hmap_hash_tag(size_t hash)
+{
+    return (unsigned char)((hash >> (sizeof(size_t) * 8 - 7)) & 0x7f);
+}
+
+static inline size_t hmap_ctrl_size(size_t limit)
+{
+    return (limit + 7) & ~(size_t)7;
+}
+
 /*
  * hmap hash table implementation
  */
@@ -156,18 +704,39 @@ struct hmap
     size_t used;
     size_t tombs;
     size_t limit;
+    size_t max_load;
+    size_t min_load;
+    unsigned flags;
+    uint64_t seed;
     hmap_hash_fn hasher;
     hmap_compare_fn compare;
+    hmap_allocator allocator;
     unsigned char *data;
+    size_t *hashes;
     uint64_t *bitmap;
+    unsigned char *ctrl;
+    unsigned char *old_data;
+    size_t *old_hashes;
+    uint64_t *old_bitmap;
+    size_t old_limit;
+    size_t old_used;
+    size_t old_pos;
+    unsigned char **slab;
+    size_t slab_chunks;
+    size_t slab_cap;
+    uint32_t slab_next;
+    uint32_t slab_free;
+    hmap_rehash_fn rehash;
+    size_t rehash_threads;
     void *userdata;
+#if defined(HMAP_STATS)
+    hmap_counters counters;
+#endif
 };
 
 static inline size_t hmap_default_hash_fn(hmap *h, void *key)
 {
-    size_t k = 0;
-    memcpy(&k, key, h->key_size < sizeof(k) ? h->key_size : sizeof(k));
-    return k;
+    return (size_t)hmap_hash_bytes(key, h->key_size, h->seed);
 }
 
 static inline int hmap_default_compare_fn(hmap *h, void *key1, void *key2)
@@ -175,278 +744,1517 @@ static inline int hmap_default_compare_fn(hmap *h, void *key1, void *key2)
     return memcmp(key1, key2, h->key_size) == 0;
 }
 
-static inline size_t hmap_stride(hmap *h)
+static inline void* hmap_default_alloc_fn(void *userdata, size_t size)
 {
-    return h->key_size + h->val_size;
+    (void)userdata;
+    return malloc(size);
 }
 
-static inline void* hmap_data_key(hmap *h, size_t idx)
+static inline void hmap_default_free_fn(void *userdata, void *ptr, size_t size)
 {
-    return h->data + idx * hmap_stride(h);
+    (void)userdata;
+    (void)size;
+    free(ptr);
 }
 
-static inline void* hmap_data_val(hmap *h, size_t idx)
+/*
+ * value slab
+ *
+ * with hmap_flag_indirect values live in chunks of HMAP_SLAB_CHUNK values
+ * allocated from h->allocator and addressed by a 32-bit handle, chunk in
+ * the high part and index in the low part. chunks are never moved or
+ * freed before the map is destroyed, and free values are chained through
+ * their first four bytes, so the slab does not shrink with the table.
+ */
+
+#define HMAP_SLAB_CHUNK 256
+
+static const uint32_t hmap_slab_none = 0xffffffffu;
+
+static inline size_t hmap_slab_stride(hmap *h)
 {
-    return h->data + h->key_size + idx * hmap_stride(h);
+    return h->val_size < sizeof(uint32_t) ? sizeof(uint32_t) : h->val_size;
 }
 
-static inline size_t hmap_iter_step(hmap *h, size_t idx)
+static inline void* hmap_slab_val(hmap *h, uint32_t v)
 {
-    while (idx < h->limit && (hmap_bitmap_get(h->bitmap,
-        idx) & hmap_occupied) != hmap_occupied) idx++;
-    return idx;
+    return h->slab[v / HMAP_SLAB_CHUNK] + (v % HMAP_SLAB_CHUNK) * hmap_slab_stride(h);
 }
 
-static inline hmap_iter hmap_iter_make(hmap *h, size_t idx)
+static inline size_t hmap_slab_bytes(hmap *h)
 {
-    hmap_iter iter = { h, idx }; return iter;
+    return h->slab_chunks * HMAP_SLAB_CHUNK * hmap_slab_stride(h) +
+        h->slab_cap * sizeof(unsigned char*);
 }
 
-static inline hmap_iter hmap_iter_next(hmap_iter iter)
+static inline void hmap_slab_init(hmap *h)
 {
-    return hmap_iter_make(iter.h, hmap_iter_step(iter.h, iter.idx + 1));
+    h->slab = NULL;
+    h->slab_chunks = 0;
+    h->slab_cap = 0;
+    h->slab_next = 0;
+    h->slab_free = hmap_slab_none;
 }
 
-static inline void* hmap_iter_key(hmap_iter iter)
+static inline void hmap_slab_grow(hmap *h)
 {
-    return hmap_data_key(iter.h, hmap_iter_step(iter.h, iter.idx));
+    size_t chunk_size = HMAP_SLAB_CHUNK * hmap_slab_stride(h);
+
+    if (h->slab_chunks == h->slab_cap) {
+        size_t cap = h->slab_cap ? h->slab_cap << 1 : 8;
+        unsigned char **slab = (unsigned char**)h->allocator.alloc(
+            h->allocator.userdata, cap * sizeof(unsigned char*));
+        if (h->slab_chunks) memcpy(slab, h->slab, h->slab_chunks * sizeof(unsigned char*));
+        if (h->slab) {
+            h->allocator.free(h->allocator.userdata, h->slab,
+                h->slab_cap * sizeof(unsigned char*));
+        }
+        h->slab = slab;
+        h->slab_cap = cap;
+    }
+    hmap_stat(h, alloc_bytes += chunk_size);
+    h->slab[h->slab_chunks++] = (unsigned char*)h->allocator.alloc(
+        h->allocator.userdata, chunk_size);
 }
 
-static inline void* hmap_iter_val(hmap_iter iter)
+static inline uint32_t hmap_slab_alloc(hmap *h)
 {
-    return hmap_data_val(iter.h, hmap_iter_step(iter.h, iter.idx));
+    uint32_t v = h->slab_free;
+    if (v != hmap_slab_none) {
+        memcpy(&h->slab_free, hmap_slab_val(h, v), sizeof(uint32_t));
+        return v;
+    }
+    assert(h->slab_next != hmap_slab_none);
+    v = h->slab_next++;
+    if (v / HMAP_SLAB_CHUNK == h->slab_chunks) hmap_slab_grow(h);
+    return v;
 }
 
-static inline int hmap_iter_eq(hmap_iter iter1, hmap_iter iter2)
+static inline void hmap_slab_release(hmap *h, uint32_t v)
 {
-    size_t i1 = hmap_iter_step(iter1.h, iter1.idx);
-    size_t i2 = hmap_iter_step(iter2.h, iter2.idx);
-    return iter1.h == iter2.h && i1 == i2;
+    memcpy(hmap_slab_val(h, v), &h->slab_free, sizeof(uint32_t));
+    h->slab_free = v;
 }
 
-static inline int hmap_iter_neq(hmap_iter iter1, hmap_iter iter2)
+static inline void hmap_slab_destroy(hmap *h)
 {
-    size_t i1 = hmap_iter_step(iter1.h, iter1.idx);
-    size_t i2 = hmap_iter_step(iter2.h, iter2.idx);
-    return iter1.h != iter2.h || i1 != i2;
+    size_t chunk_size = HMAP_SLAB_CHUNK * hmap_slab_stride(h);
+    for (size_t c = 0; c < h->slab_chunks; c++) {
+        h->allocator.free(h->allocator.userdata, h->slab[c], chunk_size);
+    }
+    if (h->slab) {
+        h->allocator.free(h->allocator.userdata, h->slab,
+            h->slab_cap * sizeof(unsigned char*));
+    }
+    hmap_slab_init(h);
 }
 
-static inline hmap_iter hmap_iter_begin(hmap *h)
+/* bytes of the value part of a slot, a slab handle with hmap_flag_indirect */
+static inline size_t hmap_slot_val_size(hmap *h)
 {
-    return hmap_iter_make(h, hmap_iter_step(h, 0));
+    return (h->flags & hmap_flag_indirect) ? sizeof(uint32_t) : h->val_size;
 }
 
-static inline hmap_iter hmap_iter_end(hmap *h)
+static inline size_t hmap_stride(hmap *h)
 {
-    return hmap_iter_make(h, h->limit);
+    return h->key_size + hmap_slot_val_size(h);
 }
 
-static inline void* hmap_userdata(hmap *h)
+/* with hmap_flag_soa values follow the key array at an 8-byte aligned offset */
+static inline size_t hmap_vals_offset(hmap *h, size_t limit)
 {
-    return h->userdata;
+    return (h->key_size * limit + 7) & ~(size_t)7;
 }
 
-static inline size_t hmap_size(hmap *h)
+static inline unsigned char* hmap_table_key(hmap *h,
+    unsigned char *data, size_t limit, size_t idx)
 {
-    return h->used * (h->key_size + h->val_size);
+    (void)limit;
+    if (h->flags & hmap_flag_soa) return data + idx * h->key_size;
+    return data + idx * hmap_stride(h);
 }
 
-static inline size_t hmap_count(hmap *h)
+static inline unsigned char* hmap_table_val(hmap *h,
+    unsigned char *data, size_t limit, size_t idx)
 {
-    return h->used;
+    if (h->flags & hmap_flag_soa) {
+        return data + hmap_vals_offset(h, limit) + idx * hmap_slot_val_size(h);
+    }
+    return data + h->key_size + idx * hmap_stride(h);
 }
 
-static inline size_t hmap_capacity(hmap *h)
+static inline void* hmap_data_key(hmap *h, size_t idx)
 {
-    return h->limit;
+    return hmap_table_key(h, h->data, h->limit, idx);
 }
 
-static inline size_t hmap_load(hmap *h)
+/* the value part of slot idx, which holds the handle when indirect */
+static inline void* hmap_data_slot(hmap *h, size_t idx)
 {
-    return (h->used + h->tombs) * hmap_load_multiplier / h->limit;
+    return hmap_table_val(h, h->data, h->limit, idx);
 }
 
-static inline size_t hmap_index_mask(hmap *h)
+/* slots are only 4-byte aligned when key_size is a multiple of 4 */
+static inline uint32_t hmap_slot_handle(const void *slot)
 {
-    return h->limit - 1;
+    uint32_t v;
+    memcpy(&v, slot, sizeof(v));
+    return v;
 }
 
-static inline size_t hmap_hash_index(hmap *h, size_t i)
+static inline void* hmap_data_val(hmap *h, size_t idx)
 {
-    return i & hmap_index_mask(h);
+    void *slot = hmap_data_slot(h, idx);
+    if (h->flags & hmap_flag_indirect) return hmap_slab_val(h, hmap_slot_handle(slot));
+    return slot;
 }
 
-static inline size_t hmap_key_index(hmap *h, void *key)
+/* copies the key and value of slot idx in an old table into slot j */
+static inline void hmap_slot_copy(hmap *h, size_t j,
+    unsigned char *data, size_t limit, size_t idx)
 {
-    return hmap_hash_index(h, h->hasher(h, key));
+    memcpy(hmap_data_key(h, j), hmap_table_key(h, data, limit, idx), h->key_size);
+    memcpy(hmap_data_slot(h, j), hmap_table_val(h, data, limit, idx), hmap_slot_val_size(h));
 }
 
-static inline void hmap_init_ex(hmap *h, void *userdata,
-    size_t key_size, size_t val_size, size_t limit,
-    hmap_hash_fn hasher, hmap_compare_fn compare)
+static inline int hmap_slot_occupied(hmap *h, size_t idx)
 {
-    size_t stride = key_size + val_size;
-    size_t data_size = stride * limit;
-    size_t bitmap_size = hmap_bitmap_size(limit);
-    size_t total_size = data_size + bitmap_size;
-
-    assert(hmap_ispow2(limit));
+    if (h->flags & hmap_flag_tags) {
+        return (h->ctrl[idx] & 0x80) == 0;
+    }
+    return (hmap_bitmap_get(h->bitmap, idx) & hmap_occupied) == hmap_occupied;
+}
 
-    h->key_size = key_size;
-    h->val_size = val_size;
-    h->used = 0;
-    h->tombs = 0;
-    h->limit = limit;
-    h->hasher = hasher;
-    h->compare = compare;
-    h->data = (unsigned char*)malloc(total_size);
-    h->bitmap = (uint64_t*)(h->data + data_size);
-    h->userdata = userdata;
+static const uint64_t hmap_bitmap_occupied_mask = 0x5555555555555555ull;
 
-    memset(h->data, 0, total_size);
+/* returns the first occupied bitmap slot in [idx,end), 32 slots per word */
+static inline size_t hmap_bitmap_scan(uint64_t *bitmap, size_t idx, size_t end)
+{
+    if (idx >= end) return end;
+    size_t w = hmap_bitmap_idx(idx), last = hmap_bitmap_idx(end - 1);
+    uint64_t m = bitmap[w] & hmap_bitmap_occupied_mask &
+        (~(uint64_t)0 << hmap_bitmap_shift(idx));
+    while (!m) {
+        if (++w > last) return end;
+        m = bitmap[w] & hmap_bitmap_occupied_mask;
+    }
+    idx = (w << 5) + (hmap_ctz64(m) >> 1);
+    return idx < end ? idx : end;
 }
 
-static inline void hmap_init(hmap *h,
-    size_t key_size, size_t val_size, size_t limit)
+/* returns the first full control byte in [idx,end), a group at a time */
+static inline size_t hmap_ctrl_scan(const unsigned char *ctrl, size_t idx, size_t end)
 {
-    hmap_init_ex(h, NULL, key_size, val_size, limit,
-        hmap_default_hash_fn, hmap_default_compare_fn);
+    if (idx >= end) return end;
+    size_t g = idx & ~(size_t)(HMAP_GROUP_WIDTH - 1);
+    uint64_t m = hmap_group_from(hmap_group_match_full(ctrl + g), (unsigned)(idx - g));
+    while (!m) {
+        if ((g += HMAP_GROUP_WIDTH) >= end) return end;
+        m = hmap_group_match_full(ctrl + g);
+    }
+    idx = g + hmap_group_next(m);
+    return idx < end ? idx : end;
 }
 
-static inline void hmap_destroy(hmap *h)
+/* returns the first occupied slot in [idx,end) or end */
+static inline size_t hmap_slot_scan(hmap *h, size_t idx, size_t end)
 {
-    free(h->data);
-    h->data = NULL;
-    h->bitmap = NULL;
+    if (h->flags & hmap_flag_tags) return hmap_ctrl_scan(h->ctrl, idx, end);
+    return hmap_bitmap_scan(h->bitmap, idx, end);
 }
 
-static inline void hmap_resize_internal(hmap *h,
-    unsigned char *old_data, uint64_t *old_bitmap, size_t old_limit, size_t new_limit)
+static inline size_t hmap_iter_step(hmap *h, size_t idx)
 {
-    size_t stride = h->key_size + h->val_size;
-    size_t data_size = stride * new_limit;
-    size_t bitmap_size = hmap_bitmap_size(new_limit);
-    size_t total_size = data_size + bitmap_size;
+    return hmap_slot_scan(h, idx, h->limit);
+}
 
-    assert(hmap_ispow2(new_limit));
+/* stop bounds the slots next steps to, lowered by hmap_iter_erase */
+static inline hmap_iter hmap_iter_make(hmap *h, size_t idx)
+{
+    hmap_iter iter = { h, idx, h->limit }; return iter;
+}
 
-    h->data = (unsigned char*)malloc(total_size);
-    h->bitmap = (uint64_t*)((char*)h->data + data_size);
+static inline hmap_iter hmap_iter_next(hmap_iter iter)
+{
+    size_t idx = hmap_slot_scan(iter.h, iter.idx + 1, iter.stop);
+    iter.idx = idx < iter.stop ? idx : iter.h->limit;
+    return iter;
+}
+
+/*
+ * iterators always hold an occupied slot or the end index, as begin, next,
+ * iter_from, find and insert step to one, so access needs no bitmap decode.
+ */
+static inline void* hmap_iter_key(hmap_iter iter)
+{
+    return hmap_data_key(iter.h, iter.idx);
+}
+
+static inline void* hmap_iter_val(hmap_iter iter)
+{
+    return hmap_data_val(iter.h, iter.idx);
+}
+
+static inline int hmap_iter_eq(hmap_iter iter1, hmap_iter iter2)
+{
+    return iter1.h == iter2.h && iter1.idx == iter2.idx;
+}
+
+static inline int hmap_iter_neq(hmap_iter iter1, hmap_iter iter2)
+{
+    return iter1.h != iter2.h || iter1.idx != iter2.idx;
+}
+
+static inline hmap_iter hmap_iter_begin(hmap *h)
+{
+    hmap_migrate(h);
+    return hmap_iter_make(h, hmap_iter_step(h, 0));
+}
+
+static inline hmap_iter hmap_iter_end(hmap *h)
+{
+    return hmap_iter_make(h, h->limit);
+}
+
+/*
+ * returns an iterator at the first entry in slot idx or after it. with
+ * hmap_iter_next while iter.idx is below b, it walks the slots [a,b) so a
+ * scan can be split into ranges of hmap_capacity. it does not migrate.
+ */
+static inline hmap_iter hmap_iter_from(hmap *h, size_t idx)
+{
+    return hmap_iter_make(h, hmap_iter_step(h, idx));
+}
+
+static inline void* hmap_userdata(hmap *h)
+{
+    return h->userdata;
+}
+
+static inline size_t hmap_size(hmap *h)
+{
+    return h->used * (h->key_size + h->val_size);
+}
+
+static inline size_t hmap_count(hmap *h)
+{
+    return h->used;
+}
+
+static inline size_t hmap_capacity(hmap *h)
+{
+    return h->limit;
+}
+
+static inline size_t hmap_load(hmap *h)
+{
+    return (h->used + h->tombs) * hmap_load_multiplier / h->limit;
+}
+
+static inline size_t hmap_index_mask(hmap *h)
+{
+    return h->limit - 1;
+}
+
+static inline size_t hmap_hash_index(hmap *h, size_t i)
+{
+    return i & hmap_index_mask(h);
+}
+
+static inline size_t hmap_key_index(hmap *h, void *key)
+{
+    return hmap_hash_index(h, h->hasher(h, key));
+}
+
+static inline size_t hmap_data_size(hmap *h, size_t limit)
+{
+    if (h->flags & hmap_flag_soa) {
+        return (hmap_vals_offset(h, limit) + hmap_slot_val_size(h) * limit + 7) & ~(size_t)7;
+    }
+    return (hmap_stride(h) * limit + 7) & ~(size_t)7;
+}
+
+static inline size_t hmap_hashes_size(hmap *h, size_t limit)
+{
+    return (h->flags & hmap_flag_hashes) ? sizeof(size_t) * limit : 0;
+}
+
+static inline size_t hmap_meta_size(hmap *h, size_t limit)
+{
+    return (h->flags & hmap_flag_tags) ? hmap_ctrl_size(limit) : hmap_bitmap_size(limit);
+}
+
+static inline size_t hmap_total_size(hmap *h, size_t limit)
+{
+    return hmap_data_size(h, limit) + hmap_hashes_size(h, limit) + hmap_meta_size(h, limit);
+}
+
+static inline unsigned char* hmap_alloc_table(hmap *h, size_t limit)
+{
+    hmap_stat(h, alloc_bytes += hmap_total_size(h, limit));
+    return (unsigned char*)h->allocator.alloc(h->allocator.userdata, hmap_total_size(h, limit));
+}
+
+static inline void hmap_free_table(hmap *h, unsigned char *data, size_t limit)
+{
+    if (data) h->allocator.free(h->allocator.userdata, data, hmap_total_size(h, limit));
+}
+
+/* points hashes, bitmap or ctrl at the arrays following data */
+static inline void hmap_meta_bind(hmap *h)
+{
+    unsigned char *meta = h->data + hmap_data_size(h, h->limit);
+
+    h->hashes = (h->flags & hmap_flag_hashes) ? (size_t*)meta : NULL;
+    meta += hmap_hashes_size(h, h->limit);
+    h->bitmap = (h->flags & hmap_flag_tags) ? NULL : (uint64_t*)meta;
+    h->ctrl = (h->flags & hmap_flag_tags) ? meta : NULL;
+}
+
+/* binds and clears the metadata arrays for an empty table */
+static inline void hmap_meta_init(hmap *h)
+{
+    hmap_meta_bind(h);
+    if (h->ctrl) {
+        memset(h->ctrl, hmap_ctrl_empty, hmap_ctrl_size(h->limit));
+    } else {
+        memset(h->bitmap, 0, hmap_bitmap_size(h->limit));
+    }
+}
+
+/* rejects on the cached hash if present before calling compare */
+static inline int hmap_slot_match(hmap *h, size_t i, size_t hash, void *key)
+{
+    if (h->hashes && h->hashes[i] != hash) return 0;
+    hmap_stat(h, compares++);
+    return h->compare(h, hmap_data_key(h, i), key);
+}
+
+static inline void hmap_slot_set_hash(hmap *h, size_t i, size_t hash)
+{
+    if (h->hashes) h->hashes[i] = hash;
+}
+
+static inline void hmap_init_opts(hmap *h, const hmap_opts *opts)
+{
+    size_t limit = opts->limit;
+
+    if ((opts->flags & hmap_flag_tags) && limit < HMAP_GROUP_WIDTH) {
+        limit = HMAP_GROUP_WIDTH;
+    }
+
+    assert(hmap_ispow2(limit));
+    assert(!(opts->flags & hmap_flag_tags) || !(opts->flags & hmap_flag_robin_hood));
+    assert(!(opts->flags & hmap_flag_incremental) ||
+        !(opts->flags & (hmap_flag_tags | hmap_flag_robin_hood)));
+    assert(opts->max_load < hmap_load_multiplier && opts->min_load <= opts->max_load >> 2);
+
+    h->key_size = opts->key_size;
+    h->val_size = opts->val_size;
+    h->used = 0;
+    h->tombs = 0;
+    h->limit = limit;
+    h->max_load = opts->max_load;
+    h->min_load = opts->min_load;
+    h->flags = opts->flags;
+    h->seed = opts->seed;
+    h->hasher = opts->hasher;
+    h->compare = opts->compare;
+    h->allocator = opts->allocator;
+    h->userdata = opts->userdata;
+    h->old_data = NULL;
+    h->old_hashes = NULL;
+    h->old_bitmap = NULL;
+    h->old_limit = 0;
+    h->old_used = 0;
+    h->old_pos = 0;
+    hmap_slab_init(h);
+    h->rehash = NULL;
+    h->rehash_threads = 0;
+    hmap_stats_reset(h);
+
+    h->data = hmap_alloc_table(h, limit);
+    memset(h->data, 0, hmap_data_size(h, limit));
+    hmap_meta_init(h);
+}
+
+static inline hmap_opts hmap_opts_make(size_t key_size, size_t val_size)
+{
+    hmap_opts opts = {
+        NULL, key_size, val_size, hmap_default_size, hmap_load_factor, 0,
+        hmap_flag_none, hmap_random_seed(),
+        hmap_default_hash_fn, hmap_default_compare_fn,
+        { hmap_default_alloc_fn, hmap_default_free_fn, NULL }
+    };
+    return opts;
+}
+
+static inline void hmap_init_ex(hmap *h, void *userdata,
+    size_t key_size, size_t val_size, size_t limit,
+    hmap_hash_fn hasher, hmap_compare_fn compare)
+{
+    hmap_opts opts = hmap_opts_make(key_size, val_size);
+    opts.userdata = userdata;
+    opts.limit = limit;
+    opts.hasher = hasher;
+    opts.compare = compare;
+    hmap_init_opts(h, &opts);
+}
+
+static inline void hmap_init(hmap *h,
+    size_t key_size, size_t val_size, size_t limit)
+{
+    hmap_init_ex(h, NULL, key_size, val_size, limit,
+        hmap_default_hash_fn, hmap_default_compare_fn);
+}
+
+static inline void hmap_destroy(hmap *h)
+{
+    hmap_free_table(h, h->old_data, h->old_limit);
+    h->old_data = NULL;
+    hmap_free_table(h, h->data, h->limit);
+    h->data = NULL;
+    h->hashes = NULL;
+    h->bitmap = NULL;
+    h->ctrl = NULL;
+    hmap_slab_destroy(h);
+}
+
+/* returns the first empty or deleted slot in the group probe sequence */
+static inline size_t hmap_ctrl_find_free(hmap *h, size_t hash)
+{
+    for (size_t g = hmap_hash_index(h, hash) & ~(size_t)(HMAP_GROUP_WIDTH-1); ;
+         g = (g + HMAP_GROUP_WIDTH) & hmap_index_mask(h))
+    {
+        uint64_t m = hmap_group_match_free(h->ctrl + g);
+        if (m) return g + hmap_group_next(m);
+    }
+}
+
+/* returns the slot holding key or hmap_empty_offset */
+static inline size_t hmap_ctrl_find(hmap *h, void *key, size_t hash)
+{
+    unsigned char tag = hmap_hash_tag(hash);
+    for (size_t g = hmap_hash_index(h, hash) & ~(size_t)(HMAP_GROUP_WIDTH-1); ;
+         g = (g + HMAP_GROUP_WIDTH) & hmap_index_mask(h))
+    {
+        for (uint64_t m = hmap_group_match(h->ctrl + g, tag); m; m &= m - 1) {
+            size_t i = g + hmap_group_next(m);
+            if (hmap_slot_match(h, i, hash, key)) return i;
+        }
+        if (hmap_group_match_empty(h->ctrl + g)) return hmap_empty_offset;
+    }
+}
+
+static inline void hmap_ctrl_resize_internal(hmap *h, size_t new_limit)
+{
+    unsigned char *old_data = h->data, *old_ctrl = h->ctrl;
+    size_t *old_hashes = h->hashes;
+    size_t old_limit = h->limit;
+
+    assert(hmap_ispow2(new_limit));
+
+    h->data = hmap_alloc_table(h, new_limit);
     h->limit = new_limit;
-    memset(h->bitmap, 0, bitmap_size);
+    hmap_meta_init(h);
+
+    for (size_t i = 0; i < old_limit; i++) {
+        if (old_ctrl[i] & 0x80) continue;
+        unsigned char *k = hmap_table_key(h, old_data, old_limit, i);
+        size_t hash = old_hashes ? old_hashes[i] : h->hasher(h, k);
+        size_t j = hmap_ctrl_find_free(h, hash);
+        h->ctrl[j] = hmap_hash_tag(hash);
+        hmap_slot_set_hash(h, j, hash);
+        hmap_slot_copy(h, j, old_data, old_limit, i);
+    }
+
+    h->tombs = 0;
+    hmap_free_table(h, old_data, old_limit);
+}
+
+static inline void hmap_resize_internal(hmap *h,
+    unsigned char *old_data, uint64_t *old_bitmap, size_t old_limit, size_t new_limit)
+{
+    size_t *old_hashes = h->hashes;
+
+    assert(hmap_ispow2(new_limit));
 
-    size_t i = 0;
-    for (unsigned char *k = old_data; k != old_data + old_limit * stride; k += stride, i++) {
+    h->data = hmap_alloc_table(h, new_limit);
+    h->limit = new_limit;
+    hmap_meta_init(h);
+
+    for (size_t i = 0; i < old_limit; i++) {
         if ((hmap_bitmap_get(old_bitmap, i) & hmap_occupied) != hmap_occupied) continue;
-        for (size_t j = hmap_key_index(h, k); ; j = (j+1) & hmap_index_mask(h)) {
+        unsigned char *k = hmap_table_key(h, old_data, old_limit, i);
+        size_t hash = old_hashes ? old_hashes[i] : h->hasher(h, k);
+        for (size_t j = hmap_hash_index(h, hash); ; j = (j+1) & hmap_index_mask(h)) {
             if ((hmap_bitmap_get(h->bitmap, j) & hmap_occupied) != hmap_occupied) {
                 hmap_bitmap_set(h->bitmap, j, hmap_occupied);
-                memcpy(hmap_data_key(h, j), k, stride);
+                hmap_slot_set_hash(h, j, hash);
+                hmap_slot_copy(h, j, old_data, old_limit, i);
                 break;
             }
         }
     }
-
-    h->tombs = 0;
-    free(old_data);
+
+    h->tombs = 0;
+    hmap_free_table(h, old_data, old_limit);
+}
+
+static inline void hmap_clear(hmap *h)
+{
+    hmap_free_table(h, h->old_data, h->old_limit);
+    h->old_data = NULL;
+    h->old_used = 0;
+    if (h->flags & hmap_flag_tags) {
+        memset(h->ctrl, hmap_ctrl_empty, hmap_ctrl_size(h->limit));
+    } else {
+        memset(h->bitmap, 0, hmap_bitmap_size(h->limit));
+    }
+    h->used = h->tombs = 0;
+    h->slab_next = 0;
+    h->slab_free = hmap_slab_none;
+}
+
+static inline size_t hmap_ctrl_claim(hmap *h, void *key, size_t hash)
+{
+    size_t i = hmap_ctrl_find_free(h, hash);
+    if (h->ctrl[i] == hmap_ctrl_deleted) h->tombs--;
+    h->ctrl[i] = hmap_hash_tag(hash);
+    hmap_slot_set_hash(h, i, hash);
+    memcpy(hmap_data_key(h, i), key, h->key_size);
+    h->used++;
+    return i;
+}
+
+static inline void hmap_ctrl_erase_at(hmap *h, size_t i)
+{
+    /*
+     * groups only regain empty slots here, so if the group still has an
+     * empty slot no probe sequence has ever continued past it.
+     */
+    size_t g = i & ~(size_t)(HMAP_GROUP_WIDTH-1);
+    if (hmap_group_match_empty(h->ctrl + g)) {
+        h->ctrl[i] = hmap_ctrl_empty;
+    } else {
+        h->ctrl[i] = hmap_ctrl_deleted;
+        h->tombs++;
+    }
+    h->used--;
+}
+
+/* empties deleted slots in groups with an empty slot, returning the count */
+static inline size_t hmap_ctrl_reclaim(hmap *h)
+{
+    size_t reclaimed = 0;
+    for (size_t g = 0; g < h->limit; g += HMAP_GROUP_WIDTH) {
+        if (!hmap_group_match_empty(h->ctrl + g)) continue;
+        for (size_t i = g; i < g + HMAP_GROUP_WIDTH; i++) {
+            if (h->ctrl[i] == hmap_ctrl_deleted) {
+                h->ctrl[i] = hmap_ctrl_empty;
+                reclaimed++;
+            }
+        }
+    }
+    return reclaimed;
+}
+
+/*
+ * robin hood probing
+ *
+ * entries are kept ordered by probe distance within each run so lookups
+ * stop once they pass an entry closer to its home slot than the key
+ * would be, and erase shifts the rest of the run back by one slot so no
+ * tombstones are left behind. probe distances come from the cached hash
+ * array when hmap_flag_hashes is set and from the hasher otherwise; the
+ * early exit on lookup is only taken with cached hashes.
+ */
+
+static inline size_t hmap_rh_dist(hmap *h, size_t i)
+{
+    size_t hash = h->hashes ? h->hashes[i] : h->hasher(h, hmap_data_key(h, i));
+    return (i - hmap_hash_index(h, hash)) & hmap_index_mask(h);
+}
+
+static inline void hmap_rh_move(hmap *h, size_t to, size_t from)
+{
+    memcpy(hmap_data_key(h, to), hmap_data_key(h, from), h->key_size);
+    memcpy(hmap_data_slot(h, to), hmap_data_slot(h, from), hmap_slot_val_size(h));
+    if (h->hashes) h->hashes[to] = h->hashes[from];
+    hmap_bitmap_set(h->bitmap, to, hmap_occupied);
+}
+
+static inline size_t hmap_rh_find(hmap *h, void *key, size_t hash)
+{
+    size_t i = hmap_hash_index(h, hash);
+    for (size_t d = 0; ; i = (i+1) & hmap_index_mask(h), d++) {
+        if (!hmap_slot_occupied(h, i)) return hmap_empty_offset;
+        if (h->hashes && hmap_rh_dist(h, i) < d) return hmap_empty_offset;
+        if (hmap_slot_match(h, i, hash, key)) return i;
+    }
+}
+
+/* inserts key at its robin hood position shifting the rest of the run */
+static inline size_t hmap_rh_insert_internal(hmap *h, void *key, size_t hash)
+{
+    size_t mask = hmap_index_mask(h), p = hmap_hash_index(h, hash), d = 0;
+    while (hmap_slot_occupied(h, p) && hmap_rh_dist(h, p) >= d) {
+        p = (p+1) & mask; d++;
+    }
+    size_t e = p;
+    while (hmap_slot_occupied(h, e)) e = (e+1) & mask;
+    for (size_t j = e; j != p; j = (j-1) & mask) {
+        hmap_rh_move(h, j, (j-1) & mask);
+    }
+    hmap_bitmap_set(h->bitmap, p, hmap_occupied);
+    hmap_slot_set_hash(h, p, hash);
+    memcpy(hmap_data_key(h, p), key, h->key_size);
+    h->used++;
+    return p;
+}
+
+static inline void hmap_rh_resize_internal(hmap *h, size_t new_limit)
+{
+    unsigned char *old_data = h->data;
+    uint64_t *old_bitmap = h->bitmap;
+    size_t *old_hashes = h->hashes;
+    size_t old_limit = h->limit;
+
+    assert(hmap_ispow2(new_limit));
+
+    h->data = hmap_alloc_table(h, new_limit);
+    h->limit = new_limit;
+    h->used = 0;
+    hmap_meta_init(h);
+
+    for (size_t i = 0; i < old_limit; i++) {
+        if ((hmap_bitmap_get(old_bitmap, i) & hmap_occupied) != hmap_occupied) continue;
+        unsigned char *k = hmap_table_key(h, old_data, old_limit, i);
+        size_t hash = old_hashes ? old_hashes[i] : h->hasher(h, k);
+        size_t j = hmap_rh_insert_internal(h, k, hash);
+        memcpy(hmap_data_slot(h, j), hmap_table_val(h, old_data, old_limit, i),
+            hmap_slot_val_size(h));
+    }
+
+    hmap_free_table(h, old_data, old_limit);
+}
+
+/* shifts the rest of the run back over slot i, returning the slot vacated */
+static inline size_t hmap_rh_erase_at(hmap *h, size_t i)
+{
+    size_t mask = hmap_index_mask(h);
+    for (size_t j = (i+1) & mask;
+         hmap_slot_occupied(h, j) && hmap_rh_dist(h, j) > 0;
+         i = j, j = (j+1) & mask)
+    {
+        hmap_rh_move(h, i, j);
+    }
+    hmap_bitmap_clear(h->bitmap, i, hmap_recycled);
+    h->used--;
+    return i;
+}
+
+/*
+ * removes slots marked deleted in one pass, starting after an available
+ * slot so no run wraps past the start. each entry moves back over the
+ * vacated slots before it, but never before its home slot, which keeps
+ * the runs ordered by probe distance as a series of backward shifts would.
+ */
+static inline void hmap_rh_compact(hmap *h)
+{
+    size_t mask = hmap_index_mask(h), s = 0;
+    while (s < h->limit && hmap_bitmap_get(h->bitmap, s) != hmap_available) s++;
+    assert(s < h->limit);
+
+    size_t w = (s+1) & mask;
+    for (size_t n = 1; n < h->limit; n++) {
+        size_t r = (s+n) & mask;
+        hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, r);
+        if (state == hmap_available) {
+            w = (r+1) & mask;
+        } else if (state == hmap_deleted) {
+            hmap_bitmap_clear(h->bitmap, r, hmap_recycled);
+        } else {
+            size_t d = hmap_rh_dist(h, r), gap = (r - w) & mask;
+            size_t t = (r - (d < gap ? d : gap)) & mask;
+            if (t != r) {
+                hmap_rh_move(h, t, r);
+                hmap_bitmap_clear(h->bitmap, r, hmap_recycled);
+            }
+            w = (t+1) & mask;
+        }
+    }
+}
+
+/*
+ * bitmap probing
+ */
+
+static inline size_t hmap_bitmap_find(hmap *h, void *key, size_t hash)
+{
+    for (size_t i = hmap_hash_index(h, hash); ; i = (i+1) & hmap_index_mask(h)) {
+        hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
+             if (state == hmap_available)           /* notfound */ break;
+        else if (state == hmap_deleted);            /* skip */
+        else if (hmap_slot_match(h, i, hash, key)) return i;
+    }
+    return hmap_empty_offset;
+}
+
+/* claims the first available or deleted slot, key must not be present */
+static inline size_t hmap_bitmap_claim(hmap *h, void *key, size_t hash)
+{
+    for (size_t i = hmap_hash_index(h, hash); ; i = (i+1) & hmap_index_mask(h)) {
+        hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
+        if ((state & hmap_occupied) != hmap_occupied) {
+            hmap_bitmap_set(h->bitmap, i, hmap_occupied);
+            hmap_slot_set_hash(h, i, hash);
+            memcpy(hmap_data_key(h, i), key, h->key_size);
+            h->used++;
+            if ((state & hmap_deleted) == hmap_deleted) h->tombs--;
+            return i;
+        }
+    }
+}
+
+static inline void hmap_bitmap_erase_at(hmap *h, size_t i)
+{
+    hmap_bitmap_set(h->bitmap, i, hmap_deleted);
+    hmap_bitmap_clear(h->bitmap, i, hmap_occupied);
+    h->used--;
+    h->tombs++;
+}
+
+/*
+ * makes deleted slots available, returning the count. a deleted slot
+ * followed by an available one ends every probe run through it, so it
+ * can be freed, and walking backwards from an available slot lets that
+ * cascade through whole runs of tombstones.
+ */
+static inline size_t hmap_bitmap_reclaim(uint64_t *bitmap, size_t limit)
+{
+    size_t mask = limit - 1, s = 0, reclaimed = 0;
+    while (s < limit && hmap_bitmap_get(bitmap, s) != hmap_available) s++;
+    if (s == limit) return 0;
+
+    for (size_t n = 1, next = s; n < limit; n++) {
+        size_t r = (s - n) & mask;
+        if (hmap_bitmap_get(bitmap, r) == hmap_deleted &&
+            hmap_bitmap_get(bitmap, next) == hmap_available) {
+            hmap_bitmap_clear(bitmap, r, hmap_recycled);
+            reclaimed++;
+        }
+        next = r;
+    }
+    return reclaimed;
+}
+
+/*
+ * incremental resize
+ *
+ * the old table is drained from slot zero upwards by hmap_migrate_step.
+ * migrated and erased old slots become tombstones, so old probe chains
+ * stay intact and always end at an available slot. h->used counts the
+ * entries in both tables and h->old_used those still in the old table.
+ */
+
+static const size_t hmap_migrate_slots = 16;
+
+static inline size_t hmap_old_find(hmap *h, void *key, size_t hash)
+{
+    size_t mask = h->old_limit - 1;
+    for (size_t i = hash & mask; ; i = (i+1) & mask) {
+        hmap_bitmap_state state = hmap_bitmap_get(h->old_bitmap, i);
+             if (state == hmap_available)           /* notfound */ break;
+        else if (state == hmap_deleted);            /* skip */
+        else if (!h->old_hashes || h->old_hashes[i] == hash) {
+            hmap_stat(h, compares++);
+            if (h->compare(h, hmap_table_key(h, h->old_data, h->old_limit, i), key)) return i;
+        }
+    }
+    return hmap_empty_offset;
+}
+
+static inline void hmap_old_erase_at(hmap *h, size_t i)
+{
+    hmap_bitmap_set(h->old_bitmap, i, hmap_deleted);
+    hmap_bitmap_clear(h->old_bitmap, i, hmap_occupied);
+    h->old_used--;
+    h->used--;
+}
+
+/* moves old slot i into the new table, which must have room for it */
+static inline size_t hmap_old_move(hmap *h, size_t i)
+{
+    unsigned char *k = hmap_table_key(h, h->old_data, h->old_limit, i);
+    size_t hash = h->old_hashes ? h->old_hashes[i] : h->hasher(h, k);
+    size_t j = hmap_bitmap_claim(h, k, hash);
+    memcpy(hmap_data_slot(h, j), hmap_table_val(h, h->old_data, h->old_limit, i),
+        hmap_slot_val_size(h));
+    hmap_old_erase_at(h, i);
+    return j;
+}
+
+static inline void hmap_migrate_done(hmap *h)
+{
+    hmap_free_table(h, h->old_data, h->old_limit);
+    h->old_data = NULL;
+    h->old_hashes = NULL;
+    h->old_bitmap = NULL;
+    h->old_limit = 0;
+}
+
+static inline void hmap_migrate_step(hmap *h, size_t slots)
+{
+    size_t end = h->old_pos + slots;
+    if (end > h->old_limit) end = h->old_limit;
+    for (size_t i = h->old_pos; i < end && h->old_used; i++) {
+        if (hmap_bitmap_get(h->old_bitmap, i) & hmap_occupied) hmap_old_move(h, i);
+    }
+    h->old_pos = end;
+    if (h->old_pos == h->old_limit || !h->old_used) hmap_migrate_done(h);
+}
+
+static inline void hmap_migrate(hmap *h)
+{
+    if (h->old_data) hmap_migrate_step(h, h->old_limit);
+}
+
+/* swaps in an empty table of new_limit and keeps the current one as old */
+static inline void hmap_migrate_begin(hmap *h, size_t new_limit)
+{
+    assert(hmap_ispow2(new_limit));
+
+    hmap_migrate(h);
+    h->old_data = h->data;
+    h->old_hashes = h->hashes;
+    h->old_bitmap = h->bitmap;
+    h->old_limit = h->limit;
+    h->old_used = h->used;
+    h->old_pos = 0;
+
+    h->data = hmap_alloc_table(h, new_limit);
+    h->limit = new_limit;
+    h->tombs = 0;
+    hmap_meta_init(h);
+}
+
+/*
+ * sizing
+ *
+ * inserts that would take used + tombs over max_load grow the table, or
+ * rehash at the same size to purge tombstones. erases that take used
+ * under min_load shrink the table to half of max_load. in incremental
+ * mode these start a migration, while reserve and shrink_to_fit finish
+ * any migration and rehash at once.
+ */
+
+static inline size_t hmap_min_limit(hmap *h)
+{
+    return (h->flags & hmap_flag_tags) ? HMAP_GROUP_WIDTH : 2;
+}
+
+/* returns the smallest power of two limit holding count entries at load */
+static inline size_t hmap_fit_limit(size_t count, size_t load, size_t min_limit)
+{
+    size_t limit = min_limit;
+    while (count * hmap_load_multiplier / limit > load) limit <<= 1;
+    return limit;
+}
+
+static inline void hmap_rehash_internal(hmap *h, size_t new_limit)
+{
+    uint64_t t0 = hmap_stats_clock();
+    hmap_migrate(h);
+    if (h->rehash && h->rehash(h, new_limit)) {
+        /* rehashed by the installed hook */
+    } else if (h->flags & hmap_flag_tags) {
+        hmap_ctrl_resize_internal(h, new_limit);
+    } else if (h->flags & hmap_flag_robin_hood) {
+        hmap_rh_resize_internal(h, new_limit);
+    } else {
+        hmap_resize_internal(h, h->data, h->bitmap, h->limit, new_limit);
+    }
+    hmap_stat_resize(h, t0);
+}
+
+/*
+ * purges tombstones at the same size while live entries stay within three
+ * quarters of max_load, otherwise doubles. the margin keeps a purge from
+ * being followed almost immediately by another one.
+ */
+static inline size_t hmap_grow_limit(size_t used, size_t limit, size_t max_load)
+{
+    int purge = used * hmap_load_multiplier / limit <= max_load - (max_load >> 2);
+    return purge ? limit : limit << 1;
+}
+
+static inline void hmap_resize_begin(hmap *h, size_t new_limit)
+{
+    if (h->flags & hmap_flag_incremental) {
+        uint64_t t0 = hmap_stats_clock();
+        hmap_migrate_begin(h, new_limit);
+        hmap_stat_resize(h, t0);
+    } else {
+        hmap_rehash_internal(h, new_limit);
+    }
+}
+
+static inline void hmap_grow_internal(hmap *h)
+{
+    hmap_resize_begin(h, hmap_grow_limit(h->used, h->limit, h->max_load));
+}
+
+static inline void hmap_shrink_internal(hmap *h)
+{
+    size_t limit = hmap_fit_limit(h->used, h->max_load >> 1, hmap_min_limit(h));
+    if (limit < h->limit) hmap_resize_begin(h, limit);
+}
+
+static inline void hmap_reserve(hmap *h, size_t count)
+{
+    size_t limit = hmap_fit_limit(count, h->max_load, hmap_min_limit(h));
+    if (limit < h->limit) limit = h->limit;
+    if (limit != h->limit || (count + h->tombs) *
+        hmap_load_multiplier / limit > h->max_load)
+    {
+        hmap_rehash_internal(h, limit);
+    }
+}
+
+static inline void hmap_shrink_to_fit(hmap *h)
+{
+    hmap_migrate(h);
+    size_t limit = hmap_fit_limit(h->used, h->max_load, hmap_min_limit(h));
+    if (limit != h->limit || h->tombs) hmap_rehash_internal(h, limit);
+}
+
+/*
+ * hmap operations
+ */
+
+/* new table load after one more insert, excluding entries not migrated */
+static inline int hmap_claim_overload(hmap *h)
+{
+    return (h->used - h->old_used + h->tombs + 1) *
+        hmap_load_multiplier / h->limit > h->max_load;
+}
+
+/* finds key in the new table, moving it there if it is still in the old */
+static inline size_t hmap_incr_find(hmap *h, void *key, size_t hash)
+{
+    size_t i = hmap_bitmap_find(h, key, hash);
+    if (i != hmap_empty_offset || !h->old_data) return i;
+    i = hmap_old_find(h, key, hash);
+    if (i == hmap_empty_offset) return i;
+    if (hmap_claim_overload(h)) {
+        hmap_grow_internal(h);
+        return hmap_incr_find(h, key, hash);
+    }
+    return hmap_old_move(h, i);
+}
+
+/* records the probe length of a lookup for hash that returned slot i */
+static inline void hmap_stat_probe(hmap *h, size_t hash, size_t i)
+{
+#if defined(HMAP_STATS)
+    size_t mask = hmap_index_mask(h), home = hmap_hash_index(h, hash), d = 0;
+    if (h->flags & hmap_flag_tags) {
+        size_t g = home & ~(size_t)(HMAP_GROUP_WIDTH-1);
+        if (i != hmap_empty_offset) {
+            d = ((i - g) & mask) / HMAP_GROUP_WIDTH;
+        } else {
+            for (; !hmap_group_match_empty(h->ctrl + g); g = (g + HMAP_GROUP_WIDTH) & mask) d++;
+        }
+    } else if (i != hmap_empty_offset) {
+        d = (i - home) & mask;
+    } else {
+        d = hmap_stats_miss_len(h->bitmap, mask, home);
+    }
+    if (i != hmap_empty_offset) {
+        h->counters.hit_probes[hmap_stats_bucket(d)]++;
+    } else {
+        h->counters.miss_probes[hmap_stats_bucket(d)]++;
+    }
+#else
+    (void)h; (void)hash; (void)i;
+#endif
+}
+
+static inline size_t hmap_find_internal(hmap *h, void *key, size_t hash)
+{
+    size_t i;
+    if (h->flags & hmap_flag_tags) i = hmap_ctrl_find(h, key, hash);
+    else if (h->flags & hmap_flag_robin_hood) i = hmap_rh_find(h, key, hash);
+    else if (h->flags & hmap_flag_incremental) i = hmap_incr_find(h, key, hash);
+    else i = hmap_bitmap_find(h, key, hash);
+    hmap_stat_probe(h, hash, i);
+    return i;
+}
+
+/*
+ * claims a slot for key growing first if the insert would exceed load,
+ * and gives it a slab value when indirect.
+ */
+static inline size_t hmap_claim_internal(hmap *h, void *key, size_t hash)
+{
+    size_t i;
+    if (hmap_claim_overload(h)) hmap_grow_internal(h);
+    if (h->flags & hmap_flag_tags) i = hmap_ctrl_claim(h, key, hash);
+    else if (h->flags & hmap_flag_robin_hood) i = hmap_rh_insert_internal(h, key, hash);
+    else i = hmap_bitmap_claim(h, key, hash);
+    if (h->flags & hmap_flag_indirect) {
+        uint32_t v = hmap_slab_alloc(h);
+        memcpy(hmap_data_slot(h, i), &v, sizeof(v));
+    }
+    return i;
+}
+
+static inline void hmap_erase_at(hmap *h, size_t i)
+{
+    if (h->flags & hmap_flag_indirect) {
+        hmap_slab_release(h, hmap_slot_handle(hmap_data_slot(h, i)));
+    }
+    if (h->flags & hmap_flag_tags) {
+        hmap_ctrl_erase_at(h, i);
+    } else if (h->flags & hmap_flag_robin_hood) {
+        hmap_rh_erase_at(h, i);
+    } else {
+        hmap_bitmap_erase_at(h, i);
+    }
+    if (h->used * hmap_load_multiplier / h->limit < h->min_load) {
+        hmap_shrink_internal(h);
+    }
+}
+
+/* shrinks under min_load, otherwise purges tombstones past max_load / 4 */
+static inline void hmap_erase_rebalance(hmap *h)
+{
+    if (h->used * hmap_load_multiplier / h->limit < h->min_load) {
+        hmap_shrink_internal(h);
+    }
+    if (!h->old_data && h->tombs * hmap_load_multiplier / h->limit > h->max_load >> 2) {
+        hmap_rehash_internal(h, h->limit);
+    }
+}
+
+/*
+ * the _hashed variants take the hash of key from a caller that has already
+ * computed it with h->hasher, for example to choose between several maps.
+ * val may be NULL for a set with val_size zero.
+ */
+
+static inline hmap_iter hmap_insert_hashed(hmap *h, void *key, void *val, size_t hash)
+{
+    if (h->old_data) hmap_migrate_step(h, hmap_migrate_slots);
+    size_t i = hmap_find_internal(h, key, hash);
+    if (i == hmap_empty_offset) i = hmap_claim_internal(h, key, hash);
+    if (h->val_size) memcpy(hmap_data_val(h, i), val, h->val_size);
+    return hmap_iter_make(h, i);
+}
+
+static inline void* hmap_get_hashed(hmap *h, void *key, size_t hash)
+{
+    if (h->old_data) hmap_migrate_step(h, hmap_migrate_slots);
+    size_t i = hmap_find_internal(h, key, hash);
+    if (i == hmap_empty_offset) i = hmap_claim_internal(h, key, hash);
+    return hmap_data_val(h, i);
+}
+
+/*
+ * batched lookup
+ *
+ * keys are looked up in groups of HMAP_BATCH_WIDTH. hashes for the group
+ * are computed and the metadata and home slot of each prefetched before
+ * any probe is resolved, so the cache misses of independent lookups
+ * overlap instead of being serialized behind mispredicted probe loops.
+ * in incremental mode any migration is finished first so that results
+ * stay valid for the whole batch.
+ */
+
+static inline void hmap_prefetch_slot(hmap *h, size_t hash)
+{
+    size_t i = hmap_hash_index(h, hash);
+    if (h->flags & hmap_flag_tags) {
+        hmap_prefetch(h->ctrl + (i & ~(size_t)(HMAP_GROUP_WIDTH-1)));
+    } else {
+        hmap_prefetch(h->bitmap + hmap_bitmap_idx(i));
+    }
+    if (h->hashes) hmap_prefetch(h->hashes + i);
+    hmap_prefetch(hmap_data_key(h, i));
+}
+
+static inline void hmap_batch_internal(hmap *h,
+    void *keys, size_t count, hmap_iter *iters, void **vals)
+{
+    unsigned char *k = (unsigned char*)keys;
+    size_t hashes[HMAP_BATCH_WIDTH];
+
+    hmap_migrate(h);
+    for (size_t b = 0; b < count; b += HMAP_BATCH_WIDTH) {
+        size_t n = count - b < HMAP_BATCH_WIDTH ? count - b : HMAP_BATCH_WIDTH;
+        for (size_t j = 0; j < n; j++) {
+            hashes[j] = h->hasher(h, k + (b + j) * h->key_size);
+            hmap_prefetch_slot(h, hashes[j]);
+        }
+        for (size_t j = b; j < b + n; j++) {
+            size_t i = hmap_find_internal(h, k + j * h->key_size, hashes[j - b]);
+            if (iters) {
+                iters[j] = i == hmap_empty_offset ? hmap_iter_end(h) : hmap_iter_make(h, i);
+            } else {
+                vals[j] = i == hmap_empty_offset ? NULL : hmap_data_val(h, i);
+            }
+        }
+    }
+}
+
+/* finds count keys stored contiguously, missing keys return end */
+static inline void hmap_find_batch(hmap *h,
+    void *keys, size_t count, hmap_iter *iters)
+{
+    hmap_batch_internal(h, keys, count, iters, NULL);
+}
+
+/* returns value pointers for count keys, unlike hmap_get misses are NULL */
+static inline void hmap_get_batch(hmap *h,
+    void *keys, size_t count, void **vals)
+{
+    hmap_batch_internal(h, keys, count, NULL, vals);
+}
+
+/*
+ * visits the entries in slots [begin,end), clamped to hmap_capacity, and
+ * returns the first non-zero result of fn. fn must not insert or erase.
+ * it does not migrate, so disjoint ranges can be visited from several
+ * threads at once once an incremental map has been migrated.
+ */
+static inline int hmap_foreach_range(hmap *h, size_t begin, size_t end,
+    hmap_visit_fn fn, void *ctx)
+{
+    if (end > h->limit) end = h->limit;
+    for (size_t i = hmap_slot_scan(h, begin, end); i < end;
+         i = hmap_slot_scan(h, i + 1, end))
+    {
+        int r = fn(ctx, hmap_data_key(h, i), hmap_data_val(h, i));
+        if (r) return r;
+    }
+    return 0;
+}
+
+/* visits every entry, finishing any incremental migration first */
+static inline int hmap_foreach(hmap *h, hmap_visit_fn fn, void *ctx)
+{
+    hmap_migrate(h);
+    return hmap_foreach_range(h, 0, h->limit, fn, ctx);
+}
+
+/*
+ * set operations
+ *
+ * an hmap with val_size zero is a hash set, and these combine maps into
+ * dst, which must be a different map with the same key and value sizes.
+ * entries already in dst are kept unless a result key replaces them. one
+ * map is walked in groups of HMAP_BATCH_WIDTH slots, hashing each key and
+ * prefetching its probe into the other map before any probe is resolved,
+ * and dst is reserved for the largest possible result first. hashes are
+ * computed once for maps that share hasher, seed and userdata, as maps
+ * made with the same hmap_opts do, and taken from hmap_flag_hashes.
+ */
+
+enum hmap_set_op {
+    hmap_set_copy,      /* src into dst, replacing */
+    hmap_set_add,       /* src into dst, keeping */
+    hmap_set_combine,   /* src into dst, combining */
+    hmap_set_and,       /* src keys found in probe */
+    hmap_set_andnot     /* src keys missing from probe */
+};
+
+static inline int hmap_same_hasher(hmap *a, hmap *b)
+{
+    return a->hasher == b->hasher && a->seed == b->seed && a->userdata == b->userdata;
+}
+
+/* hash of src slot i for probing h */
+static inline size_t hmap_set_hash(hmap *h, hmap *src, size_t i)
+{
+    if (src->hashes && hmap_same_hasher(src, h)) return src->hashes[i];
+    return h->hasher(h, hmap_data_key(src, i));
+}
+
+/*
+ * walks src probing probe, which is dst for the ops that insert src. for
+ * hmap_set_and the value is taken from out, which is src or probe.
+ */
+static inline void hmap_set_batch(hmap *dst, hmap *src, hmap *probe, hmap *out,
+    enum hmap_set_op op, hmap_combine_fn combine, void *ctx)
+{
+    size_t slots[HMAP_BATCH_WIDTH], hashes[HMAP_BATCH_WIDTH];
+    int reuse = hmap_same_hasher(probe, dst);
+
+    hmap_migrate(src);
+    hmap_migrate(probe);
+    for (size_t i = hmap_slot_scan(src, 0, src->limit); i < src->limit; ) {
+        size_t n = 0;
+        for (; n < HMAP_BATCH_WIDTH && i < src->limit; i = hmap_slot_scan(src, i + 1, src->limit)) {
+            slots[n] = i;
+            hashes[n] = hmap_set_hash(probe, src, i);
+            hmap_prefetch_slot(probe, hashes[n++]);
+        }
+        for (size_t j = 0; j < n; j++) {
+            void *key = hmap_data_key(src, slots[j]), *val = hmap_data_val(src, slots[j]);
+            size_t f = hmap_find_internal(probe, key, hashes[j]);
+            if (op == hmap_set_and || op == hmap_set_andnot) {
+                if ((f != hmap_empty_offset) != (op == hmap_set_and)) continue;
+                if (op == hmap_set_and && out == probe) val = hmap_data_val(probe, f);
+                hmap_insert_hashed(dst, key, val,
+                    reuse ? hashes[j] : dst->hasher(dst, key));
+            } else if (f == hmap_empty_offset) {
+                f = hmap_claim_internal(dst, key, hashes[j]);
+                memcpy(hmap_data_val(dst, f), val, dst->val_size);
+            } else if (op == hmap_set_copy || (op == hmap_set_combine && !combine)) {
+                memcpy(hmap_data_val(dst, f), val, dst->val_size);
+            } else if (op == hmap_set_combine) {
+                combine(ctx, key, hmap_data_val(dst, f), val);
+            }
+        }
+    }
+}
+
+static inline void hmap_set_check(hmap *dst, hmap *a, hmap *b)
+{
+    assert(dst != a && dst != b);
+    assert(dst->key_size == a->key_size && dst->key_size == b->key_size);
+    assert(dst->val_size == a->val_size && dst->val_size == b->val_size);
+    (void)dst; (void)a; (void)b;
+}
+
+/*
+ * adds every key of a and b to dst, with the value from a for keys in
+ * both. the larger map is copied first, then the smaller, except that
+ * when b is smaller only its keys missing from a are copied.
+ */
+static inline void hmap_union(hmap *dst, hmap *a, hmap *b)
+{
+    hmap *large = hmap_count(a) >= hmap_count(b) ? a : b, *small = large == a ? b : a;
+
+    hmap_set_check(dst, a, b);
+    hmap_reserve(dst, hmap_count(dst) + hmap_count(a) + hmap_count(b));
+    hmap_migrate(dst);
+    hmap_set_batch(dst, large, dst, dst, hmap_set_copy, NULL, NULL);
+    if (small == a) {
+        hmap_set_batch(dst, a, dst, dst, hmap_set_copy, NULL, NULL);
+    } else {
+        hmap_set_batch(dst, b, a, b, hmap_set_andnot, NULL, NULL);
+    }
+}
+
+/* adds the keys in both a and b to dst with their values from a */
+static inline void hmap_intersect(hmap *dst, hmap *a, hmap *b)
+{
+    hmap *large = hmap_count(a) >= hmap_count(b) ? a : b, *small = large == a ? b : a;
+    size_t n = hmap_count(small);
+
+    hmap_set_check(dst, a, b);
+    hmap_reserve(dst, hmap_count(dst) + n);
+    hmap_set_batch(dst, small, large, a, hmap_set_and, NULL, NULL);
+}
+
+/* adds the keys of a missing from b to dst, walking a whatever its size */
+static inline void hmap_difference(hmap *dst, hmap *a, hmap *b)
+{
+    hmap_set_check(dst, a, b);
+    hmap_reserve(dst, hmap_count(dst) + hmap_count(a));
+    hmap_set_batch(dst, a, b, a, hmap_set_andnot, NULL, NULL);
+}
+
+/*
+ * adds the entries of src to dst, calling combine with both values for
+ * keys already in dst, or replacing the value if combine is NULL.
+ */
+static inline void hmap_merge(hmap *dst, hmap *src,
+    hmap_combine_fn combine, void *ctx)
+{
+    hmap_set_check(dst, src, src);
+    hmap_reserve(dst, hmap_count(dst) + hmap_count(src));
+    hmap_migrate(dst);
+    hmap_set_batch(dst, src, dst, dst, hmap_set_combine, combine, ctx);
+}
+
+/*
+ * hmap statistics
+ */
+
+static inline void hmap_stats(hmap *h, hmap_statistics *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->used = h->used;
+    s->tombs = h->tombs;
+    s->limit = h->limit;
+    s->load = hmap_load(h);
+    s->tomb_load = h->tombs * hmap_load_multiplier / h->limit;
+    s->table_bytes = hmap_total_size(h, h->limit) + hmap_slab_bytes(h);
+    if (h->old_data) s->table_bytes += hmap_total_size(h, h->old_limit);
+#if defined(HMAP_STATS)
+    s->counters = h->counters;
+#endif
+}
+
+static inline int hmap_slot_empty(hmap *h, size_t i)
+{
+    if (h->flags & hmap_flag_tags) return h->ctrl[i] == hmap_ctrl_empty;
+    return hmap_bitmap_get(h->bitmap, i) == hmap_available;
+}
+
+/*
+ * fills s as hmap_stats does plus the distribution of cluster lengths,
+ * a cluster being a run of occupied or deleted slots that a probe has to
+ * pass. finishes any incremental migration first. the scan starts after
+ * an empty slot so a run wrapping past the end is counted once.
+ */
+static inline void hmap_stats_scan(hmap *h, hmap_statistics *s)
+{
+    size_t mask = hmap_index_mask(h), start = 0, len = 0;
+
+    hmap_migrate(h);
+    hmap_stats(h, s);
+    while (start < h->limit && !hmap_slot_empty(h, start)) start++;
+    for (size_t n = 1; n <= h->limit; n++) {
+        size_t i = (start + n) & mask;
+        if (hmap_slot_empty(h, i)) {
+            hmap_stats_cluster(s, len);
+            len = 0;
+        } else {
+            len++;
+        }
+    }
+}
+
+static inline void hmap_stats_reset(hmap *h)
+{
+#if defined(HMAP_STATS)
+    memset(&h->counters, 0, sizeof(h->counters));
+#else
+    (void)h;
+#endif
+}
+
+static inline hmap_iter hmap_find_hashed(hmap *h, void *key, size_t hash)
+{
+    size_t i = hmap_find_internal(h, key, hash);
+    return i == hmap_empty_offset ? hmap_iter_end(h) : hmap_iter_make(h, i);
+}
+
+static inline void hmap_erase_hashed(hmap *h, void *key, size_t hash)
+{
+    size_t i;
+    if (h->old_data) hmap_migrate_step(h, hmap_migrate_slots);
+    if (h->old_data) {
+        /* erase in place rather than moving the key to the new table */
+        i = hmap_bitmap_find(h, key, hash);
+        if (i == hmap_empty_offset) {
+            i = hmap_old_find(h, key, hash);
+            if (i == hmap_empty_offset) return;
+            if (h->flags & hmap_flag_indirect) {
+                hmap_slab_release(h, hmap_slot_handle(
+                    hmap_table_val(h, h->old_data, h->old_limit, i)));
+            }
+            hmap_old_erase_at(h, i);
+            return;
+        }
+    } else {
+        i = hmap_find_internal(h, key, hash);
+    }
+    if (i != hmap_empty_offset) hmap_erase_at(h, i);
 }
 
-static inline void hmap_clear(hmap *h)
+/*
+ * erases the entry at iter and returns an iterator at the next one, so a
+ * loop can erase as it goes. the table is never shrunk, leaving other
+ * iterators valid. with hmap_flag_robin_hood the rest of the run shifts
+ * back into the slot, and a run that wraps moves entries already visited
+ * from the start of the table to its end, so the returned iterator stops
+ * before them.
+ */
+static inline hmap_iter hmap_iter_erase(hmap_iter iter)
 {
-    size_t bitmap_size = hmap_bitmap_size(h->limit);
-    memset(h->bitmap, 0, bitmap_size);
-    h->used = h->tombs = 0;
+    hmap *h = iter.h;
+    size_t i = iter.idx;
+
+    if (h->flags & hmap_flag_indirect) {
+        hmap_slab_release(h, hmap_slot_handle(hmap_data_slot(h, i)));
+    }
+    if (h->flags & hmap_flag_tags) {
+        hmap_ctrl_erase_at(h, i);
+    } else if (h->flags & hmap_flag_robin_hood) {
+        size_t hole = hmap_rh_erase_at(h, i);
+        /* the visited entries in [stop,limit) moved back a slot */
+        if (hole < i || hole >= iter.stop) iter.stop--;
+        if (i < iter.stop && hmap_slot_occupied(h, i)) return iter;
+    } else {
+        hmap_bitmap_erase_at(h, i);
+    }
+    return hmap_iter_next(iter);
 }
 
-static inline hmap_iter hmap_insert(hmap *h, void *key, void *val)
+/*
+ * erases every entry for which pred returns non-zero in one sweep of the
+ * table and returns the number erased. slots are marked deleted as they
+ * are visited, then tombstones that no probe run needs are freed in place
+ * and robin hood runs are compacted, after which the table is shrunk or
+ * purged as for a single erase. pred must not insert or erase.
+ */
+static inline size_t hmap_erase_if(hmap *h, hmap_pred_fn pred, void *ctx)
 {
-    for (size_t i = hmap_key_index(h, key); ; i = (i+1) & hmap_index_mask(h)) {
-        hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
-        if ((state & hmap_occupied) != hmap_occupied) {
-            hmap_bitmap_set(h->bitmap, i, hmap_occupied);
-            memcpy(hmap_data_key(h, i), key, h->key_size);
-            memcpy(hmap_data_val(h, i), val, h->val_size);
-            h->used++;
-            if ((state & hmap_deleted) == hmap_deleted) h->tombs--;
-            if (hmap_load(h) > hmap_load_factor) {
-                hmap_resize_internal(h, h->data, h->bitmap, h->limit, h->limit << 1);
-                for (i = hmap_key_index(h, key); ; i = (i+1) & hmap_index_mask(h)) {
-                    hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
-                         if (state == hmap_available) abort();
-                    else if (state == hmap_deleted); /* skip */
-                    else if (h->compare(h, hmap_data_key(h, i), key)) {
-                        hmap_iter iter = { h, i };
-                        return iter;
-                    }
-                }
-            } else {
-                hmap_iter iter = { h, i };
-                return iter;
-            }
-        } else if (h->compare(h, hmap_data_key(h, i), key)) {
-            memcpy(hmap_data_val(h, i), val, h->val_size);
-            hmap_iter iter = { h, i };
-            return iter;
+    size_t erased = 0;
+
+    hmap_migrate(h);
+    for (size_t i = hmap_slot_scan(h, 0, h->limit); i < h->limit;
+         i = hmap_slot_scan(h, i + 1, h->limit))
+    {
+        if (!pred(ctx, hmap_data_key(h, i), hmap_data_val(h, i))) continue;
+        if (h->flags & hmap_flag_indirect) {
+            hmap_slab_release(h, hmap_slot_handle(hmap_data_slot(h, i)));
         }
+        if (h->flags & hmap_flag_tags) {
+            h->ctrl[i] = hmap_ctrl_deleted;
+        } else {
+            hmap_bitmap_set(h->bitmap, i, hmap_deleted);
+            hmap_bitmap_clear(h->bitmap, i, hmap_occupied);
+        }
+        erased++;
+    }
+    if (!erased) return 0;
+
+    h->used -= erased;
+    if (h->flags & hmap_flag_tags) {
+        h->tombs = h->tombs + erased - hmap_ctrl_reclaim(h);
+    } else if (h->flags & hmap_flag_robin_hood) {
+        hmap_rh_compact(h);
+    } else {
+        h->tombs = h->tombs + erased - hmap_bitmap_reclaim(h->bitmap, h->limit);
     }
+    hmap_erase_rebalance(h);
+    return erased;
+}
 
-    return hmap_iter_end(h);
+static inline hmap_iter hmap_insert(hmap *h, void *key, void *val)
+{
+    return hmap_insert_hashed(h, key, val, h->hasher(h, key));
 }
 
 static inline void* hmap_get(hmap *h, void *key)
 {
-    for (size_t i = hmap_key_index(h, key); ; i = (i+1) & hmap_index_mask(h)) {
-        hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
-        if ((state & hmap_occupied) != hmap_occupied) {
-            hmap_bitmap_set(h->bitmap, i, hmap_occupied);
-            memcpy(hmap_data_key(h, i), key, h->key_size);
-            h->used++;
-            if ((state & hmap_deleted) == hmap_deleted) h->tombs--;
-            if (hmap_load(h) > hmap_load_factor) {
-                hmap_resize_internal(h, h->data, h->bitmap, h->limit, h->limit << 1);
-                for (i = hmap_key_index(h, key); ; i = (i+1) & hmap_index_mask(h)) {
-                    hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
-                         if (state == hmap_available) abort();
-                    else if (state == hmap_deleted); /* skip */
-                    else if (h->compare(h, hmap_data_key(h, i), key)) {
-                        return hmap_data_val(h, i);
-                    }
-                }
-            }
-            return hmap_data_val(h, i);
-        } else if (h->compare(h, hmap_data_key(h, i), key)) {
-            return hmap_data_val(h, i);
-        }
-    }
+    return hmap_get_hashed(h, key, h->hasher(h, key));
 }
 
 static inline hmap_iter hmap_find(hmap *h, void *key)
 {
-    for (size_t i = hmap_key_index(h, key); ; i = (i+1) & hmap_index_mask(h)) {
-        hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
-             if (state == hmap_available)           /* notfound */ break;
-        else if (state == hmap_deleted);            /* skip */
-        else if (h->compare(h, hmap_data_key(h, i), key)) {
-            return hmap_iter_make(h, i);
-        }
-    }
-    return hmap_iter_end(h);
+    return hmap_find_hashed(h, key, h->hasher(h, key));
 }
 
 static inline void hmap_erase(hmap *h, void *key)
 {
-    for (size_t i = hmap_key_index(h, key); ; i = (i+1) & hmap_index_mask(h)) {
-        hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
-             if (state == hmap_available)           /* notfound */ break;
-        else if (state == hmap_deleted);            /* skip */
-        else if (h->compare(h, hmap_data_key(h, i), key)) {
-            hmap_bitmap_set(h->bitmap, i, hmap_deleted);
-            hmap_bitmap_clear(h->bitmap, i, hmap_occupied);
-            h->used--;
-            h->tombs++;
-            return;
-        }
-    }
+    hmap_erase_hashed(h, key, h->hasher(h, key));
 }
 
 /*
@@ -460,13 +2268,29 @@ struct lhmap
     size_t used;
     size_t tombs;
     size_t limit;
+    size_t max_load;
+    size_t min_load;
+    unsigned flags;
+    uint64_t seed;
     lhmap_hash_fn hasher;
     lhmap_compare_fn compare;
+    hmap_allocator allocator;
     unsigned char *data;
+    size_t *hashes;
     uint64_t *bitmap;
     size_t head;
     size_t tail;
+    size_t max_entries;
+    size_t max_bytes;
+    size_t bytes;
+    lhmap_cost_fn cost;
+    lhmap_evict_fn evict;
+    lhmap_rehash_fn rehash;
+    size_t rehash_threads;
     void *userdata;
+#if defined(HMAP_STATS)
+    hmap_counters counters;
+#endif
 };
 
 typedef struct lhmap_link lhmap_link;
@@ -479,9 +2303,7 @@ struct lhmap_link
 
 static inline size_t lhmap_default_hash_fn(lhmap *h, void *key)
 {
-    size_t k = 0;
-    memcpy(&k, key, h->key_size < sizeof(k) ? h->key_size : sizeof(k));
-    return k;
+    return (size_t)hmap_hash_bytes(key, h->key_size, h->seed);
 }
 
 static inline int lhmap_default_compare_fn(lhmap *h, void *key1, void *key2)
@@ -604,31 +2426,125 @@ static inline size_t lhmap_key_index(lhmap *h, void *key)
     return lhmap_hash_index(h, h->hasher(h, key));
 }
 
-static inline void lhmap_init_ex(lhmap *h, void *userdata,
-    size_t key_size, size_t val_size, size_t limit,
-    lhmap_hash_fn hasher, lhmap_compare_fn compare)
+static inline size_t lhmap_data_size(lhmap *h, size_t limit)
 {
-    size_t stride = sizeof(lhmap_link) + key_size + val_size;
-    size_t data_size = stride * limit;
-    size_t bitmap_size = hmap_bitmap_size(limit);
-    size_t total_size = data_size + bitmap_size;
+    return (lhmap_stride(h) * limit + 7) & ~(size_t)7;
+}
 
-    assert(hmap_ispow2(limit));
+static inline size_t lhmap_hashes_size(lhmap *h, size_t limit)
+{
+    return (h->flags & hmap_flag_hashes) ? sizeof(size_t) * limit : 0;
+}
+
+static inline size_t lhmap_total_size(lhmap *h, size_t limit)
+{
+    return lhmap_data_size(h, limit) + lhmap_hashes_size(h, limit) + hmap_bitmap_size(limit);
+}
+
+static inline unsigned char* lhmap_alloc_table(lhmap *h, size_t limit)
+{
+    hmap_stat(h, alloc_bytes += lhmap_total_size(h, limit));
+    return (unsigned char*)h->allocator.alloc(h->allocator.userdata, lhmap_total_size(h, limit));
+}
+
+static inline void lhmap_free_table(lhmap *h, unsigned char *data, size_t limit)
+{
+    if (data) h->allocator.free(h->allocator.userdata, data, lhmap_total_size(h, limit));
+}
+
+/* points hashes and bitmap at the arrays following data */
+static inline void lhmap_meta_bind(lhmap *h)
+{
+    unsigned char *meta = h->data + lhmap_data_size(h, h->limit);
+
+    h->hashes = (h->flags & hmap_flag_hashes) ? (size_t*)meta : NULL;
+    h->bitmap = (uint64_t*)(meta + lhmap_hashes_size(h, h->limit));
+}
+
+/* binds and clears the bitmap for an empty table */
+static inline void lhmap_meta_init(lhmap *h)
+{
+    lhmap_meta_bind(h);
+    memset(h->bitmap, 0, hmap_bitmap_size(h->limit));
+}
+
+static inline int lhmap_slot_match(lhmap *h, size_t i, size_t hash, void *key)
+{
+    if (h->hashes && h->hashes[i] != hash) return 0;
+    hmap_stat(h, compares++);
+    return h->compare(h, lhmap_data_key(h, i), key);
+}
+
+static inline void lhmap_slot_set_hash(lhmap *h, size_t i, size_t hash)
+{
+    if (h->hashes) h->hashes[i] = hash;
+}
 
-    h->key_size = key_size;
-    h->val_size = val_size;
+static inline void lhmap_init_opts(lhmap *h, const lhmap_opts *opts)
+{
+    size_t limit = opts->limit;
+
+    assert(hmap_ispow2(opts->limit));
+    assert((opts->flags & ~hmap_flag_hashes) == 0);
+    assert(opts->max_load < hmap_load_multiplier && opts->min_load <= opts->max_load >> 2);
+
+    /* full at max_entries must leave room to purge tombstones in place */
+    if (opts->max_entries) {
+        size_t fit = hmap_fit_limit(opts->max_entries, opts->max_load - (opts->max_load >> 2), 2);
+        if (fit > limit) limit = fit;
+    }
+
+    h->key_size = opts->key_size;
+    h->val_size = opts->val_size;
     h->used = 0;
     h->tombs = 0;
     h->limit = limit;
-    h->hasher = hasher;
-    h->compare = compare;
-    h->data = (unsigned char*)malloc(total_size);
-    h->bitmap = (uint64_t*)(h->data + data_size);
+    h->max_load = opts->max_load;
+    h->min_load = opts->min_load;
+    h->flags = opts->flags;
+    h->seed = opts->seed;
+    h->hasher = opts->hasher;
+    h->compare = opts->compare;
+    h->allocator = opts->allocator;
+    lhmap_stats_reset(h);
+    h->data = lhmap_alloc_table(h, h->limit);
     h->head = hmap_empty_offset;
     h->tail = hmap_empty_offset;
-    h->userdata = userdata;
+    h->max_entries = opts->max_entries;
+    h->max_bytes = opts->max_bytes;
+    h->bytes = 0;
+    h->cost = opts->cost;
+    h->evict = opts->evict;
+    h->rehash = NULL;
+    h->rehash_threads = 0;
+    h->userdata = opts->userdata;
+
+    memset(h->data, 0, lhmap_data_size(h, h->limit));
+    lhmap_meta_init(h);
+}
+
+static inline lhmap_opts lhmap_opts_make(size_t key_size, size_t val_size)
+{
+    lhmap_opts opts = {
+        NULL, key_size, val_size, hmap_default_size, hmap_load_factor, 0,
+        hmap_flag_none, hmap_random_seed(),
+        lhmap_default_hash_fn, lhmap_default_compare_fn,
+        { hmap_default_alloc_fn, hmap_default_free_fn, NULL },
+        0, 0, NULL, NULL
+    };
+    return opts;
+}
 
-    memset(h->data, 0, total_size);
+static inline void lhmap_init_ex(lhmap *h, void *userdata,
+    size_t key_size, size_t val_size, size_t limit,
+    lhmap_hash_fn hasher, lhmap_compare_fn compare)
+{
+    lhmap_opts opts = lhmap_opts_make(key_size, val_size);
+    opts.userdata = userdata;
+    opts.limit = limit;
+    opts.hasher = hasher;
+    opts.compare = compare;
+    lhmap_init_opts(h, &opts);
 }
 
 static inline void lhmap_init(lhmap *h,
@@ -640,53 +2556,68 @@ static inline void lhmap_init(lhmap *h,
 
 static inline void lhmap_destroy(lhmap *h)
 {
-    free(h->data);
+    lhmap_free_table(h, h->data, h->limit);
     h->data = NULL;
+    h->hashes = NULL;
     h->bitmap = NULL;
 }
 
+/*
+ * rebuilds into a table of new_limit in two sequential passes rather than
+ * chasing links through the old table. the first streams over old slots
+ * in physical order, copying each entry with its old links and recording
+ * its new index in a remap array. the second streams over the new slots
+ * and translates links through the remap array, keeping insertion order.
+ */
 static inline void lhmap_resize_internal(lhmap *h,
     unsigned char *old_data, uint64_t *old_bitmap, size_t old_limit, size_t new_limit)
 {
-    size_t stride = sizeof(lhmap_link) + h->key_size + h->val_size;
-    size_t data_size = stride * new_limit;
-    size_t bitmap_size = hmap_bitmap_size(new_limit);
-    size_t total_size = data_size + bitmap_size;
+    size_t *old_hashes = h->hashes, stride = lhmap_stride(h);
 
     assert(hmap_ispow2(new_limit));
 
-    h->data = (unsigned char*)malloc(total_size);
-    h->bitmap = (uint64_t*)((char*)h->data + data_size);
+    unsigned char *data = lhmap_alloc_table(h, new_limit);
+    size_t *remap = (size_t*)h->allocator.alloc(h->allocator.userdata,
+        sizeof(size_t) * old_limit);
+    assert(data && remap);
+
+    h->data = data;
     h->limit = new_limit;
-    memset(h->bitmap, 0, bitmap_size);
+    lhmap_meta_init(h);
 
-    size_t k = hmap_empty_offset;
-    for (size_t i = h->head; i != hmap_empty_offset;
-         i = lhmap_old_data_link(h, old_data, i)->next)
+    for (size_t i = 0; i < old_limit; i++)
     {
-        void *key = lhmap_old_data_key(h, old_data, i);
-        for (size_t j = lhmap_key_index(h, key); ; j = (j+1) & lhmap_index_mask(h))
+        if ((hmap_bitmap_get(old_bitmap, i) & hmap_occupied) != hmap_occupied) continue;
+        lhmap_link *link = lhmap_old_data_link(h, old_data, i);
+        size_t hash = old_hashes ? old_hashes[i] :
+            h->hasher(h, lhmap_old_data_key(h, old_data, i));
+        for (size_t j = lhmap_hash_index(h, hash); ; j = (j+1) & lhmap_index_mask(h))
         {
             if ((hmap_bitmap_get(h->bitmap, j) & hmap_occupied) != hmap_occupied) {
                 hmap_bitmap_set(h->bitmap, j, hmap_occupied);
-                if (i == h->head) h->head = j;
-                if (i == h->tail) h->tail = j;
-                memcpy(lhmap_data_key(h, j), key, h->key_size + h->val_size);
-                lhmap_data_link(h, j)->next = hmap_empty_offset;
-                if (k == hmap_empty_offset) {
-                    lhmap_data_link(h, j)->prev = hmap_empty_offset;
-                } else {
-                    lhmap_data_link(h, j)->prev = k;
-                    lhmap_data_link(h, k)->next = j;
-                }
-                k = j;
+                lhmap_slot_set_hash(h, j, hash);
+                memcpy(lhmap_data_link(h, j), link, stride);
+                remap[i] = j;
                 break;
             }
         }
     }
 
+    for (size_t j = 0; j < new_limit; j++)
+    {
+        if ((hmap_bitmap_get(h->bitmap, j) & hmap_occupied) != hmap_occupied) continue;
+        lhmap_link *link = lhmap_data_link(h, j);
+        if (link->prev != hmap_empty_offset) link->prev = remap[link->prev];
+        if (link->next != hmap_empty_offset) link->next = remap[link->next];
+    }
+
+    if (h->head != hmap_empty_offset) {
+        h->head = remap[h->head];
+        h->tail = remap[h->tail];
+    }
     h->tombs = 0;
-    free(old_data);
+    h->allocator.free(h->allocator.userdata, remap, sizeof(size_t) * old_limit);
+    lhmap_free_table(h, old_data, old_limit);
 }
 
 static inline void lhmap_clear(lhmap *h)
@@ -695,6 +2626,7 @@ static inline void lhmap_clear(lhmap *h)
     memset(h->bitmap, 0, bitmap_size);
     h->head = h->tail = hmap_empty_offset;
     h->used = h->tombs = 0;
+    h->bytes = 0;
 }
 
 /* inserts indice link before specified position */
@@ -740,92 +2672,373 @@ static inline void lhmap_erase_link_internal(lhmap *h, size_t i)
     }
 }
 
-static inline lhmap_iter lhmap_insert(lhmap *h,
-    lhmap_iter iter, void *key, void *val)
+/* records the probe length of a lookup for hash that returned slot i */
+static inline void lhmap_stat_probe(lhmap *h, size_t hash, size_t i)
+{
+#if defined(HMAP_STATS)
+    size_t mask = lhmap_index_mask(h), home = lhmap_hash_index(h, hash);
+    if (i != hmap_empty_offset) {
+        h->counters.hit_probes[hmap_stats_bucket((i - home) & mask)]++;
+    } else {
+        h->counters.miss_probes[hmap_stats_bucket(hmap_stats_miss_len(h->bitmap, mask, home))]++;
+    }
+#else
+    (void)h; (void)hash; (void)i;
+#endif
+}
+
+static inline size_t lhmap_bitmap_find(lhmap *h, void *key, size_t hash)
+{
+    for (size_t i = lhmap_hash_index(h, hash); ; i = (i+1) & lhmap_index_mask(h)) {
+        hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
+             if (state == hmap_available)           /* notfound */ break;
+        else if (state == hmap_deleted);            /* skip */
+        else if (lhmap_slot_match(h, i, hash, key)) return i;
+    }
+    return hmap_empty_offset;
+}
+
+static inline size_t lhmap_find_internal(lhmap *h, void *key, size_t hash)
+{
+    size_t i = lhmap_bitmap_find(h, key, hash);
+    lhmap_stat_probe(h, hash, i);
+    return i;
+}
+
+static inline void lhmap_rehash_internal(lhmap *h, size_t new_limit)
 {
-    for (size_t i = lhmap_key_index(h, key); ; i = (i+1) & lhmap_index_mask(h)) {
+    uint64_t t0 = hmap_stats_clock();
+    if (!h->rehash || !h->rehash(h, new_limit)) {
+        lhmap_resize_internal(h, h->data, h->bitmap, h->limit, new_limit);
+    }
+    hmap_stat_resize(h, t0);
+}
+
+static inline void lhmap_reserve(lhmap *h, size_t count)
+{
+    size_t limit = hmap_fit_limit(count, h->max_load, 2);
+    if (limit < h->limit) limit = h->limit;
+    if (limit != h->limit || (count + h->tombs) *
+        hmap_load_multiplier / limit > h->max_load)
+    {
+        lhmap_rehash_internal(h, limit);
+    }
+}
+
+static inline void lhmap_shrink_to_fit(lhmap *h)
+{
+    size_t limit = hmap_fit_limit(h->used, h->max_load, 2);
+    if (limit != h->limit || h->tombs) lhmap_rehash_internal(h, limit);
+}
+
+/*
+ * claims a slot for key, which must not be present, and links it before
+ * pos. the table is grown or purged after linking, as resize preserves
+ * link order, so the returned index is looked up again in that case.
+ */
+static inline size_t lhmap_claim_internal(lhmap *h, void *key, size_t hash, size_t pos)
+{
+    if (h->max_entries && h->used >= h->max_entries) {
+        if (pos == h->tail) pos = hmap_empty_offset;
+        lhmap_evict(h);
+    }
+
+    size_t i = lhmap_hash_index(h, hash);
+    for (; ; i = (i+1) & lhmap_index_mask(h)) {
         hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
         if ((state & hmap_occupied) != hmap_occupied) {
             hmap_bitmap_set(h->bitmap, i, hmap_occupied);
-            memcpy(lhmap_data_key(h, i), key, h->key_size);
-            memcpy(lhmap_data_val(h, i), val, h->val_size);
-            lhmap_insert_link_internal(h, iter.idx, i);
-            h->used++;
             if ((state & hmap_deleted) == hmap_deleted) h->tombs--;
-            if (lhmap_load(h) > hmap_load_factor) {
-                lhmap_resize_internal(h, h->data, h->bitmap, h->limit, h->limit << 1);
-                for (i = lhmap_key_index(h, key); ; i = (i+1) & lhmap_index_mask(h)) {
-                    hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
-                         if (state == hmap_available) abort();
-                    else if (state == hmap_deleted); /* skip */
-                    else if (h->compare(h, lhmap_data_key(h, i), key)) {
-                        return lhmap_iter_make(h, i);
-                    }
-                }
-            } else {
-                return lhmap_iter_make(h, i);
-            }
-        } else if (h->compare(h, lhmap_data_key(h, i), key)) {
-            memcpy(lhmap_data_val(h, i), val, h->val_size);
-            return lhmap_iter_make(h, i);
+            break;
         }
     }
+    lhmap_slot_set_hash(h, i, hash);
+    memcpy(lhmap_data_key(h, i), key, h->key_size);
+    lhmap_insert_link_internal(h, pos, i);
+    h->used++;
+    if (lhmap_load(h) > h->max_load) {
+        lhmap_rehash_internal(h, hmap_grow_limit(h->used, h->limit, h->max_load));
+        i = lhmap_find_internal(h, key, hash);
+    }
+    return i;
+}
+
+static inline size_t lhmap_cost(lhmap *h, size_t i)
+{
+    if (!h->max_bytes) return 0;
+    if (!h->cost) return lhmap_stride(h);
+    return h->cost(h, lhmap_data_key(h, i), lhmap_data_val(h, i));
+}
+
+/* removes slot i without shrinking, so other slot indices stay valid */
+static inline void lhmap_remove_at(lhmap *h, size_t i)
+{
+    h->bytes -= lhmap_cost(h, i);
+    hmap_bitmap_set(h->bitmap, i, hmap_deleted);
+    hmap_bitmap_clear(h->bitmap, i, hmap_occupied);
+    lhmap_erase_link_internal(h, i);
+    h->used--;
+    h->tombs++;
+}
+
+static inline void lhmap_shrink_internal(lhmap *h)
+{
+    size_t limit = hmap_fit_limit(h->used, h->max_load >> 1, 2);
+    if (limit < h->limit) lhmap_rehash_internal(h, limit);
+}
+
+static inline void lhmap_erase_at(lhmap *h, size_t i)
+{
+    lhmap_remove_at(h, i);
+    if (h->used * hmap_load_multiplier / h->limit < h->min_load) {
+        lhmap_shrink_internal(h);
+    }
+}
+
+static inline void lhmap_evict_at(lhmap *h, size_t i)
+{
+    if (h->evict) h->evict(h, lhmap_data_key(h, i), lhmap_data_val(h, i));
+    lhmap_remove_at(h, i);
+}
+
+/* removes the tail entry, returning zero if the map is empty */
+static inline int lhmap_evict(lhmap *h)
+{
+    size_t i = h->tail;
+    if (i == hmap_empty_offset) return 0;
+    lhmap_evict_at(h, i);
+    return 1;
+}
+
+/*
+ * evicts from the tail until within max_bytes, passing over slot keep,
+ * which may itself be the tail when it was just inserted at the end.
+ */
+static inline void lhmap_evict_bytes(lhmap *h, size_t keep)
+{
+    while (h->max_bytes && h->bytes > h->max_bytes) {
+        size_t i = h->tail;
+        if (i == keep) i = lhmap_data_link(h, keep)->prev;
+        if (i == hmap_empty_offset) break;
+        lhmap_evict_at(h, i);
+    }
+}
+
+/* stores val in slot i, evicting past max_bytes but never i */
+static inline void lhmap_store_val(lhmap *h, size_t i, void *val, int present)
+{
+    if (present) h->bytes -= lhmap_cost(h, i);
+    if (h->val_size) memcpy(lhmap_data_val(h, i), val, h->val_size);
+    h->bytes += lhmap_cost(h, i);
+    lhmap_evict_bytes(h, i);
+}
+
+static inline lhmap_iter lhmap_insert(lhmap *h,
+    lhmap_iter iter, void *key, void *val)
+{
+    size_t hash = h->hasher(h, key);
+    size_t i = lhmap_find_internal(h, key, hash);
+    int present = i != hmap_empty_offset;
+    if (!present) i = lhmap_claim_internal(h, key, hash, iter.idx);
+    lhmap_store_val(h, i, val, present);
+    return lhmap_iter_make(h, i);
 }
 
 static inline void* lhmap_get(lhmap *h, void *key)
 {
-    for (size_t i = lhmap_key_index(h, key); ; i = (i+1) & lhmap_index_mask(h)) {
-        hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
-        if ((state & hmap_occupied) != hmap_occupied) {
-            hmap_bitmap_set(h->bitmap, i, hmap_occupied);
-            memcpy(lhmap_data_key(h, i), key, h->key_size);
-            lhmap_insert_link_internal(h, hmap_empty_offset, i);
-            h->used++;
-            if ((state & hmap_deleted) == hmap_deleted) h->tombs--;
-            if (lhmap_load(h) > hmap_load_factor) {
-                lhmap_resize_internal(h, h->data, h->bitmap, h->limit, h->limit << 1);
-                for (i = lhmap_key_index(h, key); ; i = (i+1) & lhmap_index_mask(h)) {
-                    hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
-                         if (state == hmap_available) abort();
-                    else if (state == hmap_deleted); /* skip */
-                    else if (h->compare(h, lhmap_data_key(h, i), key)) {
-                        return lhmap_data_val(h, i);
-                    }
-                }
-            }
-            return lhmap_data_val(h, i);
-        } else if (h->compare(h, lhmap_data_key(h, i), key)) {
-            return lhmap_data_val(h, i);
+    size_t hash = h->hasher(h, key);
+    size_t i = lhmap_find_internal(h, key, hash);
+    if (i == hmap_empty_offset) {
+        i = lhmap_claim_internal(h, key, hash, hmap_empty_offset);
+        if (h->max_bytes) {
+            memset(lhmap_data_val(h, i), 0, h->val_size);
+            h->bytes += lhmap_cost(h, i);
+            lhmap_evict_bytes(h, i);
         }
     }
+    return lhmap_data_val(h, i);
+}
+
+/*
+ * lru cache
+ *
+ * the head of the list is the most recently used entry and eviction takes
+ * the tail. promotion relinks the slot in place without probing again or
+ * copying the entry.
+ */
+
+static inline void lhmap_promote(lhmap *h, size_t i)
+{
+    if (i == h->head) return;
+    lhmap_erase_link_internal(h, i);
+    lhmap_insert_link_internal(h, h->head, i);
+}
+
+/* finds key and moves it to the front, returning the end iterator if absent */
+static inline lhmap_iter lhmap_touch(lhmap *h, void *key)
+{
+    size_t i = lhmap_find_internal(h, key, h->hasher(h, key));
+    if (i != hmap_empty_offset) lhmap_promote(h, i);
+    return lhmap_iter_make(h, i);
+}
+
+/* inserts or replaces key at the front, evicting from the tail if full */
+static inline lhmap_iter lhmap_insert_front(lhmap *h, void *key, void *val)
+{
+    size_t hash = h->hasher(h, key);
+    size_t i = lhmap_find_internal(h, key, hash);
+    int present = i != hmap_empty_offset;
+    if (present) {
+        lhmap_promote(h, i);
+    } else {
+        i = lhmap_claim_internal(h, key, hash, h->head);
+    }
+    lhmap_store_val(h, i, val, present);
+    return lhmap_iter_make(h, i);
+}
+
+static inline size_t lhmap_bytes(lhmap *h)
+{
+    return h->bytes;
 }
 
 static inline lhmap_iter lhmap_find(lhmap *h, void *key)
 {
-    for (size_t i = lhmap_key_index(h, key); ; i = (i+1) & lhmap_index_mask(h)) {
-        hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
-             if (state == hmap_available)           /* notfound */ break;
-        else if (state == hmap_deleted);            /* skip */
-        else if (h->compare(h, lhmap_data_key(h, i), key)) {
-            return lhmap_iter_make(h, i);
+    size_t i = lhmap_find_internal(h, key, h->hasher(h, key));
+    return lhmap_iter_make(h, i);
+}
+
+static inline void lhmap_erase(lhmap *h, void *key)
+{
+    size_t i = lhmap_find_internal(h, key, h->hasher(h, key));
+    if (i != hmap_empty_offset) lhmap_erase_at(h, i);
+}
+
+/*
+ * erases the entry at iter and returns an iterator at the entry after it
+ * in list order. the table is never shrunk, leaving other iterators valid.
+ */
+static inline lhmap_iter lhmap_iter_erase(lhmap_iter iter)
+{
+    size_t next = lhmap_data_link(iter.h, iter.idx)->next;
+    lhmap_remove_at(iter.h, iter.idx);
+    return lhmap_iter_make(iter.h, next);
+}
+
+/*
+ * erases every entry for which pred returns non-zero, visiting them in
+ * slot order, and returns the number erased. erased entries are unlinked
+ * as they are visited, then tombstones that no probe run needs are freed
+ * in place and the table is shrunk or purged as for a single erase. evict
+ * is not called and pred must not insert or erase.
+ */
+static inline size_t lhmap_erase_if(lhmap *h, hmap_pred_fn pred, void *ctx)
+{
+    size_t erased = 0;
+
+    for (size_t i = hmap_bitmap_scan(h->bitmap, 0, h->limit); i < h->limit;
+         i = hmap_bitmap_scan(h->bitmap, i + 1, h->limit))
+    {
+        if (!pred(ctx, lhmap_data_key(h, i), lhmap_data_val(h, i))) continue;
+        lhmap_remove_at(h, i);
+        erased++;
+    }
+    if (!erased) return 0;
+
+    h->tombs -= hmap_bitmap_reclaim(h->bitmap, h->limit);
+    if (h->used * hmap_load_multiplier / h->limit < h->min_load) {
+        lhmap_shrink_internal(h);
+    }
+    if (h->tombs * hmap_load_multiplier / h->limit > h->max_load >> 2) {
+        lhmap_rehash_internal(h, h->limit);
+    }
+    return erased;
+}
+
+static inline void lhmap_prefetch_slot(lhmap *h, size_t hash)
+{
+    size_t i = lhmap_hash_index(h, hash);
+    hmap_prefetch(h->bitmap + hmap_bitmap_idx(i));
+    if (h->hashes) hmap_prefetch(h->hashes + i);
+    hmap_prefetch(lhmap_data_key(h, i));
+}
+
+static inline void lhmap_batch_internal(lhmap *h,
+    void *keys, size_t count, lhmap_iter *iters, void **vals)
+{
+    unsigned char *k = (unsigned char*)keys;
+    size_t hashes[HMAP_BATCH_WIDTH];
+
+    for (size_t b = 0; b < count; b += HMAP_BATCH_WIDTH) {
+        size_t n = count - b < HMAP_BATCH_WIDTH ? count - b : HMAP_BATCH_WIDTH;
+        for (size_t j = 0; j < n; j++) {
+            hashes[j] = h->hasher(h, k + (b + j) * h->key_size);
+            lhmap_prefetch_slot(h, hashes[j]);
+        }
+        for (size_t j = b; j < b + n; j++) {
+            size_t i = lhmap_find_internal(h, k + j * h->key_size, hashes[j - b]);
+            if (iters) {
+                iters[j] = lhmap_iter_make(h, i);
+            } else {
+                vals[j] = i == hmap_empty_offset ? NULL : lhmap_data_val(h, i);
+            }
         }
     }
-    return lhmap_iter_end(h);
 }
 
-static inline void lhmap_erase(lhmap *h, void *key)
+static inline void lhmap_find_batch(lhmap *h,
+    void *keys, size_t count, lhmap_iter *iters)
 {
-    for (size_t i = lhmap_key_index(h, key); ; i = (i+1) & lhmap_index_mask(h)) {
-        hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
-             if (state == hmap_available)           /* notfound */ break;
-        else if (state == hmap_deleted);            /* skip */
-        else if (h->compare(h, lhmap_data_key(h, i), key)) {
-            hmap_bitmap_set(h->bitmap, i, hmap_deleted);
-            hmap_bitmap_clear(h->bitmap, i, hmap_occupied);
-            lhmap_erase_link_internal(h, i);
-            h->used--;
-            h->tombs++;
-            return;
+    lhmap_batch_internal(h, keys, count, iters, NULL);
+}
+
+static inline void lhmap_get_batch(lhmap *h,
+    void *keys, size_t count, void **vals)
+{
+    lhmap_batch_internal(h, keys, count, NULL, vals);
+}
+
+/*
+ * lhmap statistics
+ */
+
+static inline void lhmap_stats(lhmap *h, hmap_statistics *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->used = h->used;
+    s->tombs = h->tombs;
+    s->limit = h->limit;
+    s->load = lhmap_load(h);
+    s->tomb_load = h->tombs * hmap_load_multiplier / h->limit;
+    s->table_bytes = lhmap_total_size(h, h->limit);
+#if defined(HMAP_STATS)
+    s->counters = h->counters;
+#endif
+}
+
+/* fills s as lhmap_stats does plus the cluster lengths, see hmap_stats_scan */
+static inline void lhmap_stats_scan(lhmap *h, hmap_statistics *s)
+{
+    size_t mask = lhmap_index_mask(h), start = 0, len = 0;
+
+    lhmap_stats(h, s);
+    while (start < h->limit && hmap_bitmap_get(h->bitmap, start) != hmap_available) start++;
+    for (size_t n = 1; n <= h->limit; n++) {
+        size_t i = (start + n) & mask;
+        if (hmap_bitmap_get(h->bitmap, i) == hmap_available) {
+            hmap_stats_cluster(s, len);
+            len = 0;
+        } else {
+            len++;
         }
     }
 }
+
+static inline void lhmap_stats_reset(lhmap *h)
+{
+#if defined(HMAP_STATS)
+    memset(&h->counters, 0, sizeof(h->counters));
+#else
+    (void)h;
+#endif
+}
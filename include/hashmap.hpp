@@ -0,0 +1,794 @@
+/*
+ * PLEASE LICENSE 2023, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <iterator>
+#include <functional>
+#include <type_traits>
+
+#include "hashmap.h"
+
+/*
+ * chashmap::hmap and chashmap::lhmap
+ *
+ * type-specialized C++ front-end using the same 2-bit state bitmap,
+ * linear probing and load factor as the C implementation. key and value
+ * types, hash and equality are template parameters so probes have no
+ * indirect calls and slot addressing is constant-folded. entries are
+ * constructed in place and moved on resize.
+ */
+
+namespace chashmap {
+
+template <typename K, typename = void>
+struct default_hash
+{
+    uint64_t seed;
+
+    default_hash() : seed(hmap_random_seed()) {}
+
+    size_t operator()(const K &key) const
+    {
+        return (size_t)hmap_mix((uint64_t)std::hash<K>()(key) ^ seed, hmap_hash_secret[1]);
+    }
+};
+
+template <typename K>
+struct default_hash<K, typename std::enable_if<std::is_integral<K>::value ||
+    std::is_enum<K>::value || std::is_pointer<K>::value>::type>
+{
+    uint64_t seed;
+
+    default_hash() : seed(hmap_random_seed()) {}
+
+    size_t operator()(const K &key) const
+    {
+        return (size_t)hmap_hash_bytes(&key, sizeof(K), seed);
+    }
+};
+
+namespace detail {
+
+static const size_t npos = hmap_empty_offset;
+
+inline uint64_t* bitmap_alloc(size_t limit)
+{
+    uint64_t *bitmap = static_cast<uint64_t*>(std::calloc(1, hmap_bitmap_size(limit)));
+    if (!bitmap) throw std::bad_alloc();
+    return bitmap;
+}
+
+/* allocates slots for limit entries and their bitmap, or neither */
+template <typename T>
+inline void table_alloc(size_t limit, T *&data, uint64_t *&bitmap)
+{
+    uint64_t *b = bitmap_alloc(limit);
+    try {
+        data = static_cast<T*>(::operator new(sizeof(T) * limit));
+    } catch (...) {
+        std::free(b);
+        throw;
+    }
+    bitmap = b;
+}
+
+inline bool slot_occupied(uint64_t *bitmap, size_t i)
+{
+    return (hmap_bitmap_get(bitmap, i) & hmap_occupied) == hmap_occupied;
+}
+
+inline void slot_set(uint64_t *bitmap, size_t i)
+{
+    hmap_bitmap_set(bitmap, i, hmap_occupied);
+}
+
+inline void slot_erase(uint64_t *bitmap, size_t i)
+{
+    hmap_bitmap_set(bitmap, i, hmap_deleted);
+    hmap_bitmap_clear(bitmap, i, hmap_occupied);
+}
+
+/* returns the slot for which match(i) holds or npos */
+template <typename Match>
+inline size_t probe_find(uint64_t *bitmap, size_t limit, size_t hash, Match match)
+{
+    for (size_t i = hash & (limit - 1); ; i = (i+1) & (limit - 1)) {
+        hmap_bitmap_state state = hmap_bitmap_get(bitmap, i);
+             if (state == hmap_available)           /* notfound */ return npos;
+        else if (state == hmap_deleted);            /* skip */
+        else if (match(i)) return i;
+    }
+}
+
+/* returns the slot for which match(i) holds, or npos and the first free slot */
+template <typename Match>
+inline size_t probe_insert(uint64_t *bitmap, size_t limit, size_t hash,
+    Match match, size_t *free_slot)
+{
+    *free_slot = npos;
+    for (size_t i = hash & (limit - 1); ; i = (i+1) & (limit - 1)) {
+        hmap_bitmap_state state = hmap_bitmap_get(bitmap, i);
+        if (state == hmap_available) {
+            if (*free_slot == npos) *free_slot = i;
+            return npos;
+        } else if (state == hmap_deleted) {
+            if (*free_slot == npos) *free_slot = i;
+        } else if (match(i)) {
+            return i;
+        }
+    }
+}
+
+/* returns the first non-occupied slot, used when rehashing unique keys */
+inline size_t probe_free(uint64_t *bitmap, size_t limit, size_t hash)
+{
+    for (size_t i = hash & (limit - 1); ; i = (i+1) & (limit - 1)) {
+        if (!slot_occupied(bitmap, i)) return i;
+    }
+}
+
+inline bool over_load(size_t used, size_t tombs, size_t limit)
+{
+    return (used + tombs) * hmap_load_multiplier / limit > hmap_load_factor;
+}
+
+inline size_t round_limit(size_t limit)
+{
+    size_t n = 2;
+    while (n < limit) n <<= 1;
+    return n;
+}
+
+}
+
+/*
+ * chashmap::hmap
+ */
+
+template <typename K, typename V,
+          typename Hash = default_hash<K>, typename Eq = std::equal_to<K>>
+class hmap
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<K,V> value_type;
+    typedef size_t size_type;
+
+    template <typename T, typename M>
+    class basic_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename std::remove_const<T>::type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef T* pointer;
+        typedef T& reference;
+
+        basic_iterator() : m(nullptr), idx(0) {}
+        basic_iterator(M *m, size_t idx) : m(m), idx(idx) {}
+        template <typename U, typename N>
+        basic_iterator(const basic_iterator<U,N> &o) : m(o.m), idx(o.idx) {}
+
+        reference operator*() const { return m->data[idx]; }
+        pointer operator->() const { return &m->data[idx]; }
+        basic_iterator& operator++() { idx = m->step(idx + 1); return *this; }
+        basic_iterator operator++(int) { basic_iterator t = *this; ++*this; return t; }
+        bool operator==(const basic_iterator &o) const { return m == o.m && idx == o.idx; }
+        bool operator!=(const basic_iterator &o) const { return m != o.m || idx != o.idx; }
+
+        M *m;
+        size_t idx;
+    };
+
+    typedef basic_iterator<value_type,hmap> iterator;
+    typedef basic_iterator<const value_type,const hmap> const_iterator;
+
+    explicit hmap(size_t limit = hmap_default_size,
+                  const Hash &hash = Hash(), const Eq &eq = Eq()) :
+        data(nullptr), bitmap(nullptr), used(0), tombs(0),
+        limit(detail::round_limit(limit)), hasher(hash), compare(eq)
+    {
+        detail::table_alloc(this->limit, data, bitmap);
+    }
+
+    /* copies into a new table, committing it only once every entry is copied */
+    hmap(const hmap &o) :
+        data(nullptr), bitmap(nullptr), used(0), tombs(0),
+        limit(0), hasher(o.hasher), compare(o.compare)
+    {
+        if (!o.data) return;
+        value_type *d;
+        uint64_t *b;
+        detail::table_alloc(o.limit, d, b);
+        size_t i = 0;
+        try {
+            for (; i < o.limit; i++) {
+                if (detail::slot_occupied(o.bitmap, i)) new (&d[i]) value_type(o.data[i]);
+            }
+        } catch (...) {
+            while (i-- > 0) {
+                if (detail::slot_occupied(o.bitmap, i)) d[i].~value_type();
+            }
+            ::operator delete(d);
+            std::free(b);
+            throw;
+        }
+        std::memcpy(b, o.bitmap, hmap_bitmap_size(o.limit));
+        data = d;
+        bitmap = b;
+        used = o.used;
+        tombs = o.tombs;
+        limit = o.limit;
+    }
+
+    /* the source is left empty without a table, which is allocated on insert */
+    hmap(hmap &&o) noexcept :
+        data(o.data), bitmap(o.bitmap), used(o.used), tombs(o.tombs),
+        limit(o.limit), hasher(std::move(o.hasher)), compare(std::move(o.compare))
+    {
+        o.data = nullptr;
+        o.bitmap = nullptr;
+        o.used = o.tombs = o.limit = 0;
+    }
+
+    hmap& operator=(const hmap &o)
+    {
+        if (this != &o) { hmap t(o); swap(t); }
+        return *this;
+    }
+
+    hmap& operator=(hmap &&o) noexcept
+    {
+        if (this != &o) { hmap t(std::move(o)); swap(t); }
+        return *this;
+    }
+
+    ~hmap() { release(); }
+
+    void swap(hmap &o) noexcept
+    {
+        std::swap(data, o.data);
+        std::swap(bitmap, o.bitmap);
+        std::swap(used, o.used);
+        std::swap(tombs, o.tombs);
+        std::swap(limit, o.limit);
+        std::swap(hasher, o.hasher);
+        std::swap(compare, o.compare);
+    }
+
+    iterator begin() { return iterator(this, step(0)); }
+    iterator end() { return iterator(this, limit); }
+    const_iterator begin() const { return const_iterator(this, step(0)); }
+    const_iterator end() const { return const_iterator(this, limit); }
+
+    size_t size() const { return used; }
+    bool empty() const { return used == 0; }
+    size_t capacity() const { return limit; }
+    size_t load() const { return limit ? (used + tombs) * hmap_load_multiplier / limit : 0; }
+
+    void clear()
+    {
+        if (!data) return;
+        destroy_all();
+        std::memset(bitmap, 0, hmap_bitmap_size(limit));
+        used = tombs = 0;
+    }
+
+    template <typename... Args>
+    std::pair<iterator,bool> emplace(const K &key, Args&&... args)
+    {
+        return emplace_key(key, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    std::pair<iterator,bool> emplace(K &&key, Args&&... args)
+    {
+        return emplace_key(std::move(key), std::forward<Args>(args)...);
+    }
+
+    /* inserts or assigns the value, matching hmap_insert */
+    iterator insert(const value_type &kv)
+    {
+        std::pair<iterator,bool> r = emplace_key(kv.first, kv.second);
+        if (!r.second) r.first->second = kv.second;
+        return r.first;
+    }
+
+    iterator insert(value_type &&kv)
+    {
+        std::pair<iterator,bool> r = emplace_key(std::move(kv.first), std::move(kv.second));
+        if (!r.second) r.first->second = std::move(kv.second);
+        return r.first;
+    }
+
+    /* default constructs missing values, matching hmap_get */
+    V& operator[](const K &key) { return emplace_key(key).first->second; }
+    V& operator[](K &&key) { return emplace_key(std::move(key)).first->second; }
+
+    iterator find(const K &key) { return iterator(this, find_index(key)); }
+    const_iterator find(const K &key) const { return const_iterator(this, find_index(key)); }
+
+    size_t erase(const K &key)
+    {
+        size_t i = find_index(key);
+        if (i == limit) return 0;
+        erase_index(i);
+        return 1;
+    }
+
+    iterator erase(const_iterator it)
+    {
+        erase_index(it.idx);
+        return iterator(this, step(it.idx + 1));
+    }
+
+    void reserve(size_t count)
+    {
+        size_t n = limit ? limit : 2;
+        while (detail::over_load(count, 0, n)) n <<= 1;
+        if (n != limit || tombs) rehash(n);
+    }
+
+private:
+    value_type *data;
+    uint64_t *bitmap;
+    size_t used;
+    size_t tombs;
+    size_t limit;
+    Hash hasher;
+    Eq compare;
+
+    void destroy_all()
+    {
+        if (!std::is_trivially_destructible<value_type>::value) {
+            for (size_t i = step(0); i < limit; i = step(i + 1)) data[i].~value_type();
+        }
+    }
+
+    void release()
+    {
+        if (!data) return;
+        destroy_all();
+        ::operator delete(data);
+        std::free(bitmap);
+        data = nullptr;
+        bitmap = nullptr;
+    }
+
+    size_t step(size_t i) const
+    {
+        while (i < limit && !detail::slot_occupied(bitmap, i)) i++;
+        return i;
+    }
+
+    size_t find_index(const K &key) const
+    {
+        if (!data) return limit;
+        size_t i = detail::probe_find(bitmap, limit, hasher(key),
+            [&](size_t j) { return compare(data[j].first, key); });
+        return i == detail::npos ? limit : i;
+    }
+
+    template <typename KK, typename... Args>
+    std::pair<iterator,bool> emplace_key(KK &&key, Args&&... args)
+    {
+        if (!data) rehash(detail::round_limit(hmap_default_size));
+        size_t hash = hasher(key), free_slot;
+        auto match = [&](size_t j) { return compare(data[j].first, key); };
+        size_t i = detail::probe_insert(bitmap, limit, hash, match, &free_slot);
+        if (i != detail::npos) return std::make_pair(iterator(this, i), false);
+        if (detail::over_load(used + 1, tombs, limit)) {
+            rehash(limit << 1);
+            free_slot = detail::probe_free(bitmap, limit, hash);
+        }
+        new (&data[free_slot]) value_type(std::piecewise_construct,
+            std::forward_as_tuple(std::forward<KK>(key)),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+        if (hmap_bitmap_get(bitmap, free_slot) == hmap_deleted) tombs--;
+        detail::slot_set(bitmap, free_slot);
+        used++;
+        return std::make_pair(iterator(this, free_slot), true);
+    }
+
+    void erase_index(size_t i)
+    {
+        data[i].~value_type();
+        detail::slot_erase(bitmap, i);
+        used--;
+        tombs++;
+    }
+
+    void rehash(size_t new_limit)
+    {
+        value_type *old_data = data;
+        uint64_t *old_bitmap = bitmap;
+        size_t old_limit = limit;
+
+        detail::table_alloc(new_limit, data, bitmap);
+        limit = new_limit;
+        for (size_t i = 0; i < old_limit; i++) {
+            if (!detail::slot_occupied(old_bitmap, i)) continue;
+            size_t j = detail::probe_free(bitmap, limit, hasher(old_data[i].first));
+            new (&data[j]) value_type(std::move(old_data[i]));
+            detail::slot_set(bitmap, j);
+            old_data[i].~value_type();
+        }
+        tombs = 0;
+        ::operator delete(old_data);
+        std::free(old_bitmap);
+    }
+};
+
+/*
+ * chashmap::lhmap
+ */
+
+template <typename K, typename V,
+          typename Hash = default_hash<K>, typename Eq = std::equal_to<K>>
+class lhmap
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<K,V> value_type;
+    typedef size_t size_type;
+
+    template <typename T, typename M>
+    class basic_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef typename std::remove_const<T>::type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef T* pointer;
+        typedef T& reference;
+
+        basic_iterator() : m(nullptr), idx(detail::npos) {}
+        basic_iterator(M *m, size_t idx) : m(m), idx(idx) {}
+        template <typename U, typename N>
+        basic_iterator(const basic_iterator<U,N> &o) : m(o.m), idx(o.idx) {}
+
+        reference operator*() const { return m->data[idx].kv; }
+        pointer operator->() const { return &m->data[idx].kv; }
+        basic_iterator& operator++() { idx = m->data[idx].next; return *this; }
+        basic_iterator operator++(int) { basic_iterator t = *this; ++*this; return t; }
+        basic_iterator& operator--()
+        {
+            idx = idx == detail::npos ? m->tail : m->data[idx].prev; return *this;
+        }
+        basic_iterator operator--(int) { basic_iterator t = *this; --*this; return t; }
+        bool operator==(const basic_iterator &o) const { return m == o.m && idx == o.idx; }
+        bool operator!=(const basic_iterator &o) const { return m != o.m || idx != o.idx; }
+
+        M *m;
+        size_t idx;
+    };
+
+    typedef basic_iterator<value_type,lhmap> iterator;
+    typedef basic_iterator<const value_type,const lhmap> const_iterator;
+
+    explicit lhmap(size_t limit = hmap_default_size,
+                   const Hash &hash = Hash(), const Eq &eq = Eq()) :
+        data(nullptr), bitmap(nullptr), used(0), tombs(0),
+        limit(detail::round_limit(limit)), head(detail::npos), tail(detail::npos),
+        hasher(hash), compare(eq)
+    {
+        detail::table_alloc(this->limit, data, bitmap);
+    }
+
+    /* copies into a new table, committing it only once every entry is copied */
+    lhmap(const lhmap &o) :
+        data(nullptr), bitmap(nullptr), used(0), tombs(0), limit(0),
+        head(detail::npos), tail(detail::npos),
+        hasher(o.hasher), compare(o.compare)
+    {
+        if (!o.data) return;
+        node *d;
+        uint64_t *b;
+        detail::table_alloc(o.limit, d, b);
+        size_t i = o.head;
+        try {
+            for (; i != detail::npos; i = o.data[i].next) {
+                new (&d[i]) node(o.data[i].kv);
+                d[i].prev = o.data[i].prev;
+                d[i].next = o.data[i].next;
+            }
+        } catch (...) {
+            for (size_t j = o.head; j != i; j = o.data[j].next) d[j].~node();
+            ::operator delete(d);
+            std::free(b);
+            throw;
+        }
+        std::memcpy(b, o.bitmap, hmap_bitmap_size(o.limit));
+        data = d;
+        bitmap = b;
+        used = o.used;
+        tombs = o.tombs;
+        limit = o.limit;
+        head = o.head;
+        tail = o.tail;
+    }
+
+    /* the source is left empty without a table, which is allocated on insert */
+    lhmap(lhmap &&o) noexcept :
+        data(o.data), bitmap(o.bitmap), used(o.used), tombs(o.tombs),
+        limit(o.limit), head(o.head), tail(o.tail),
+        hasher(std::move(o.hasher)), compare(std::move(o.compare))
+    {
+        o.data = nullptr;
+        o.bitmap = nullptr;
+        o.used = o.tombs = o.limit = 0;
+        o.head = o.tail = detail::npos;
+    }
+
+    lhmap& operator=(const lhmap &o)
+    {
+        if (this != &o) { lhmap t(o); swap(t); }
+        return *this;
+    }
+
+    lhmap& operator=(lhmap &&o) noexcept
+    {
+        if (this != &o) { lhmap t(std::move(o)); swap(t); }
+        return *this;
+    }
+
+    ~lhmap() { release(); }
+
+    void swap(lhmap &o) noexcept
+    {
+        std::swap(data, o.data);
+        std::swap(bitmap, o.bitmap);
+        std::swap(used, o.used);
+        std::swap(tombs, o.tombs);
+        std::swap(limit, o.limit);
+        std::swap(head, o.head);
+        std::swap(tail, o.tail);
+        std::swap(hasher, o.hasher);
+        std::swap(compare, o.compare);
+    }
+
+    iterator begin() { return iterator(this, head); }
+    iterator end() { return iterator(this, detail::npos); }
+    const_iterator begin() const { return const_iterator(this, head); }
+    const_iterator end() const { return const_iterator(this, detail::npos); }
+
+    size_t size() const { return used; }
+    bool empty() const { return used == 0; }
+    size_t capacity() const { return limit; }
+    size_t load() const { return limit ? (used + tombs) * hmap_load_multiplier / limit : 0; }
+
+    void clear()
+    {
+        if (!data) return;
+        destroy_all();
+        std::memset(bitmap, 0, hmap_bitmap_size(limit));
+        head = tail = detail::npos;
+        used = tombs = 0;
+    }
+
+    /* emplaces before pos if the key is absent, matching lhmap_insert */
+    template <typename... Args>
+    std::pair<iterator,bool> emplace_hint(const_iterator pos, const K &key, Args&&... args)
+    {
+        return emplace_key(pos.idx, key, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    std::pair<iterator,bool> emplace_hint(const_iterator pos, K &&key, Args&&... args)
+    {
+        return emplace_key(pos.idx, std::move(key), std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    std::pair<iterator,bool> emplace(const K &key, Args&&... args)
+    {
+        return emplace_key(detail::npos, key, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    std::pair<iterator,bool> emplace(K &&key, Args&&... args)
+    {
+        return emplace_key(detail::npos, std::move(key), std::forward<Args>(args)...);
+    }
+
+    iterator insert(const_iterator pos, const value_type &kv)
+    {
+        std::pair<iterator,bool> r = emplace_key(pos.idx, kv.first, kv.second);
+        if (!r.second) r.first->second = kv.second;
+        return r.first;
+    }
+
+    iterator insert(const_iterator pos, value_type &&kv)
+    {
+        std::pair<iterator,bool> r = emplace_key(pos.idx,
+            std::move(kv.first), std::move(kv.second));
+        if (!r.second) r.first->second = std::move(kv.second);
+        return r.first;
+    }
+
+    iterator insert(const value_type &kv) { return insert(end(), kv); }
+    iterator insert(value_type &&kv) { return insert(end(), std::move(kv)); }
+
+    V& operator[](const K &key) { return emplace_key(detail::npos, key).first->second; }
+    V& operator[](K &&key) { return emplace_key(detail::npos, std::move(key)).first->second; }
+
+    iterator find(const K &key) { return iterator(this, find_index(key)); }
+    const_iterator find(const K &key) const { return const_iterator(this, find_index(key)); }
+
+    size_t erase(const K &key)
+    {
+        size_t i = find_index(key);
+        if (i == detail::npos) return 0;
+        erase_index(i);
+        return 1;
+    }
+
+    iterator erase(const_iterator it)
+    {
+        size_t next = data[it.idx].next;
+        erase_index(it.idx);
+        return iterator(this, next);
+    }
+
+    void reserve(size_t count)
+    {
+        size_t n = limit ? limit : 2;
+        while (detail::over_load(count, 0, n)) n <<= 1;
+        if (n != limit || tombs) rehash(n);
+    }
+
+private:
+    struct node
+    {
+        size_t prev;
+        size_t next;
+        value_type kv;
+
+        template <typename... Args>
+        node(Args&&... args) : prev(detail::npos), next(detail::npos),
+            kv(std::forward<Args>(args)...) {}
+    };
+
+    node *data;
+    uint64_t *bitmap;
+    size_t used;
+    size_t tombs;
+    size_t limit;
+    size_t head;
+    size_t tail;
+    Hash hasher;
+    Eq compare;
+
+    void destroy_all()
+    {
+        if (!std::is_trivially_destructible<value_type>::value) {
+            for (size_t i = head; i != detail::npos; i = data[i].next) data[i].~node();
+        }
+    }
+
+    void release()
+    {
+        if (!data) return;
+        destroy_all();
+        ::operator delete(data);
+        std::free(bitmap);
+        data = nullptr;
+        bitmap = nullptr;
+    }
+
+    size_t find_index(const K &key) const
+    {
+        if (!data) return detail::npos;
+        return detail::probe_find(bitmap, limit, hasher(key),
+            [&](size_t j) { return compare(data[j].kv.first, key); });
+    }
+
+    /* inserts link i before pos, or at the tail if pos is npos */
+    void link(size_t pos, size_t i)
+    {
+        if (head == detail::npos) {
+            head = tail = i;
+            data[i].prev = data[i].next = detail::npos;
+        } else if (pos == detail::npos) {
+            data[i].next = detail::npos;
+            data[i].prev = tail;
+            data[tail].next = i;
+            tail = i;
+        } else {
+            data[i].next = pos;
+            data[i].prev = data[pos].prev;
+            if (data[pos].prev != detail::npos) data[data[pos].prev].next = i;
+            data[pos].prev = i;
+            if (head == pos) head = i;
+        }
+    }
+
+    void unlink(size_t i)
+    {
+        if (head == i) head = data[i].next;
+        if (tail == i) tail = data[i].prev;
+        if (data[i].prev != detail::npos) data[data[i].prev].next = data[i].next;
+        if (data[i].next != detail::npos) data[data[i].next].prev = data[i].prev;
+    }
+
+    template <typename KK, typename... Args>
+    std::pair<iterator,bool> emplace_key(size_t pos, KK &&key, Args&&... args)
+    {
+        if (!data) rehash(detail::round_limit(hmap_default_size));
+        size_t hash = hasher(key), free_slot;
+        auto match = [&](size_t j) { return compare(data[j].kv.first, key); };
+        size_t i = detail::probe_insert(bitmap, limit, hash, match, &free_slot);
+        if (i != detail::npos) return std::make_pair(iterator(this, i), false);
+        if (detail::over_load(used + 1, tombs, limit)) {
+            rehash(limit << 1, &pos);
+            free_slot = detail::probe_free(bitmap, limit, hash);
+        }
+        new (&data[free_slot]) node(std::piecewise_construct,
+            std::forward_as_tuple(std::forward<KK>(key)),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+        if (hmap_bitmap_get(bitmap, free_slot) == hmap_deleted) tombs--;
+        detail::slot_set(bitmap, free_slot);
+        link(pos, free_slot);
+        used++;
+        return std::make_pair(iterator(this, free_slot), true);
+    }
+
+    void erase_index(size_t i)
+    {
+        unlink(i);
+        data[i].~node();
+        detail::slot_erase(bitmap, i);
+        used--;
+        tombs++;
+    }
+
+    /* rehashes preserving order, remapping the index in *pos if not npos */
+    void rehash(size_t new_limit, size_t *pos = nullptr)
+    {
+        node *old_data = data;
+        uint64_t *old_bitmap = bitmap;
+        size_t old_head = head;
+        size_t old_pos = pos ? *pos : detail::npos;
+
+        detail::table_alloc(new_limit, data, bitmap);
+        limit = new_limit;
+        head = tail = detail::npos;
+        for (size_t i = old_head; i != detail::npos; ) {
+            size_t next = old_data[i].next;
+            size_t j = detail::probe_free(bitmap, limit, hasher(old_data[i].kv.first));
+            if (i == old_pos) *pos = j;
+            new (&data[j]) node(std::move(old_data[i].kv));
+            detail::slot_set(bitmap, j);
+            link(detail::npos, j);
+            old_data[i].~node();
+            i = next;
+        }
+        tombs = 0;
+        ::operator delete(old_data);
+        std::free(old_bitmap);
+    }
+};
+
+}
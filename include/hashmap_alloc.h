@@ -0,0 +1,220 @@
+/*
+ * PLEASE LICENSE 2023, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "hashmap.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+/*
+ * hmap_allocator backends
+ *
+ * hmap_aligned_allocator returns cache-line aligned tables so a probe
+ * group or slot never straddles an extra line.
+ *
+ * hmap_arena_allocator bump allocates cache-line aligned tables from
+ * blocks owned by an hmap_arena. free only gives back the most recent
+ * allocation, so maps that are thrown away together cost nothing to
+ * destroy and hmap_arena_reset rewinds every block for reuse.
+ *
+ * hmap_huge_allocator maps tables of at least threshold bytes directly,
+ * aligned to 2MiB and advised with MADV_HUGEPAGE so random probes into a
+ * large table take fewer TLB misses. smaller tables and platforms without
+ * madvise use the aligned backend. with glibc in strict ISO mode this
+ * needs _DEFAULT_SOURCE for MAP_ANONYMOUS and madvise.
+ */
+
+typedef struct hmap_arena hmap_arena;
+typedef struct hmap_arena_block hmap_arena_block;
+
+static inline hmap_allocator hmap_aligned_allocator(void);
+static inline void hmap_arena_init(hmap_arena *a, size_t block_size);
+static inline void hmap_arena_reset(hmap_arena *a);
+static inline void hmap_arena_destroy(hmap_arena *a);
+static inline hmap_allocator hmap_arena_allocator(hmap_arena *a);
+static inline hmap_allocator hmap_huge_allocator(size_t threshold);
+
+/*
+ * hmap_allocator backend implementation
+ */
+
+static const size_t hmap_cache_line = 64;
+static const size_t hmap_huge_page = (size_t)2 << 20;
+
+/* the pointer from malloc is kept in the word before the aligned block */
+static inline void* hmap_aligned_alloc_fn(void *userdata, size_t size)
+{
+    (void)userdata;
+    unsigned char *p = (unsigned char*)malloc(size + sizeof(void*) + hmap_cache_line - 1);
+    if (!p) return NULL;
+    uintptr_t a = ((uintptr_t)p + sizeof(void*) + hmap_cache_line - 1) &
+        ~(uintptr_t)(hmap_cache_line - 1);
+    ((void**)a)[-1] = p;
+    return (void*)a;
+}
+
+static inline void hmap_aligned_free_fn(void *userdata, void *ptr, size_t size)
+{
+    (void)userdata;
+    (void)size;
+    free(((void**)ptr)[-1]);
+}
+
+static inline hmap_allocator hmap_aligned_allocator(void)
+{
+    hmap_allocator a = { hmap_aligned_alloc_fn, hmap_aligned_free_fn, NULL };
+    return a;
+}
+
+struct hmap_arena_block
+{
+    hmap_arena_block *next;
+    size_t size;
+    size_t used;
+    unsigned char *base;
+};
+
+struct hmap_arena
+{
+    hmap_arena_block *head;
+    hmap_arena_block *cur;
+    size_t block_size;
+};
+
+static inline void hmap_arena_init(hmap_arena *a, size_t block_size)
+{
+    a->head = NULL;
+    a->cur = NULL;
+    a->block_size = block_size;
+}
+
+/* rewinds every block, no map using the arena may be accessed afterwards */
+static inline void hmap_arena_reset(hmap_arena *a)
+{
+    for (hmap_arena_block *b = a->head; b; b = b->next) b->used = 0;
+    a->cur = a->head;
+}
+
+static inline void hmap_arena_destroy(hmap_arena *a)
+{
+    for (hmap_arena_block *b = a->head, *next; b; b = next) {
+        next = b->next;
+        free(b);
+    }
+    a->head = a->cur = NULL;
+}
+
+static inline hmap_arena_block* hmap_arena_block_new(hmap_arena *a, size_t size)
+{
+    size_t block_size = size > a->block_size ? size : a->block_size;
+    hmap_arena_block *b = (hmap_arena_block*)malloc(
+        sizeof(hmap_arena_block) + block_size + hmap_cache_line - 1);
+    if (!b) return NULL;
+    b->next = NULL;
+    b->size = block_size;
+    b->used = 0;
+    b->base = (unsigned char*)(((uintptr_t)(b + 1) + hmap_cache_line - 1) &
+        ~(uintptr_t)(hmap_cache_line - 1));
+    return b;
+}
+
+/* uses the first block from cur with room, appending a new one at the end */
+static inline void* hmap_arena_alloc_fn(void *userdata, size_t size)
+{
+    hmap_arena *a = (hmap_arena*)userdata;
+    hmap_arena_block *b = a->cur, *last = NULL;
+
+    size = (size + hmap_cache_line - 1) & ~(hmap_cache_line - 1);
+    for (; b && b->size - b->used < size; b = b->next) last = b;
+    if (!b) {
+        if (!(b = hmap_arena_block_new(a, size))) return NULL;
+        if (last) last->next = b; else a->head = b;
+    }
+    a->cur = b;
+
+    void *p = b->base + b->used;
+    b->used += size;
+    return p;
+}
+
+static inline void hmap_arena_free_fn(void *userdata, void *ptr, size_t size)
+{
+    hmap_arena *a = (hmap_arena*)userdata;
+    hmap_arena_block *b = a->cur;
+
+    size = (size + hmap_cache_line - 1) & ~(hmap_cache_line - 1);
+    if (b && (unsigned char*)ptr + size == b->base + b->used) b->used -= size;
+}
+
+static inline hmap_allocator hmap_arena_allocator(hmap_arena *a)
+{
+    hmap_allocator alloc = { hmap_arena_alloc_fn, hmap_arena_free_fn, a };
+    return alloc;
+}
+
+#if defined(__linux__) && defined(MAP_ANONYMOUS) && defined(MADV_HUGEPAGE)
+
+static inline size_t hmap_huge_round(size_t size)
+{
+    return (size + hmap_huge_page - 1) & ~(hmap_huge_page - 1);
+}
+
+/* over-maps by one huge page and trims both ends to align the mapping */
+static inline void* hmap_huge_alloc_fn(void *userdata, size_t size)
+{
+    if (size < (size_t)(uintptr_t)userdata) return hmap_aligned_alloc_fn(NULL, size);
+
+    size_t len = hmap_huge_round(size);
+    unsigned char *p = (unsigned char*)mmap(NULL, len + hmap_huge_page,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == (unsigned char*)MAP_FAILED) return NULL;
+
+    unsigned char *a = (unsigned char*)(((uintptr_t)p + hmap_huge_page - 1) &
+        ~(uintptr_t)(hmap_huge_page - 1));
+    if (a != p) munmap(p, a - p);
+    if (a + len != p + len + hmap_huge_page) {
+        munmap(a + len, (p + len + hmap_huge_page) - (a + len));
+    }
+    madvise(a, len, MADV_HUGEPAGE);
+    return a;
+}
+
+static inline void hmap_huge_free_fn(void *userdata, void *ptr, size_t size)
+{
+    if (size < (size_t)(uintptr_t)userdata) {
+        hmap_aligned_free_fn(NULL, ptr, size);
+    } else {
+        munmap(ptr, hmap_huge_round(size));
+    }
+}
+
+static inline hmap_allocator hmap_huge_allocator(size_t threshold)
+{
+    hmap_allocator a = { hmap_huge_alloc_fn, hmap_huge_free_fn, (void*)(uintptr_t)threshold };
+    return a;
+}
+
+#else
+
+static inline hmap_allocator hmap_huge_allocator(size_t threshold)
+{
+    (void)threshold;
+    return hmap_aligned_allocator();
+}
+
+#endif
@@ -0,0 +1,313 @@
+/*
+ * PLEASE LICENSE 2023, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hashmap.h"
+
+/*
+ * hmap and lhmap snapshot file interface
+ *
+ * hmap_save and lhmap_save write a header followed by the table storage
+ * exactly as it is in memory, as data, hashes and metadata are a single
+ * allocation and lhmap links are slot indices. hmap_map and lhmap_map map
+ * a snapshot read-only with no per-entry work, so opening is independent
+ * of size and processes mapping the same file share the page cache.
+ *
+ * the header records key and value size, limit, counts, load factors,
+ * flags, seed and the lhmap head and tail, plus the word size, byte order
+ * and group width the layout depends on. a mismatch fails to map.
+ *
+ * a mapped map uses the default hash with the saved seed. a map that used
+ * a custom hasher or compare must have them assigned after mapping. a
+ * mapped map is read-only: use find, the batch lookups and iteration, not
+ * insert or get, which may claim a slot. destroy unmaps it.
+ *
+ * the snapshot is written to path.tmp and renamed over path, so a process
+ * that has the old file mapped keeps a consistent view. these functions
+ * return zero on success or -1 with errno set. a map with
+ * hmap_flag_indirect keeps its values outside the table and cannot be
+ * saved, failing with EINVAL. POSIX is required.
+ */
+
+typedef struct hmap_file_header hmap_file_header;
+
+static inline int hmap_save(hmap *h, const char *path);
+static inline int hmap_map(hmap *h, const char *path);
+static inline int lhmap_save(lhmap *h, const char *path);
+static inline int lhmap_map(lhmap *h, const char *path);
+
+/*
+ * hmap and lhmap snapshot file implementation
+ */
+
+enum hmap_file_kind { hmap_file_hmap = 1, hmap_file_lhmap = 2 };
+
+static const char hmap_file_magic[8] = { 'h', 'm', 'a', 'p', 's', 'n', 'a', 'p' };
+static const uint32_t hmap_file_version = 1;
+static const uint32_t hmap_file_endian = 0x01020304;
+
+/* data starts one page in so the mapped table is page aligned */
+static const size_t hmap_file_data_offset = 4096;
+
+struct hmap_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t kind;
+    uint32_t flags;
+    uint32_t word_size;
+    uint32_t group_width;
+    uint64_t key_size;
+    uint64_t val_size;
+    uint64_t limit;
+    uint64_t used;
+    uint64_t tombs;
+    uint64_t max_load;
+    uint64_t min_load;
+    uint64_t seed;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t size;
+};
+
+static inline hmap_file_header hmap_file_header_make(uint32_t kind, unsigned flags)
+{
+    hmap_file_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, hmap_file_magic, sizeof(hdr.magic));
+    hdr.version = hmap_file_version;
+    hdr.endian = hmap_file_endian;
+    hdr.kind = kind;
+    hdr.flags = flags;
+    hdr.word_size = sizeof(size_t);
+    hdr.group_width = (flags & hmap_flag_tags) ? HMAP_GROUP_WIDTH : 0;
+    return hdr;
+}
+
+static inline int hmap_file_write(const char *path, hmap_file_header *hdr, const void *data)
+{
+    static const unsigned char zero[64];
+    size_t len = strlen(path);
+    char *tmp = (char*)malloc(len + 5);
+    FILE *f;
+    int ok;
+
+    if (!tmp) return -1;
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", 5);
+
+    if (!(f = fopen(tmp, "wb"))) {
+        free(tmp);
+        return -1;
+    }
+    ok = fwrite(hdr, sizeof(*hdr), 1, f) == 1;
+    for (size_t pad = hmap_file_data_offset - sizeof(*hdr); ok && pad; ) {
+        size_t n = pad < sizeof(zero) ? pad : sizeof(zero);
+        ok = fwrite(zero, 1, n, f) == n;
+        pad -= n;
+    }
+    ok = ok && fwrite(data, 1, (size_t)hdr->size, f) == (size_t)hdr->size;
+    ok = (fclose(f) == 0) && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) remove(tmp);
+    free(tmp);
+    return ok ? 0 : -1;
+}
+
+/* maps path and checks the header matches kind and this build's layout */
+static inline const hmap_file_header* hmap_file_map(const char *path, uint32_t kind)
+{
+    struct stat st;
+    void *p;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) return NULL;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+    if ((size_t)st.st_size < hmap_file_data_offset) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return NULL;
+
+    const hmap_file_header *hdr = (const hmap_file_header*)p;
+    if (memcmp(hdr->magic, hmap_file_magic, sizeof(hdr->magic)) != 0 ||
+        hdr->version != hmap_file_version || hdr->endian != hmap_file_endian ||
+        hdr->kind != kind || hdr->word_size != sizeof(size_t) ||
+        ((hdr->flags & hmap_flag_tags) && hdr->group_width != HMAP_GROUP_WIDTH) ||
+        !hmap_ispow2((size_t)hdr->limit) ||
+        hdr->size != (uint64_t)st.st_size - hmap_file_data_offset)
+    {
+        munmap(p, (size_t)st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+    return hdr;
+}
+
+static inline void* hmap_mapped_alloc_fn(void *userdata, size_t size)
+{
+    (void)userdata;
+    (void)size;
+    assert(!"mapped hash table is read-only");
+    return NULL;
+}
+
+static inline void hmap_mapped_free_fn(void *userdata, void *ptr, size_t size)
+{
+    (void)userdata;
+    munmap((unsigned char*)ptr - hmap_file_data_offset, hmap_file_data_offset + size);
+}
+
+static const hmap_allocator hmap_mapped_allocator = {
+    hmap_mapped_alloc_fn, hmap_mapped_free_fn, NULL
+};
+
+/* unmaps the file if its size does not match the header fields */
+static inline int hmap_file_check(const hmap_file_header *hdr, size_t size)
+{
+    if (hdr->size == size) return 1;
+    munmap((void*)hdr, hmap_file_data_offset + (size_t)hdr->size);
+    errno = EINVAL;
+    return 0;
+}
+
+static inline int hmap_save(hmap *h, const char *path)
+{
+    hmap_file_header hdr = hmap_file_header_make(hmap_file_hmap, h->flags);
+
+    if (h->flags & hmap_flag_indirect) {
+        errno = EINVAL;
+        return -1;
+    }
+    hmap_migrate(h);
+    hdr.key_size = h->key_size;
+    hdr.val_size = h->val_size;
+    hdr.limit = h->limit;
+    hdr.used = h->used;
+    hdr.tombs = h->tombs;
+    hdr.max_load = h->max_load;
+    hdr.min_load = h->min_load;
+    hdr.seed = h->seed;
+    hdr.head = hdr.tail = hmap_empty_offset;
+    hdr.size = hmap_total_size(h, h->limit);
+    return hmap_file_write(path, &hdr, h->data);
+}
+
+static inline int hmap_map(hmap *h, const char *path)
+{
+    const hmap_file_header *hdr = hmap_file_map(path, hmap_file_hmap);
+    if (!hdr) return -1;
+
+    h->key_size = (size_t)hdr->key_size;
+    h->val_size = (size_t)hdr->val_size;
+    h->used = (size_t)hdr->used;
+    h->tombs = (size_t)hdr->tombs;
+    h->limit = (size_t)hdr->limit;
+    h->max_load = (size_t)hdr->max_load;
+    h->min_load = (size_t)hdr->min_load;
+    h->flags = hdr->flags;
+    h->seed = hdr->seed;
+    h->hasher = hmap_default_hash_fn;
+    h->compare = hmap_default_compare_fn;
+    h->allocator = hmap_mapped_allocator;
+    h->data = (unsigned char*)hdr + hmap_file_data_offset;
+    h->old_data = NULL;
+    h->old_hashes = NULL;
+    h->old_bitmap = NULL;
+    h->old_limit = 0;
+    h->old_used = 0;
+    h->old_pos = 0;
+    hmap_slab_init(h);
+    h->rehash = NULL;
+    h->rehash_threads = 0;
+    h->userdata = NULL;
+    hmap_stats_reset(h);
+    if (!hmap_file_check(hdr, hmap_total_size(h, h->limit))) {
+        h->data = NULL;
+        return -1;
+    }
+    hmap_meta_bind(h);
+    return 0;
+}
+
+static inline int lhmap_save(lhmap *h, const char *path)
+{
+    hmap_file_header hdr = hmap_file_header_make(hmap_file_lhmap, h->flags);
+
+    hdr.key_size = h->key_size;
+    hdr.val_size = h->val_size;
+    hdr.limit = h->limit;
+    hdr.used = h->used;
+    hdr.tombs = h->tombs;
+    hdr.max_load = h->max_load;
+    hdr.min_load = h->min_load;
+    hdr.seed = h->seed;
+    hdr.head = h->head;
+    hdr.tail = h->tail;
+    hdr.size = lhmap_total_size(h, h->limit);
+    return hmap_file_write(path, &hdr, h->data);
+}
+
+static inline int lhmap_map(lhmap *h, const char *path)
+{
+    const hmap_file_header *hdr = hmap_file_map(path, hmap_file_lhmap);
+    if (!hdr) return -1;
+
+    h->key_size = (size_t)hdr->key_size;
+    h->val_size = (size_t)hdr->val_size;
+    h->used = (size_t)hdr->used;
+    h->tombs = (size_t)hdr->tombs;
+    h->limit = (size_t)hdr->limit;
+    h->max_load = (size_t)hdr->max_load;
+    h->min_load = (size_t)hdr->min_load;
+    h->flags = hdr->flags;
+    h->seed = hdr->seed;
+    h->hasher = lhmap_default_hash_fn;
+    h->compare = lhmap_default_compare_fn;
+    h->allocator = hmap_mapped_allocator;
+    h->data = (unsigned char*)hdr + hmap_file_data_offset;
+    h->head = (size_t)hdr->head;
+    h->tail = (size_t)hdr->tail;
+    h->max_entries = 0;
+    h->max_bytes = 0;
+    h->bytes = 0;
+    h->cost = NULL;
+    h->evict = NULL;
+    h->rehash = NULL;
+    h->rehash_threads = 0;
+    h->userdata = NULL;
+    lhmap_stats_reset(h);
+    if (!hmap_file_check(hdr, lhmap_total_size(h, h->limit))) {
+        h->data = NULL;
+        return -1;
+    }
+    lhmap_meta_bind(h);
+    return 0;
+}
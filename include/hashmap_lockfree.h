@@ -0,0 +1,419 @@
+/*
+ * PLEASE LICENSE 2023, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include "hashmap.h"
+
+/*
+ * hmap_lf lock-free hash table interface
+ *
+ * a map from uint64_t keys to uint64_t values where any number of threads
+ * insert, find and erase concurrently without locks. each slot is a key
+ * word and a value word. keys are claimed with compare-and-swap and never
+ * change afterwards, and values are published with release semantics.
+ * erase is logical, replacing the value with a tombstone.
+ *
+ * key zero is reserved for empty slots. values must be non-zero and below
+ * 2^62 as the top two bits mark tombstones and slots being migrated. find
+ * returns zero for a missing key.
+ *
+ * when a table fills, a larger table (or one of the same size if most
+ * slots hold tombstones) is chained after it and every operation that
+ * passes the old table copies a chunk of slots across until the new
+ * table is promoted. a slot is first
+ * primed, freezing its value, then copied and finally marked moved, so
+ * a thread that finds a primed slot finishes the copy before using the
+ * new table. old tables are kept until hmap_lf_destroy or
+ * hmap_lf_quiesce, as a lock-free reader may still be probing them.
+ */
+
+typedef struct hmap_lf hmap_lf;
+typedef struct hmap_lf_table hmap_lf_table;
+typedef struct hmap_lf_slot hmap_lf_slot;
+
+static inline void hmap_lf_init(hmap_lf *m, size_t limit);
+static inline void hmap_lf_destroy(hmap_lf *m);
+static inline void hmap_lf_quiesce(hmap_lf *m);
+static inline size_t hmap_lf_count(hmap_lf *m);
+static inline size_t hmap_lf_capacity(hmap_lf *m);
+static inline int hmap_lf_insert(hmap_lf *m, uint64_t key, uint64_t val);
+static inline uint64_t hmap_lf_find(hmap_lf *m, uint64_t key);
+static inline int hmap_lf_erase(hmap_lf *m, uint64_t key);
+
+/*
+ * hmap_lf implementation
+ */
+
+#define HMAP_LF_STRIPES 16
+
+static const uint64_t hmap_lf_tomb = 1ull << 62;
+static const uint64_t hmap_lf_prime = 1ull << 63;
+static const uint64_t hmap_lf_moved = (1ull << 63) | (1ull << 62);
+static const size_t hmap_lf_full = (size_t)-2LL;
+static const size_t hmap_lf_chunk = 1024;
+
+/* counters are striped over cache lines by hash to avoid contention */
+typedef struct hmap_lf_counter hmap_lf_counter;
+struct hmap_lf_counter
+{
+    _Alignas(64) atomic_size_t n;
+};
+
+struct hmap_lf_slot
+{
+    _Atomic uint64_t key;
+    _Atomic uint64_t val;
+};
+
+struct hmap_lf_table
+{
+    size_t limit;
+    _Atomic(hmap_lf_table*) next;
+    atomic_size_t copy_idx;
+    atomic_size_t copy_done;
+    hmap_lf_counter claimed[HMAP_LF_STRIPES];
+    hmap_lf_slot *slots;
+    void *alloc;
+};
+
+struct hmap_lf
+{
+    _Atomic(hmap_lf_table*) table;
+    hmap_lf_table *first;
+    uint64_t seed;
+    hmap_lf_counter live[HMAP_LF_STRIPES];
+};
+
+static inline size_t hmap_lf_hash(hmap_lf *m, uint64_t key)
+{
+    return (size_t)hmap_mix(key ^ m->seed, hmap_hash_secret[1]);
+}
+
+static inline size_t hmap_lf_stripe(size_t hash)
+{
+    return (hash >> 32) & (HMAP_LF_STRIPES - 1);
+}
+
+static inline size_t hmap_lf_sum(hmap_lf_counter *c)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < HMAP_LF_STRIPES; i++) {
+        n += atomic_load_explicit(&c[i].n, memory_order_relaxed);
+    }
+    return n;
+}
+
+static inline hmap_lf_table* hmap_lf_table_alloc(size_t limit)
+{
+    size_t head = (sizeof(hmap_lf_table) + 63) & ~(size_t)63;
+    void *alloc = malloc(head + sizeof(hmap_lf_slot) * limit + 63);
+    hmap_lf_table *t = (hmap_lf_table*)(((uintptr_t)alloc + 63) & ~(uintptr_t)63);
+
+    assert(hmap_ispow2(limit));
+
+    t->limit = limit;
+    t->alloc = alloc;
+    t->slots = (hmap_lf_slot*)((unsigned char*)t + head);
+    atomic_init(&t->next, NULL);
+    atomic_init(&t->copy_idx, 0);
+    atomic_init(&t->copy_done, 0);
+    for (size_t i = 0; i < HMAP_LF_STRIPES; i++) {
+        atomic_init(&t->claimed[i].n, 0);
+    }
+    for (size_t i = 0; i < limit; i++) {
+        atomic_init(&t->slots[i].key, 0);
+        atomic_init(&t->slots[i].val, 0);
+    }
+    return t;
+}
+
+static inline void hmap_lf_init(hmap_lf *m, size_t limit)
+{
+    if (limit < 16) limit = 16;
+    m->first = hmap_lf_table_alloc(limit);
+    m->seed = hmap_random_seed();
+    atomic_init(&m->table, m->first);
+    for (size_t i = 0; i < HMAP_LF_STRIPES; i++) {
+        atomic_init(&m->live[i].n, 0);
+    }
+}
+
+/* frees every table, no other thread may be using the map */
+static inline void hmap_lf_destroy(hmap_lf *m)
+{
+    for (hmap_lf_table *t = m->first, *next; t; t = next) {
+        next = atomic_load(&t->next);
+        free(t->alloc);
+    }
+    m->first = NULL;
+    atomic_store(&m->table, NULL);
+}
+
+/* frees tables that have been migrated, no other thread may be using the map */
+static inline void hmap_lf_quiesce(hmap_lf *m)
+{
+    hmap_lf_table *t = atomic_load(&m->table);
+    while (m->first != t) {
+        hmap_lf_table *next = atomic_load(&m->first->next);
+        free(m->first->alloc);
+        m->first = next;
+    }
+}
+
+/* approximate while other threads are inserting or erasing */
+static inline size_t hmap_lf_count(hmap_lf *m)
+{
+    return hmap_lf_sum(m->live);
+}
+
+static inline size_t hmap_lf_capacity(hmap_lf *m)
+{
+    return atomic_load(&m->table)->limit;
+}
+
+/*
+ * reserves a claim in t, failing once three quarters of the slots are
+ * taken. the increment comes first and all accesses are sequentially
+ * consistent, so of racing claims the last to count sees the others.
+ */
+static inline int hmap_lf_reserve(hmap_lf_table *t, size_t stripe)
+{
+    size_t n = 0;
+    atomic_fetch_add(&t->claimed[stripe].n, 1);
+    for (size_t i = 0; i < HMAP_LF_STRIPES; i++) n += atomic_load(&t->claimed[i].n);
+    if (n <= t->limit - (t->limit >> 2)) return 1;
+    atomic_fetch_sub(&t->claimed[stripe].n, 1);
+    return 0;
+}
+
+/*
+ * returns the slot holding key, claiming an empty one if claim is set.
+ * returns hmap_empty_offset if key is absent and claim is not set, or
+ * hmap_lf_full if the table has no room. no more than three quarters of
+ * the slots ever hold keys, so every probe ends at an empty slot, and a
+ * key that was refused one goes to the next table where a miss also looks.
+ */
+static inline size_t hmap_lf_probe(hmap_lf_table *t, uint64_t key, size_t hash, int claim)
+{
+    size_t mask = t->limit - 1, i = hash & mask, stripe = hmap_lf_stripe(hash);
+    for (;; i = (i+1) & mask) {
+        uint64_t k = atomic_load_explicit(&t->slots[i].key, memory_order_acquire);
+        if (k == key) return i;
+        if (k != 0) continue;
+        if (!claim) return hmap_empty_offset;
+        if (!hmap_lf_reserve(t, stripe)) return hmap_lf_full;
+        if (atomic_compare_exchange_strong(&t->slots[i].key, &k, key)) return i;
+        atomic_fetch_sub(&t->claimed[stripe].n, 1);
+        if (k == key) return i;
+    }
+}
+
+/* chains a new table after t, sized for the live count, or returns the one there */
+static inline hmap_lf_table* hmap_lf_resize(hmap_lf *m, hmap_lf_table *t)
+{
+    hmap_lf_table *nt = atomic_load(&t->next);
+    if (nt) return nt;
+
+    size_t live = hmap_lf_sum(m->live), limit = t->limit;
+    while (live * 2 >= limit) limit <<= 1;
+    nt = hmap_lf_table_alloc(limit);
+
+    hmap_lf_table *expected = NULL;
+    if (!atomic_compare_exchange_strong(&t->next, &expected, nt)) {
+        free(nt->alloc);
+        return expected;
+    }
+    return nt;
+}
+
+static inline void hmap_lf_copy_slot(hmap_lf *m, hmap_lf_table *t, size_t i);
+
+/* stores val into an empty slot for key, leaving any newer value in place */
+static inline void hmap_lf_put_copy(hmap_lf *m, hmap_lf_table *t, uint64_t key, uint64_t val)
+{
+    size_t hash = hmap_lf_hash(m, key);
+    for (;;) {
+        size_t i = hmap_lf_probe(t, key, hash, 1);
+        if (i == hmap_lf_full) {
+            t = hmap_lf_resize(m, t);
+            continue;
+        }
+        uint64_t cur = 0;
+        if (atomic_compare_exchange_strong(&t->slots[i].val, &cur, val)) return;
+        if (!(cur & hmap_lf_prime)) return;
+        hmap_lf_copy_slot(m, t, i);
+        t = atomic_load(&t->next);
+    }
+}
+
+/* primes, copies and marks slot i moved, t->next must exist */
+static inline void hmap_lf_copy_slot(hmap_lf *m, hmap_lf_table *t, size_t i)
+{
+    _Atomic uint64_t *pv = &t->slots[i].val;
+    uint64_t v = atomic_load(pv);
+
+    for (;;) {
+        if (v == hmap_lf_moved) return;
+        if (v == 0 || v == hmap_lf_tomb) {
+            if (atomic_compare_exchange_strong(pv, &v, hmap_lf_moved)) return;
+            continue;
+        }
+        if (!(v & hmap_lf_prime)) {
+            if (!atomic_compare_exchange_strong(pv, &v, v | hmap_lf_prime)) continue;
+        }
+        break;
+    }
+
+    uint64_t key = atomic_load(&t->slots[i].key);
+    hmap_lf_put_copy(m, atomic_load(&t->next), key, v & ~hmap_lf_prime);
+    atomic_store(pv, hmap_lf_moved);
+}
+
+/* moves the map past tables whose copy has finished */
+static inline void hmap_lf_promote(hmap_lf *m)
+{
+    hmap_lf_table *t = atomic_load(&m->table), *nt;
+    while ((nt = atomic_load(&t->next)) &&
+           atomic_load(&t->copy_done) == t->limit) {
+        if (atomic_compare_exchange_strong(&m->table, &t, nt)) t = nt;
+    }
+}
+
+/*
+ * copies one chunk of t into its next table. every operation that passes
+ * a table with a next one calls this, so a copy always finishes and the
+ * map is promoted even if no thread touches the slots still to move.
+ */
+static inline void hmap_lf_help(hmap_lf *m, hmap_lf_table *t)
+{
+    if (atomic_load_explicit(&t->copy_idx, memory_order_relaxed) >= t->limit) return;
+    size_t start = atomic_fetch_add(&t->copy_idx, hmap_lf_chunk);
+    if (start >= t->limit) return;
+
+    size_t end = start + hmap_lf_chunk < t->limit ? start + hmap_lf_chunk : t->limit;
+    for (size_t i = start; i < end; i++) hmap_lf_copy_slot(m, t, i);
+    if (atomic_fetch_add(&t->copy_done, end - start) + (end - start) == t->limit) {
+        hmap_lf_promote(m);
+    }
+}
+
+/* returns 1 if key was added and 0 if an existing value was replaced */
+static inline int hmap_lf_insert(hmap_lf *m, uint64_t key, uint64_t val)
+{
+    size_t hash = hmap_lf_hash(m, key);
+    hmap_lf_table *t = atomic_load(&m->table), *nt;
+
+    assert(key != 0 && val != 0 && val < hmap_lf_tomb);
+
+    for (;;) {
+        size_t i = hmap_lf_probe(t, key, hash, 1);
+        if (i == hmap_lf_full) {
+            nt = hmap_lf_resize(m, t);
+            hmap_lf_help(m, t);
+            t = nt;
+            continue;
+        }
+        if ((nt = atomic_load(&t->next))) {
+            /* route through the old slot so its value is never stale */
+            hmap_lf_copy_slot(m, t, i);
+            hmap_lf_help(m, t);
+            t = nt;
+            continue;
+        }
+        _Atomic uint64_t *pv = &t->slots[i].val;
+        uint64_t v = atomic_load_explicit(pv, memory_order_relaxed);
+        while (!(v & hmap_lf_prime)) {
+            if (atomic_compare_exchange_weak_explicit(pv, &v, val,
+                memory_order_release, memory_order_relaxed))
+            {
+                int added = v == 0 || v == hmap_lf_tomb;
+                if (added) {
+                    atomic_fetch_add_explicit(&m->live[hmap_lf_stripe(hash)].n, 1,
+                        memory_order_relaxed);
+                }
+                return added;
+            }
+        }
+        hmap_lf_copy_slot(m, t, i);
+        nt = atomic_load(&t->next);
+        hmap_lf_help(m, t);
+        t = nt;
+    }
+}
+
+static inline uint64_t hmap_lf_find(hmap_lf *m, uint64_t key)
+{
+    size_t hash = hmap_lf_hash(m, key);
+    hmap_lf_table *t = atomic_load(&m->table), *nt;
+
+    for (;;) {
+        size_t i = hmap_lf_probe(t, key, hash, 0);
+        if ((nt = atomic_load(&t->next))) hmap_lf_help(m, t);
+        if (i == hmap_empty_offset) {
+            if (!nt) return 0;
+            t = nt;
+            continue;
+        }
+        uint64_t v = atomic_load_explicit(&t->slots[i].val, memory_order_acquire);
+        if (v & hmap_lf_prime) {
+            hmap_lf_copy_slot(m, t, i);
+            t = atomic_load(&t->next);
+            continue;
+        }
+        return v == hmap_lf_tomb ? 0 : v;
+    }
+}
+
+/* returns 1 if key was present */
+static inline int hmap_lf_erase(hmap_lf *m, uint64_t key)
+{
+    size_t hash = hmap_lf_hash(m, key);
+    hmap_lf_table *t = atomic_load(&m->table), *nt;
+
+    for (;;) {
+        size_t i = hmap_lf_probe(t, key, hash, 0);
+        if (i == hmap_empty_offset) {
+            if (!(nt = atomic_load(&t->next))) return 0;
+            hmap_lf_help(m, t);
+            t = nt;
+            continue;
+        }
+        if ((nt = atomic_load(&t->next))) {
+            hmap_lf_copy_slot(m, t, i);
+            hmap_lf_help(m, t);
+            t = nt;
+            continue;
+        }
+        _Atomic uint64_t *pv = &t->slots[i].val;
+        uint64_t v = atomic_load_explicit(pv, memory_order_relaxed);
+        while (!(v & hmap_lf_prime)) {
+            if (v == 0 || v == hmap_lf_tomb) return 0;
+            if (atomic_compare_exchange_weak_explicit(pv, &v, hmap_lf_tomb,
+                memory_order_release, memory_order_relaxed))
+            {
+                atomic_fetch_sub_explicit(&m->live[hmap_lf_stripe(hash)].n, 1,
+                    memory_order_relaxed);
+                return 1;
+            }
+        }
+        hmap_lf_copy_slot(m, t, i);
+        nt = atomic_load(&t->next);
+        hmap_lf_help(m, t);
+        t = nt;
+    }
+}
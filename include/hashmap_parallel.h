@@ -0,0 +1,862 @@
+/*
+ * PLEASE LICENSE 2023, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <threads.h>
+
+#include "hashmap.h"
+
+/*
+ * hmap parallel bulk operations interface
+ *
+ * hmap_build_parallel inserts n keys and values, stored contiguously in
+ * keys and vals, into an empty hmap using nthreads threads. the table is
+ * sized for n up front, then keys are hashed in parallel and bucketed by
+ * the high bits of their home slot into partitions that cover disjoint
+ * slot ranges, so each thread fills whole partitions without locks. an
+ * entry whose probe run would leave its partition, including runs that
+ * wrap past the end of the table, is deferred and inserted afterwards by
+ * the calling thread. later duplicates of a key replace earlier ones as
+ * with hmap_insert.
+ *
+ * the hasher and compare are called from several threads at once and
+ * must be safe to do so. the build needs two size_t of scratch per entry.
+ * a map that is not empty, or uses hmap_flag_robin_hood whose runs must
+ * stay ordered, is filled with hmap_insert on the calling thread.
+ *
+ * hmap_parallel_resize and lhmap_parallel_resize make every later rehash
+ * of a map, whether from growth, shrinking, hmap_reserve or shrink_to_fit,
+ * use nthreads threads, and zero or one restores the serial rehash.
+ * workers take chunks of old slots and claim new slots with an atomic OR
+ * on bitmap words or a compare-and-swap on control bytes, so the slot
+ * order of the new table depends on timing. lhmap workers record each new
+ * index in a remap array and then translate the links of chunks of new
+ * slots. tables under hmap_parallel_min_resize slots, robin hood maps and
+ * the migrations of hmap_flag_incremental still resize serially, and the
+ * hasher must be thread safe unless hmap_flag_hashes is set.
+ *
+ * the _parallel set operations match hmap_union, hmap_intersect,
+ * hmap_difference and hmap_merge. threads walk chunks of slots of one
+ * map probing the other, and collect the slots that belong in the result,
+ * which is then loaded with hmap_build_parallel when dst is empty and
+ * inserted on the calling thread otherwise. hmap_merge_parallel combines
+ * keys already in dst from the threads, so combine must be thread safe,
+ * and the maps must not be used by other threads meanwhile.
+ */
+
+static inline void hmap_build_parallel(hmap *h, void *keys, void *vals,
+    size_t n, size_t nthreads);
+static inline void hmap_parallel_resize(hmap *h, size_t nthreads);
+static inline void lhmap_parallel_resize(lhmap *h, size_t nthreads);
+static inline void hmap_union_parallel(hmap *dst, hmap *a, hmap *b, size_t nthreads);
+static inline void hmap_intersect_parallel(hmap *dst, hmap *a, hmap *b, size_t nthreads);
+static inline void hmap_difference_parallel(hmap *dst, hmap *a, hmap *b, size_t nthreads);
+static inline void hmap_merge_parallel(hmap *dst, hmap *src,
+    hmap_combine_fn combine, void *ctx, size_t nthreads);
+
+/*
+ * hmap parallel implementation
+ */
+
+typedef int (*hmap_parallel_fn)(void *arg);
+
+/*
+ * runs fn on count args of size bytes each, one thread per arg with the
+ * calling thread taking the first, and returns once all have finished.
+ * an arg whose thread cannot be started runs on the calling thread. with
+ * size zero every thread is passed the same arg.
+ */
+static inline void hmap_parallel_run(hmap_parallel_fn fn,
+    void *args, size_t size, size_t count)
+{
+    thrd_t *thr = (thrd_t*)malloc(sizeof(thrd_t) * count);
+    unsigned char *started = (unsigned char*)malloc(count);
+    unsigned char *a = (unsigned char*)args;
+
+    for (size_t t = 1; t < count; t++) {
+        started[t] = thrd_create(&thr[t], fn, a + t * size) == thrd_success;
+    }
+    fn(a);
+    for (size_t t = 1; t < count; t++) {
+        if (started[t]) thrd_join(thr[t], NULL);
+        else fn(a + t * size);
+    }
+    free(started);
+    free(thr);
+}
+
+/* smallest partition in slots, a multiple of bitmap words and groups */
+static const size_t hmap_build_min_part = 1024;
+
+enum hmap_build_phase {
+    hmap_build_hash,
+    hmap_build_scatter,
+    hmap_build_place
+};
+
+typedef struct hmap_build hmap_build;
+typedef struct hmap_build_worker hmap_build_worker;
+
+struct hmap_build
+{
+    hmap *h;
+    unsigned char *keys;
+    unsigned char *vals;
+    size_t n;
+    size_t nthreads;
+    size_t parts;
+    size_t part_shift;
+    size_t *hashes;
+    size_t *perm;
+    size_t *counts;
+    size_t *part_start;
+    atomic_size_t next_part;
+    enum hmap_build_phase phase;
+};
+
+/*
+ * deferred holds entries whose run left their partition, and released
+ * the slab handles of replaced duplicates with hmap_flag_indirect.
+ */
+struct hmap_build_worker
+{
+    hmap_build *b;
+    size_t t;
+    size_t placed;
+    size_t *deferred;
+    size_t deferred_len;
+    size_t deferred_cap;
+    size_t *released;
+    size_t released_len;
+    size_t released_cap;
+};
+
+static inline void hmap_build_push(size_t **v, size_t *len, size_t *cap, size_t x)
+{
+    if (*len == *cap) {
+        *cap = *cap ? *cap << 1 : 64;
+        *v = (size_t*)realloc(*v, sizeof(size_t) * *cap);
+    }
+    (*v)[(*len)++] = x;
+}
+
+static inline size_t hmap_build_part(hmap_build *b, size_t hash)
+{
+    return hmap_hash_index(b->h, hash) >> b->part_shift;
+}
+
+static inline int hmap_build_match(hmap *h, size_t i, size_t hash, void *key)
+{
+    return (!h->hashes || h->hashes[i] == hash) && h->compare(h, hmap_data_key(h, i), key);
+}
+
+/*
+ * probes from the home slot up to end, which is never passed, returning
+ * the slot holding key or the slot to claim for it, or hmap_empty_offset.
+ * the table has no tombstones so the first free slot ends the run.
+ */
+static inline size_t hmap_build_probe_bitmap(hmap *h, void *key, size_t hash,
+    size_t end, int *found)
+{
+    for (size_t i = hmap_hash_index(h, hash); i < end; i++) {
+        if ((hmap_bitmap_get(h->bitmap, i) & hmap_occupied) != hmap_occupied) {
+            *found = 0;
+            return i;
+        }
+        if (hmap_build_match(h, i, hash, key)) {
+            *found = 1;
+            return i;
+        }
+    }
+    return hmap_empty_offset;
+}
+
+static inline size_t hmap_build_probe_ctrl(hmap *h, void *key, size_t hash,
+    size_t end, int *found)
+{
+    unsigned char tag = hmap_hash_tag(hash);
+    for (size_t g = hmap_hash_index(h, hash) & ~(size_t)(HMAP_GROUP_WIDTH-1);
+         g < end; g += HMAP_GROUP_WIDTH)
+    {
+        for (uint64_t m = hmap_group_match(h->ctrl + g, tag); m; m &= m - 1) {
+            size_t i = g + hmap_group_next(m);
+            if (hmap_build_match(h, i, hash, key)) {
+                *found = 1;
+                return i;
+            }
+        }
+        uint64_t m = hmap_group_match_empty(h->ctrl + g);
+        if (m) {
+            *found = 0;
+            return g + hmap_group_next(m);
+        }
+    }
+    return hmap_empty_offset;
+}
+
+/* marks slot i occupied with the key of entry e, whose handle is e */
+static inline void hmap_build_claim(hmap_build *b, size_t i, size_t e)
+{
+    hmap *h = b->h;
+    size_t hash = b->hashes[e];
+
+    if (h->flags & hmap_flag_tags) h->ctrl[i] = hmap_hash_tag(hash);
+    else hmap_bitmap_set(h->bitmap, i, hmap_occupied);
+    hmap_slot_set_hash(h, i, hash);
+    memcpy(hmap_data_key(h, i), b->keys + e * h->key_size, h->key_size);
+    if (h->flags & hmap_flag_indirect) {
+        uint32_t v = (uint32_t)e;
+        memcpy(hmap_data_slot(h, i), &v, sizeof(v));
+    }
+}
+
+static inline void hmap_build_store(hmap_build *b, size_t i, size_t e)
+{
+    hmap *h = b->h;
+    if (h->val_size) memcpy(hmap_data_val(h, i), b->vals + e * h->val_size, h->val_size);
+}
+
+/* fills the slots of partition p from its entries in input order */
+static inline void hmap_build_place_part(hmap_build_worker *w, size_t p)
+{
+    hmap_build *b = w->b;
+    hmap *h = b->h;
+    size_t end = (p + 1) << b->part_shift;
+
+    for (size_t j = b->part_start[p]; j < b->part_start[p + 1]; j++) {
+        size_t e = b->perm[j], hash = b->hashes[e], i;
+        void *key = b->keys + e * h->key_size;
+        int found;
+
+        if (h->flags & hmap_flag_tags) i = hmap_build_probe_ctrl(h, key, hash, end, &found);
+        else i = hmap_build_probe_bitmap(h, key, hash, end, &found);
+
+        if (i == hmap_empty_offset) {
+            hmap_build_push(&w->deferred, &w->deferred_len, &w->deferred_cap, e);
+            continue;
+        }
+        if (!found) {
+            hmap_build_claim(b, i, e);
+            w->placed++;
+        } else if (h->flags & hmap_flag_indirect) {
+            hmap_build_push(&w->released, &w->released_len, &w->released_cap, e);
+        }
+        hmap_build_store(b, i, e);
+    }
+}
+
+static inline int hmap_build_worker_fn(void *arg)
+{
+    hmap_build_worker *w = (hmap_build_worker*)arg;
+    hmap_build *b = w->b;
+    hmap *h = b->h;
+    size_t begin = b->n * w->t / b->nthreads, end = b->n * (w->t + 1) / b->nthreads;
+    size_t *counts = b->counts + w->t * b->parts;
+
+    switch (b->phase) {
+    case hmap_build_hash:
+        for (size_t e = begin; e < end; e++) {
+            size_t hash = h->hasher(h, b->keys + e * h->key_size);
+            b->hashes[e] = hash;
+            counts[hmap_build_part(b, hash)]++;
+        }
+        break;
+    case hmap_build_scatter:
+        /* counts now holds each thread's offset into each partition */
+        for (size_t e = begin; e < end; e++) {
+            b->perm[counts[hmap_build_part(b, b->hashes[e])]++] = e;
+        }
+        break;
+    case hmap_build_place:
+        for (;;) {
+            size_t p = atomic_fetch_add_explicit(&b->next_part, 1, memory_order_relaxed);
+            if (p >= b->parts) break;
+            hmap_build_place_part(w, p);
+        }
+        break;
+    }
+    return 0;
+}
+
+/* inserts a deferred entry with the usual probe, which may wrap */
+static inline void hmap_build_insert_deferred(hmap_build *b, size_t e,
+    hmap_build_worker *w)
+{
+    hmap *h = b->h;
+    size_t hash = b->hashes[e];
+    void *key = b->keys + e * h->key_size;
+    size_t i = hmap_find_internal(h, key, hash);
+
+    if (i == hmap_empty_offset) {
+        i = (h->flags & hmap_flag_tags) ? hmap_ctrl_claim(h, key, hash)
+                                        : hmap_bitmap_claim(h, key, hash);
+        if (h->flags & hmap_flag_indirect) {
+            uint32_t v = (uint32_t)e;
+            memcpy(hmap_data_slot(h, i), &v, sizeof(v));
+        }
+    } else if (h->flags & hmap_flag_indirect) {
+        hmap_build_push(&w->released, &w->released_len, &w->released_cap, e);
+    }
+    hmap_build_store(b, i, e);
+}
+
+static inline void hmap_build_parallel(hmap *h, void *keys, void *vals,
+    size_t n, size_t nthreads)
+{
+    hmap_build b;
+    hmap_build_worker *workers;
+    size_t parts = 1, limit_bits;
+
+    hmap_migrate(h);
+    if (h->used || (h->flags & hmap_flag_robin_hood) || nthreads < 2) {
+        hmap_reserve(h, h->used + n);
+        for (size_t e = 0; e < n; e++) {
+            hmap_insert(h, (unsigned char*)keys + e * h->key_size,
+                (unsigned char*)vals + e * h->val_size);
+        }
+        return;
+    }
+
+    /* the partitions probe up to the first free slot, so drop tombstones */
+    if (h->tombs) hmap_clear(h);
+    hmap_reserve(h, n);
+    limit_bits = hmap_ctz64(h->limit);
+    while (parts < nthreads * 8 && (h->limit / parts) > hmap_build_min_part) parts <<= 1;
+
+    /* every handle below n is taken by its entry, replaced ones are freed */
+    if (h->flags & hmap_flag_indirect) {
+        assert(n < hmap_slab_none);
+        while (h->slab_chunks * HMAP_SLAB_CHUNK < n) hmap_slab_grow(h);
+        h->slab_next = (uint32_t)n;
+        h->slab_free = hmap_slab_none;
+    }
+
+    b.h = h;
+    b.keys = (unsigned char*)keys;
+    b.vals = (unsigned char*)vals;
+    b.n = n;
+    b.nthreads = nthreads;
+    b.parts = parts;
+    b.part_shift = limit_bits - hmap_ctz64(parts);
+    b.hashes = (size_t*)malloc(sizeof(size_t) * (n ? n : 1));
+    b.perm = (size_t*)malloc(sizeof(size_t) * (n ? n : 1));
+    b.counts = (size_t*)calloc(nthreads * parts, sizeof(size_t));
+    b.part_start = (size_t*)malloc(sizeof(size_t) * (parts + 1));
+    atomic_init(&b.next_part, 0);
+
+    workers = (hmap_build_worker*)calloc(nthreads, sizeof(hmap_build_worker));
+    for (size_t t = 0; t < nthreads; t++) {
+        workers[t].b = &b;
+        workers[t].t = t;
+    }
+
+    b.phase = hmap_build_hash;
+    hmap_parallel_run(hmap_build_worker_fn, workers, sizeof(*workers), nthreads);
+
+    /* partitions in order, each holding its entries from thread 0 upwards */
+    size_t sum = 0;
+    for (size_t p = 0; p < parts; p++) {
+        b.part_start[p] = sum;
+        for (size_t t = 0; t < nthreads; t++) {
+            size_t c = b.counts[t * parts + p];
+            b.counts[t * parts + p] = sum;
+            sum += c;
+        }
+    }
+    b.part_start[parts] = sum;
+
+    b.phase = hmap_build_scatter;
+    hmap_parallel_run(hmap_build_worker_fn, workers, sizeof(*workers), nthreads);
+    b.phase = hmap_build_place;
+    hmap_parallel_run(hmap_build_worker_fn, workers, sizeof(*workers), nthreads);
+
+    /*
+     * duplicates of a key share a partition, so per worker lists keep
+     * their input order and deferred entries replace in the same order.
+     */
+    for (size_t t = 0; t < nthreads; t++) h->used += workers[t].placed;
+    for (size_t t = 0; t < nthreads; t++) {
+        hmap_build_worker *w = &workers[t];
+        for (size_t j = 0; j < w->deferred_len; j++) {
+            hmap_build_insert_deferred(&b, w->deferred[j], w);
+        }
+        for (size_t j = 0; j < w->released_len; j++) {
+            hmap_slab_release(h, (uint32_t)w->released[j]);
+        }
+        free(w->deferred);
+        free(w->released);
+    }
+
+    free(workers);
+    free(b.part_start);
+    free(b.counts);
+    free(b.perm);
+    free(b.hashes);
+}
+
+/*
+ * parallel resize
+ */
+
+static const size_t hmap_parallel_min_resize = 65536;
+
+/* old or new slots taken by a worker at a time */
+static const size_t hmap_parallel_chunk = 16384;
+
+enum hmap_rehash_phase {
+    hmap_rehash_copy,
+    hmap_rehash_links
+};
+
+typedef struct hmap_rehash_job hmap_rehash_job;
+
+struct hmap_rehash_job
+{
+    hmap *h;
+    lhmap *lh;
+    unsigned char *old_data;
+    size_t *old_hashes;
+    uint64_t *old_bitmap;
+    unsigned char *old_ctrl;
+    size_t old_limit;
+    size_t *remap;
+    atomic_size_t next;
+    enum hmap_rehash_phase phase;
+};
+
+/*
+ * claims the first free slot from the home of hash against other workers.
+ * occupied bits are only ever set during the rehash, so every slot passed
+ * over stays occupied and the probe run from home remains unbroken.
+ */
+static inline size_t hmap_parallel_claim_bitmap(uint64_t *bitmap, size_t mask, size_t hash)
+{
+    for (size_t j = hash & mask; ; j = ((hmap_bitmap_idx(j) + 1) << 5) & mask) {
+        _Atomic uint64_t *w = (_Atomic uint64_t*)&bitmap[hmap_bitmap_idx(j)];
+        uint64_t v = atomic_load_explicit(w, memory_order_relaxed);
+        uint64_t m = ~v & hmap_bitmap_occupied_mask & (~(uint64_t)0 << hmap_bitmap_shift(j));
+        for (; m; m &= m - 1) {
+            uint64_t bit = m & (~m + 1);
+            if (!(atomic_fetch_or_explicit(w, bit, memory_order_relaxed) & bit)) {
+                return (hmap_bitmap_idx(j) << 5) + (hmap_ctz64(bit) >> 1);
+            }
+        }
+    }
+}
+
+static inline size_t hmap_parallel_claim_ctrl(unsigned char *ctrl, size_t mask, size_t hash)
+{
+    unsigned char tag = hmap_hash_tag(hash);
+    for (size_t g = hash & mask & ~(size_t)(HMAP_GROUP_WIDTH-1); ;
+         g = (g + HMAP_GROUP_WIDTH) & mask)
+    {
+        for (size_t j = g; j < g + HMAP_GROUP_WIDTH; j++) {
+            _Atomic unsigned char *c = (_Atomic unsigned char*)&ctrl[j];
+            unsigned char empty = hmap_ctrl_empty;
+            if (atomic_load_explicit(c, memory_order_relaxed) == empty &&
+                atomic_compare_exchange_strong_explicit(c, &empty, tag,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                return j;
+            }
+        }
+    }
+}
+
+/* returns the next chunk of n slots as [*begin,*end), or zero when done */
+static inline int hmap_rehash_next(hmap_rehash_job *job, size_t n,
+    size_t *begin, size_t *end)
+{
+    size_t c = atomic_fetch_add_explicit(&job->next, 1, memory_order_relaxed);
+    if (c * hmap_parallel_chunk >= n) return 0;
+    *begin = c * hmap_parallel_chunk;
+    *end = *begin + hmap_parallel_chunk < n ? *begin + hmap_parallel_chunk : n;
+    return 1;
+}
+
+static inline int hmap_rehash_worker_fn(void *arg)
+{
+    hmap_rehash_job *job = (hmap_rehash_job*)arg;
+    hmap *h = job->h;
+    size_t mask = hmap_index_mask(h), begin, end;
+
+    while (hmap_rehash_next(job, job->old_limit, &begin, &end)) {
+        for (size_t i = job->old_ctrl ? hmap_ctrl_scan(job->old_ctrl, begin, end) :
+                 hmap_bitmap_scan(job->old_bitmap, begin, end); i < end;
+             i = job->old_ctrl ? hmap_ctrl_scan(job->old_ctrl, i + 1, end) :
+                 hmap_bitmap_scan(job->old_bitmap, i + 1, end))
+        {
+            unsigned char *k = hmap_table_key(h, job->old_data, job->old_limit, i);
+            size_t hash = job->old_hashes ? job->old_hashes[i] : h->hasher(h, k);
+            size_t j = h->ctrl ? hmap_parallel_claim_ctrl(h->ctrl, mask, hash)
+                               : hmap_parallel_claim_bitmap(h->bitmap, mask, hash);
+            hmap_slot_set_hash(h, j, hash);
+            hmap_slot_copy(h, j, job->old_data, job->old_limit, i);
+        }
+    }
+    return 0;
+}
+
+static inline int hmap_parallel_rehash(hmap *h, size_t new_limit)
+{
+    hmap_rehash_job job;
+
+    if ((h->flags & hmap_flag_robin_hood) || h->rehash_threads < 2 ||
+        h->limit < hmap_parallel_min_resize || new_limit < hmap_build_min_part) {
+        return 0;
+    }
+    assert(hmap_ispow2(new_limit));
+
+    /* backs out before any change, the serial rehash then allocates again */
+    unsigned char *data = hmap_alloc_table(h, new_limit);
+    if (!data) return 0;
+
+    job.h = h;
+    job.lh = NULL;
+    job.old_data = h->data;
+    job.old_hashes = h->hashes;
+    job.old_bitmap = h->bitmap;
+    job.old_ctrl = h->ctrl;
+    job.old_limit = h->limit;
+    job.remap = NULL;
+    job.phase = hmap_rehash_copy;
+    atomic_init(&job.next, 0);
+
+    h->data = data;
+    h->limit = new_limit;
+    hmap_meta_init(h);
+    hmap_parallel_run(hmap_rehash_worker_fn, &job, 0, h->rehash_threads);
+
+    h->tombs = 0;
+    hmap_free_table(h, job.old_data, job.old_limit);
+    return 1;
+}
+
+/* copies chunks of old slots, then translates links of chunks of new ones */
+static inline int lhmap_rehash_worker_fn(void *arg)
+{
+    hmap_rehash_job *job = (hmap_rehash_job*)arg;
+    lhmap *h = job->lh;
+    size_t mask = lhmap_index_mask(h), stride = lhmap_stride(h), begin, end;
+
+    if (job->phase == hmap_rehash_copy) {
+        while (hmap_rehash_next(job, job->old_limit, &begin, &end)) {
+            for (size_t i = hmap_bitmap_scan(job->old_bitmap, begin, end); i < end;
+                 i = hmap_bitmap_scan(job->old_bitmap, i + 1, end))
+            {
+                size_t hash = job->old_hashes ? job->old_hashes[i] :
+                    h->hasher(h, lhmap_old_data_key(h, job->old_data, i));
+                size_t j = hmap_parallel_claim_bitmap(h->bitmap, mask, hash);
+                lhmap_slot_set_hash(h, j, hash);
+                memcpy(lhmap_data_link(h, j), lhmap_old_data_link(h, job->old_data, i), stride);
+                job->remap[i] = j;
+            }
+        }
+    } else {
+        while (hmap_rehash_next(job, h->limit, &begin, &end)) {
+            for (size_t j = hmap_bitmap_scan(h->bitmap, begin, end); j < end;
+                 j = hmap_bitmap_scan(h->bitmap, j + 1, end))
+            {
+                lhmap_link *link = lhmap_data_link(h, j);
+                if (link->prev != hmap_empty_offset) link->prev = job->remap[link->prev];
+                if (link->next != hmap_empty_offset) link->next = job->remap[link->next];
+            }
+        }
+    }
+    return 0;
+}
+
+static inline int lhmap_parallel_rehash(lhmap *h, size_t new_limit)
+{
+    hmap_rehash_job job;
+
+    if (h->rehash_threads < 2 || h->limit < hmap_parallel_min_resize ||
+        new_limit < hmap_build_min_part) {
+        return 0;
+    }
+    assert(hmap_ispow2(new_limit));
+
+    /* backs out before any change, the serial rehash then allocates again */
+    size_t *remap = (size_t*)h->allocator.alloc(h->allocator.userdata,
+        sizeof(size_t) * h->limit);
+    if (!remap) return 0;
+    unsigned char *data = lhmap_alloc_table(h, new_limit);
+    if (!data) {
+        h->allocator.free(h->allocator.userdata, remap, sizeof(size_t) * h->limit);
+        return 0;
+    }
+
+    job.h = NULL;
+    job.lh = h;
+    job.old_data = h->data;
+    job.old_hashes = h->hashes;
+    job.old_bitmap = h->bitmap;
+    job.old_ctrl = NULL;
+    job.old_limit = h->limit;
+    job.remap = remap;
+
+    h->data = data;
+    h->limit = new_limit;
+    lhmap_meta_init(h);
+
+    job.phase = hmap_rehash_copy;
+    atomic_init(&job.next, 0);
+    hmap_parallel_run(lhmap_rehash_worker_fn, &job, 0, h->rehash_threads);
+    job.phase = hmap_rehash_links;
+    atomic_store_explicit(&job.next, 0, memory_order_relaxed);
+    hmap_parallel_run(lhmap_rehash_worker_fn, &job, 0, h->rehash_threads);
+
+    if (h->head != hmap_empty_offset) {
+        h->head = job.remap[h->head];
+        h->tail = job.remap[h->tail];
+    }
+    h->tombs = 0;
+    h->allocator.free(h->allocator.userdata, job.remap, sizeof(size_t) * job.old_limit);
+    lhmap_free_table(h, job.old_data, job.old_limit);
+    return 1;
+}
+
+static inline void hmap_parallel_resize(hmap *h, size_t nthreads)
+{
+    h->rehash = nthreads > 1 ? hmap_parallel_rehash : NULL;
+    h->rehash_threads = nthreads;
+}
+
+static inline void lhmap_parallel_resize(lhmap *h, size_t nthreads)
+{
+    h->rehash = nthreads > 1 ? lhmap_parallel_rehash : NULL;
+    h->rehash_threads = nthreads;
+}
+
+/*
+ * parallel set operations
+ */
+
+typedef struct hmap_set_job hmap_set_job;
+typedef struct hmap_set_worker hmap_set_worker;
+
+struct hmap_set_job
+{
+    hmap *src;
+    hmap *probe;
+    hmap *out;
+    enum hmap_set_op op;
+    hmap_combine_fn combine;
+    void *ctx;
+    atomic_size_t next;
+};
+
+/* slots of job->out that belong in the result */
+struct hmap_set_worker
+{
+    hmap_set_job *job;
+    size_t *slots;
+    size_t len;
+    size_t cap;
+};
+
+/* finds key without touching statistics counters, so threads can share h */
+static inline size_t hmap_parallel_find(hmap *h, void *key, size_t hash)
+{
+    size_t mask = hmap_index_mask(h);
+
+    if (h->flags & hmap_flag_tags) {
+        unsigned char tag = hmap_hash_tag(hash);
+        for (size_t g = hmap_hash_index(h, hash) & ~(size_t)(HMAP_GROUP_WIDTH-1); ;
+             g = (g + HMAP_GROUP_WIDTH) & mask)
+        {
+            for (uint64_t m = hmap_group_match(h->ctrl + g, tag); m; m &= m - 1) {
+                size_t i = g + hmap_group_next(m);
+                if (hmap_build_match(h, i, hash, key)) return i;
+            }
+            if (hmap_group_match_empty(h->ctrl + g)) return hmap_empty_offset;
+        }
+    }
+    int rh = (h->flags & hmap_flag_robin_hood) && h->hashes;
+    for (size_t i = hmap_hash_index(h, hash), d = 0; ; i = (i+1) & mask, d++) {
+        hmap_bitmap_state state = hmap_bitmap_get(h->bitmap, i);
+        if (state == hmap_available) return hmap_empty_offset;
+        if (state != hmap_occupied) continue;
+        if (rh && hmap_rh_dist(h, i) < d) return hmap_empty_offset;
+        if (hmap_build_match(h, i, hash, key)) return i;
+    }
+}
+
+static inline int hmap_set_worker_fn(void *arg)
+{
+    hmap_set_worker *w = (hmap_set_worker*)arg;
+    hmap_set_job *job = w->job;
+    hmap *src = job->src, *probe = job->probe;
+    size_t slots[HMAP_BATCH_WIDTH], hashes[HMAP_BATCH_WIDTH];
+    size_t n = src->limit, c;
+
+    while ((c = atomic_fetch_add_explicit(&job->next, 1, memory_order_relaxed))
+           * hmap_parallel_chunk < n)
+    {
+        size_t begin = c * hmap_parallel_chunk;
+        size_t end = begin + hmap_parallel_chunk < n ? begin + hmap_parallel_chunk : n;
+        for (size_t i = hmap_slot_scan(src, begin, end); i < end; ) {
+            size_t k = 0;
+            for (; k < HMAP_BATCH_WIDTH && i < end; i = hmap_slot_scan(src, i + 1, end)) {
+                slots[k] = i;
+                hashes[k] = hmap_set_hash(probe, src, i);
+                hmap_prefetch_slot(probe, hashes[k++]);
+            }
+            for (size_t j = 0; j < k; j++) {
+                void *key = hmap_data_key(src, slots[j]);
+                size_t f = hmap_parallel_find(probe, key, hashes[j]);
+                if (job->op == hmap_set_combine && f != hmap_empty_offset) {
+                    void *dval = hmap_data_val(probe, f), *sval = hmap_data_val(src, slots[j]);
+                    if (job->combine) job->combine(job->ctx, key, dval, sval);
+                    else memcpy(dval, sval, probe->val_size);
+                } else if ((f != hmap_empty_offset) == (job->op == hmap_set_and)) {
+                    size_t e = job->out == probe ? f : slots[j];
+                    hmap_build_push(&w->slots, &w->len, &w->cap, e);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/* copies key and value of slot i of h to entry e of the build arrays */
+static inline void hmap_set_gather(hmap *h, size_t i,
+    unsigned char *keys, unsigned char *vals, size_t e)
+{
+    memcpy(keys + e * h->key_size, hmap_data_key(h, i), h->key_size);
+    memcpy(vals + e * h->val_size, hmap_data_val(h, i), h->val_size);
+}
+
+/*
+ * runs job on nthreads, then adds every entry of base, if given, and the
+ * collected slots of job->out to dst, building it in parallel when empty.
+ */
+static inline void hmap_set_parallel(hmap *dst, hmap *base, hmap_set_job *job,
+    size_t nthreads)
+{
+    hmap_set_worker *w = (hmap_set_worker*)calloc(nthreads, sizeof(hmap_set_worker));
+    size_t n = base ? hmap_count(base) : 0;
+    hmap *out = job->out;
+
+    hmap_migrate(job->src);
+    hmap_migrate(job->probe);
+    if (base) hmap_migrate(base);
+    atomic_init(&job->next, 0);
+    for (size_t t = 0; t < nthreads; t++) w[t].job = job;
+    hmap_parallel_run(hmap_set_worker_fn, w, sizeof(hmap_set_worker), nthreads);
+    for (size_t t = 0; t < nthreads; t++) n += w[t].len;
+
+    if (hmap_count(dst) == 0 && n) {
+        unsigned char *keys = (unsigned char*)malloc(n * dst->key_size + 1);
+        unsigned char *vals = (unsigned char*)malloc(n * dst->val_size + 1);
+        size_t e = 0;
+        if (base) {
+            for (size_t i = hmap_slot_scan(base, 0, base->limit); i < base->limit;
+                 i = hmap_slot_scan(base, i + 1, base->limit)) {
+                hmap_set_gather(base, i, keys, vals, e++);
+            }
+        }
+        for (size_t t = 0; t < nthreads; t++) {
+            for (size_t j = 0; j < w[t].len; j++) {
+                hmap_set_gather(out, w[t].slots[j], keys, vals, e++);
+            }
+        }
+        hmap_build_parallel(dst, keys, vals, n, nthreads);
+        free(vals);
+        free(keys);
+    } else if (n) {
+        hmap_reserve(dst, hmap_count(dst) + n);
+        if (base) {
+            for (size_t i = hmap_slot_scan(base, 0, base->limit); i < base->limit;
+                 i = hmap_slot_scan(base, i + 1, base->limit)) {
+                hmap_insert(dst, hmap_data_key(base, i), hmap_data_val(base, i));
+            }
+        }
+        for (size_t t = 0; t < nthreads; t++) {
+            for (size_t j = 0; j < w[t].len; j++) {
+                size_t i = w[t].slots[j];
+                hmap_insert(dst, hmap_data_key(out, i), hmap_data_val(out, i));
+            }
+        }
+    }
+
+    for (size_t t = 0; t < nthreads; t++) free(w[t].slots);
+    free(w);
+}
+
+static inline void hmap_set_job_init(hmap_set_job *job, hmap *src, hmap *probe,
+    hmap *out, enum hmap_set_op op)
+{
+    job->src = src;
+    job->probe = probe;
+    job->out = out;
+    job->op = op;
+    job->combine = NULL;
+    job->ctx = NULL;
+}
+
+/* a, then the keys of b missing from a */
+static inline void hmap_union_parallel(hmap *dst, hmap *a, hmap *b, size_t nthreads)
+{
+    hmap_set_job job;
+    if (nthreads < 2) {
+        hmap_union(dst, a, b);
+        return;
+    }
+    hmap_set_check(dst, a, b);
+    hmap_set_job_init(&job, b, a, b, hmap_set_andnot);
+    hmap_set_parallel(dst, a, &job, nthreads);
+}
+
+static inline void hmap_intersect_parallel(hmap *dst, hmap *a, hmap *b, size_t nthreads)
+{
+    hmap_set_job job;
+    hmap *large = hmap_count(a) >= hmap_count(b) ? a : b, *small = large == a ? b : a;
+    if (nthreads < 2) {
+        hmap_intersect(dst, a, b);
+        return;
+    }
+    hmap_set_check(dst, a, b);
+    hmap_set_job_init(&job, small, large, a, hmap_set_and);
+    hmap_set_parallel(dst, NULL, &job, nthreads);
+}
+
+static inline void hmap_difference_parallel(hmap *dst, hmap *a, hmap *b, size_t nthreads)
+{
+    hmap_set_job job;
+    if (nthreads < 2) {
+        hmap_difference(dst, a, b);
+        return;
+    }
+    hmap_set_check(dst, a, b);
+    hmap_set_job_init(&job, a, b, a, hmap_set_andnot);
+    hmap_set_parallel(dst, NULL, &job, nthreads);
+}
+
+static inline void hmap_merge_parallel(hmap *dst, hmap *src,
+    hmap_combine_fn combine, void *ctx, size_t nthreads)
+{
+    hmap_set_job job;
+    if (nthreads < 2) {
+        hmap_merge(dst, src, combine, ctx);
+        return;
+    }
+    hmap_set_check(dst, src, src);
+    hmap_set_job_init(&job, src, dst, src, hmap_set_combine);
+    job.combine = combine;
+    job.ctx = ctx;
+    hmap_set_parallel(dst, NULL, &job, nthreads);
+}
@@ -0,0 +1,447 @@
+/*
+ * PLEASE LICENSE 2023, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include "hashmap.h"
+
+/*
+ * hmap_rcu single-writer many-reader hash table interface
+ *
+ * one writer thread inserts and erases while any number of registered
+ * reader threads look up keys without taking locks. readers copy values
+ * out under a sequence counter and retry if a write overlapped the copy.
+ * resize builds a new table and publishes it with an atomic pointer swap,
+ * and the old table is freed once every reader has left the epoch in
+ * which it could have loaded it.
+ *
+ * readers must call hmap_rcu_reader_register once per thread and pass the
+ * returned slot to hmap_rcu_find. the hasher and compare functions may be
+ * called on a key while the writer is overwriting it; the result is then
+ * discarded and the lookup retried.
+ */
+
+typedef struct hmap_rcu hmap_rcu;
+typedef struct hmap_rcu_opts hmap_rcu_opts;
+typedef struct hmap_rcu_table hmap_rcu_table;
+
+typedef size_t (*hmap_rcu_hash_fn)(hmap_rcu *h, void *key);
+typedef int (*hmap_rcu_compare_fn)(hmap_rcu *h, void *key1, void *key2);
+
+#define HMAP_RCU_MAX_READERS 64
+
+struct hmap_rcu_opts
+{
+    void *userdata;
+    size_t key_size;
+    size_t val_size;
+    size_t limit;
+    size_t max_load;
+    uint64_t seed;
+    hmap_rcu_hash_fn hasher;
+    hmap_rcu_compare_fn compare;
+};
+
+static inline hmap_rcu_opts hmap_rcu_opts_make(size_t key_size, size_t val_size);
+static inline void hmap_rcu_init_opts(hmap_rcu *h, const hmap_rcu_opts *opts);
+static inline void hmap_rcu_init(hmap_rcu *h,
+    size_t key_size, size_t val_size, size_t limit);
+static inline void hmap_rcu_destroy(hmap_rcu *h);
+static inline void* hmap_rcu_userdata(hmap_rcu *h);
+static inline size_t hmap_rcu_count(hmap_rcu *h);
+static inline size_t hmap_rcu_capacity(hmap_rcu *h);
+static inline int hmap_rcu_reader_register(hmap_rcu *h);
+static inline void hmap_rcu_reader_unregister(hmap_rcu *h, int reader);
+static inline int hmap_rcu_find(hmap_rcu *h, int reader, void *key, void *val);
+static inline void hmap_rcu_insert(hmap_rcu *h, void *key, void *val);
+static inline int hmap_rcu_erase(hmap_rcu *h, void *key);
+
+/*
+ * hmap_rcu implementation
+ */
+
+struct hmap_rcu_table
+{
+    size_t limit;
+    uint64_t retired;
+    hmap_rcu_table *next;
+    size_t *hashes;
+    _Atomic uint64_t *bitmap;
+    unsigned char *data;
+};
+
+/* epoch is zero while the reader is outside a lookup */
+typedef struct hmap_rcu_reader hmap_rcu_reader;
+struct hmap_rcu_reader
+{
+    _Alignas(64) _Atomic uint64_t epoch;
+    atomic_int active;
+};
+
+struct hmap_rcu
+{
+    _Atomic(hmap_rcu_table*) table;
+    _Atomic uint64_t seq;
+    _Atomic uint64_t epoch;
+    hmap_rcu_table *retired;
+    size_t key_size;
+    size_t val_size;
+    size_t used;
+    size_t tombs;
+    size_t max_load;
+    uint64_t seed;
+    hmap_rcu_hash_fn hasher;
+    hmap_rcu_compare_fn compare;
+    void *userdata;
+    hmap_rcu_reader readers[HMAP_RCU_MAX_READERS];
+};
+
+static inline size_t hmap_rcu_default_hash_fn(hmap_rcu *h, void *key)
+{
+    return (size_t)hmap_hash_bytes(key, h->key_size, h->seed);
+}
+
+static inline int hmap_rcu_default_compare_fn(hmap_rcu *h, void *key1, void *key2)
+{
+    return memcmp(key1, key2, h->key_size) == 0;
+}
+
+static inline size_t hmap_rcu_stride(hmap_rcu *h)
+{
+    return h->key_size + h->val_size;
+}
+
+static inline void* hmap_rcu_data_key(hmap_rcu *h, hmap_rcu_table *t, size_t idx)
+{
+    return t->data + idx * hmap_rcu_stride(h);
+}
+
+static inline void* hmap_rcu_data_val(hmap_rcu *h, hmap_rcu_table *t, size_t idx)
+{
+    return t->data + h->key_size + idx * hmap_rcu_stride(h);
+}
+
+static inline hmap_bitmap_state hmap_rcu_state(hmap_rcu_table *t, size_t i)
+{
+    uint64_t w = atomic_load_explicit(&t->bitmap[hmap_bitmap_idx(i)], memory_order_relaxed);
+    return (hmap_bitmap_state)((w >> hmap_bitmap_shift(i)) & 3);
+}
+
+/* only called by the writer, so a plain read-modify-write is enough */
+static inline void hmap_rcu_set_state(hmap_rcu_table *t, size_t i, hmap_bitmap_state s)
+{
+    _Atomic uint64_t *w = &t->bitmap[hmap_bitmap_idx(i)];
+    uint64_t v = atomic_load_explicit(w, memory_order_relaxed);
+    v = (v & ~((uint64_t)3 << hmap_bitmap_shift(i))) | ((uint64_t)s << hmap_bitmap_shift(i));
+    atomic_store_explicit(w, v, memory_order_relaxed);
+}
+
+static inline hmap_rcu_table* hmap_rcu_table_alloc(hmap_rcu *h, size_t limit)
+{
+    size_t head = (sizeof(hmap_rcu_table) + 7) & ~(size_t)7;
+    size_t data = (hmap_rcu_stride(h) * limit + 7) & ~(size_t)7;
+    size_t hashes = sizeof(size_t) * limit;
+    hmap_rcu_table *t = (hmap_rcu_table*)malloc(head + data + hashes +
+        hmap_bitmap_size(limit));
+
+    assert(hmap_ispow2(limit));
+
+    t->limit = limit;
+    t->retired = 0;
+    t->next = NULL;
+    t->data = (unsigned char*)t + head;
+    t->hashes = (size_t*)(t->data + data);
+    t->bitmap = (_Atomic uint64_t*)((unsigned char*)t->hashes + hashes);
+    for (size_t i = 0; i < hmap_bitmap_size(limit) / 8; i++) {
+        atomic_init(&t->bitmap[i], 0);
+    }
+    return t;
+}
+
+static inline hmap_rcu_table* hmap_rcu_table_get(hmap_rcu *h)
+{
+    return atomic_load_explicit(&h->table, memory_order_relaxed);
+}
+
+static inline void hmap_rcu_init_opts(hmap_rcu *h, const hmap_rcu_opts *opts)
+{
+    assert(hmap_ispow2(opts->limit));
+    assert(opts->max_load < hmap_load_multiplier);
+
+    h->key_size = opts->key_size;
+    h->val_size = opts->val_size;
+    h->used = 0;
+    h->tombs = 0;
+    h->max_load = opts->max_load;
+    h->seed = opts->seed;
+    h->hasher = opts->hasher;
+    h->compare = opts->compare;
+    h->userdata = opts->userdata;
+    h->retired = NULL;
+
+    atomic_init(&h->seq, 0);
+    atomic_init(&h->epoch, 1);
+    for (size_t i = 0; i < HMAP_RCU_MAX_READERS; i++) {
+        atomic_init(&h->readers[i].epoch, 0);
+        atomic_init(&h->readers[i].active, 0);
+    }
+    atomic_init(&h->table, hmap_rcu_table_alloc(h, opts->limit));
+}
+
+static inline hmap_rcu_opts hmap_rcu_opts_make(size_t key_size, size_t val_size)
+{
+    hmap_rcu_opts opts = {
+        NULL, key_size, val_size, hmap_default_size, hmap_load_factor,
+        hmap_random_seed(), hmap_rcu_default_hash_fn, hmap_rcu_default_compare_fn
+    };
+    return opts;
+}
+
+static inline void hmap_rcu_init(hmap_rcu *h,
+    size_t key_size, size_t val_size, size_t limit)
+{
+    hmap_rcu_opts opts = hmap_rcu_opts_make(key_size, val_size);
+    opts.limit = limit;
+    hmap_rcu_init_opts(h, &opts);
+}
+
+/* no reader may be inside hmap_rcu_find */
+static inline void hmap_rcu_destroy(hmap_rcu *h)
+{
+    while (h->retired) {
+        hmap_rcu_table *t = h->retired;
+        h->retired = t->next;
+        free(t);
+    }
+    free(hmap_rcu_table_get(h));
+    atomic_store(&h->table, NULL);
+}
+
+static inline void* hmap_rcu_userdata(hmap_rcu *h)
+{
+    return h->userdata;
+}
+
+static inline size_t hmap_rcu_count(hmap_rcu *h)
+{
+    return h->used;
+}
+
+static inline size_t hmap_rcu_capacity(hmap_rcu *h)
+{
+    return hmap_rcu_table_get(h)->limit;
+}
+
+/* returns a reader slot or -1 if all HMAP_RCU_MAX_READERS are taken */
+static inline int hmap_rcu_reader_register(hmap_rcu *h)
+{
+    for (int i = 0; i < HMAP_RCU_MAX_READERS; i++) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&h->readers[i].active, &expected, 1)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static inline void hmap_rcu_reader_unregister(hmap_rcu *h, int reader)
+{
+    atomic_store(&h->readers[reader].epoch, 0);
+    atomic_store(&h->readers[reader].active, 0);
+}
+
+/*
+ * epochs
+ *
+ * a reader publishes the current epoch in its slot before loading the
+ * table pointer. the writer swaps the pointer, then advances the epoch
+ * and tags the old table with the new value. once no slot holds an epoch
+ * older than the tag, no reader can still be using the old table.
+ */
+
+static inline void hmap_rcu_read_lock(hmap_rcu *h, int reader)
+{
+    atomic_store(&h->readers[reader].epoch, atomic_load(&h->epoch));
+}
+
+static inline void hmap_rcu_read_unlock(hmap_rcu *h, int reader)
+{
+    atomic_store_explicit(&h->readers[reader].epoch, 0, memory_order_release);
+}
+
+static inline void hmap_rcu_reclaim(hmap_rcu *h)
+{
+    uint64_t oldest = UINT64_MAX;
+    for (size_t i = 0; i < HMAP_RCU_MAX_READERS; i++) {
+        uint64_t e = atomic_load(&h->readers[i].epoch);
+        if (e && e < oldest) oldest = e;
+    }
+    for (hmap_rcu_table **p = &h->retired; *p; ) {
+        hmap_rcu_table *t = *p;
+        if (t->retired <= oldest) {
+            *p = t->next;
+            free(t);
+        } else {
+            p = &t->next;
+        }
+    }
+}
+
+/*
+ * sequence counter
+ *
+ * the writer makes the counter odd while it modifies the published table
+ * and even again afterwards. a reader copy is only accepted when the
+ * counter was even and unchanged across it.
+ */
+
+static inline void hmap_rcu_write_begin(hmap_rcu *h)
+{
+    uint64_t s = atomic_load_explicit(&h->seq, memory_order_relaxed);
+    atomic_store_explicit(&h->seq, s + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void hmap_rcu_write_end(hmap_rcu *h)
+{
+    uint64_t s = atomic_load_explicit(&h->seq, memory_order_relaxed);
+    atomic_store_explicit(&h->seq, s + 1, memory_order_release);
+}
+
+static inline size_t hmap_rcu_probe(hmap_rcu *h, hmap_rcu_table *t, void *key, size_t hash)
+{
+    size_t mask = t->limit - 1;
+    for (size_t i = hash & mask; ; i = (i+1) & mask) {
+        hmap_bitmap_state state = hmap_rcu_state(t, i);
+             if (state == hmap_available)           /* notfound */ break;
+        else if (state == hmap_deleted);            /* skip */
+        else if (t->hashes[i] == hash &&
+                 h->compare(h, hmap_rcu_data_key(h, t, i), key)) return i;
+    }
+    return hmap_empty_offset;
+}
+
+/* copies the value for key into val if it is present, val may be NULL */
+static inline int hmap_rcu_find(hmap_rcu *h, int reader, void *key, void *val)
+{
+    size_t hash = h->hasher(h, key), i;
+
+    hmap_rcu_read_lock(h, reader);
+    for (;;) {
+        uint64_t s = atomic_load_explicit(&h->seq, memory_order_acquire);
+        if (s & 1) {
+            hmap_cpu_relax();
+            continue;
+        }
+        hmap_rcu_table *t = atomic_load(&h->table);
+        i = hmap_rcu_probe(h, t, key, hash);
+        if (i != hmap_empty_offset && val) {
+            memcpy(val, hmap_rcu_data_val(h, t, i), h->val_size);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&h->seq, memory_order_relaxed) == s) break;
+    }
+    hmap_rcu_read_unlock(h, reader);
+
+    return i != hmap_empty_offset;
+}
+
+/*
+ * the new table is built while readers continue on the old one, which the
+ * writer does not modify, so only the pointer swap is inside the caller's
+ * write_begin and write_end.
+ */
+static inline hmap_rcu_table* hmap_rcu_rehash(hmap_rcu *h, size_t new_limit)
+{
+    hmap_rcu_table *old = hmap_rcu_table_get(h);
+    hmap_rcu_table *t = hmap_rcu_table_alloc(h, new_limit);
+    size_t stride = hmap_rcu_stride(h), mask = new_limit - 1;
+
+    for (size_t i = 0; i < old->limit; i++) {
+        if ((hmap_rcu_state(old, i) & hmap_occupied) != hmap_occupied) continue;
+        size_t hash = old->hashes[i], j = hash & mask;
+        while (hmap_rcu_state(t, j) != hmap_available) j = (j+1) & mask;
+        hmap_rcu_set_state(t, j, hmap_occupied);
+        t->hashes[j] = hash;
+        memcpy(hmap_rcu_data_key(h, t, j), hmap_rcu_data_key(h, old, i), stride);
+    }
+    return t;
+}
+
+static inline void hmap_rcu_publish(hmap_rcu *h, hmap_rcu_table *t)
+{
+    hmap_rcu_table *old = hmap_rcu_table_get(h);
+    atomic_store(&h->table, t);
+    old->retired = atomic_fetch_add(&h->epoch, 1) + 1;
+    old->next = h->retired;
+    h->retired = old;
+    h->tombs = 0;
+}
+
+static inline void hmap_rcu_insert(hmap_rcu *h, void *key, void *val)
+{
+    size_t hash = h->hasher(h, key);
+    hmap_rcu_table *t = hmap_rcu_table_get(h), *nt = NULL;
+    size_t i = hmap_rcu_probe(h, t, key, hash);
+
+    if (i == hmap_empty_offset &&
+        (h->used + h->tombs + 1) * hmap_load_multiplier / t->limit > h->max_load)
+    {
+        nt = hmap_rcu_rehash(h, hmap_grow_limit(h->used, t->limit, h->max_load));
+    }
+
+    hmap_rcu_write_begin(h);
+    if (nt) {
+        hmap_rcu_publish(h, nt);
+        t = nt;
+    }
+    if (i == hmap_empty_offset) {
+        for (i = hash & (t->limit - 1); ; i = (i+1) & (t->limit - 1)) {
+            hmap_bitmap_state state = hmap_rcu_state(t, i);
+            if ((state & hmap_occupied) != hmap_occupied) {
+                if (state == hmap_deleted) h->tombs--;
+                break;
+            }
+        }
+        t->hashes[i] = hash;
+        memcpy(hmap_rcu_data_key(h, t, i), key, h->key_size);
+        memcpy(hmap_rcu_data_val(h, t, i), val, h->val_size);
+        hmap_rcu_set_state(t, i, hmap_occupied);
+        h->used++;
+    } else {
+        memcpy(hmap_rcu_data_val(h, t, i), val, h->val_size);
+    }
+    hmap_rcu_write_end(h);
+
+    if (h->retired) hmap_rcu_reclaim(h);
+}
+
+static inline int hmap_rcu_erase(hmap_rcu *h, void *key)
+{
+    hmap_rcu_table *t = hmap_rcu_table_get(h);
+    size_t i = hmap_rcu_probe(h, t, key, h->hasher(h, key));
+
+    if (i == hmap_empty_offset) return 0;
+    hmap_rcu_write_begin(h);
+    hmap_rcu_set_state(t, i, hmap_deleted);
+    hmap_rcu_write_end(h);
+    h->used--;
+    h->tombs++;
+
+    if (h->retired) hmap_rcu_reclaim(h);
+    return 1;
+}
@@ -0,0 +1,204 @@
+/*
+ * PLEASE LICENSE 2023, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <threads.h>
+
+#include "hashmap.h"
+
+/*
+ * hmap_sharded lock-striped hash table interface
+ *
+ * keys are partitioned over a power of two number of independent hmap
+ * shards by the hash bits just below the 7 bits used for control byte
+ * tags, so the shard index is independent of both the tag and the slot
+ * index within the shard. each shard has its own spinlock and sits on its
+ * own cache lines, and resizes on its own while the other shards stay
+ * available. lookups copy values out, as pointers into a shard are only
+ * stable while its lock is held.
+ */
+
+typedef struct hmap_sharded hmap_sharded;
+typedef struct hmap_shard hmap_shard;
+
+/* visitor for hmap_sharded_foreach, returns non-zero to stop */
+typedef hmap_visit_fn hmap_sharded_visit_fn;
+
+static inline void hmap_sharded_init_opts(hmap_sharded *s,
+    const hmap_opts *opts, size_t shards);
+static inline void hmap_sharded_init(hmap_sharded *s,
+    size_t key_size, size_t val_size, size_t shards);
+static inline void hmap_sharded_destroy(hmap_sharded *s);
+static inline size_t hmap_sharded_count(hmap_sharded *s);
+static inline void hmap_sharded_insert(hmap_sharded *s, void *key, void *val);
+static inline int hmap_sharded_find(hmap_sharded *s, void *key, void *val);
+static inline int hmap_sharded_erase(hmap_sharded *s, void *key);
+static inline int hmap_sharded_foreach(hmap_sharded *s,
+    hmap_sharded_visit_fn fn, void *ctx);
+
+/*
+ * hmap_sharded implementation
+ */
+
+struct hmap_shard
+{
+    _Alignas(64) atomic_int lock;
+    hmap h;
+};
+
+struct hmap_sharded
+{
+    size_t shard_bits;
+    hmap_shard *shards;
+    void *alloc;
+};
+
+static inline void hmap_shard_lock(hmap_shard *shard)
+{
+    for (unsigned spins = 0; ; spins++) {
+        if (!atomic_load_explicit(&shard->lock, memory_order_relaxed) &&
+            !atomic_exchange_explicit(&shard->lock, 1, memory_order_acquire)) {
+            return;
+        }
+        if (spins < 64) {
+            hmap_cpu_relax();
+        } else {
+            thrd_yield();
+        }
+    }
+}
+
+static inline void hmap_shard_unlock(hmap_shard *shard)
+{
+    atomic_store_explicit(&shard->lock, 0, memory_order_release);
+}
+
+static inline hmap_shard* hmap_sharded_shard(hmap_sharded *s, size_t hash)
+{
+    size_t shift = sizeof(size_t) * 8 - 7 - s->shard_bits;
+    return &s->shards[(hash >> shift) & (((size_t)1 << s->shard_bits) - 1)];
+}
+
+/* all shards share opts, including the seed, so any one can hash a key */
+static inline size_t hmap_sharded_hash(hmap_sharded *s, void *key)
+{
+    return s->shards[0].h.hasher(&s->shards[0].h, key);
+}
+
+static inline void hmap_sharded_init_opts(hmap_sharded *s,
+    const hmap_opts *opts, size_t shards)
+{
+    assert(hmap_ispow2(shards) && shards <= 1024);
+
+    /* aligned by hand as aligned_alloc is not available everywhere */
+    s->shard_bits = hmap_ctz64(shards);
+    s->alloc = malloc(sizeof(hmap_shard) * shards + 63);
+    s->shards = (hmap_shard*)(((uintptr_t)s->alloc + 63) & ~(uintptr_t)63);
+    for (size_t i = 0; i < shards; i++) {
+        atomic_init(&s->shards[i].lock, 0);
+        hmap_init_opts(&s->shards[i].h, opts);
+    }
+}
+
+static inline void hmap_sharded_init(hmap_sharded *s,
+    size_t key_size, size_t val_size, size_t shards)
+{
+    hmap_opts opts = hmap_opts_make(key_size, val_size);
+    hmap_sharded_init_opts(s, &opts, shards);
+}
+
+/* no other thread may be using the map */
+static inline void hmap_sharded_destroy(hmap_sharded *s)
+{
+    for (size_t i = 0; i < ((size_t)1 << s->shard_bits); i++) {
+        hmap_destroy(&s->shards[i].h);
+    }
+    free(s->alloc);
+    s->alloc = NULL;
+    s->shards = NULL;
+}
+
+/* sums shard counts one lock at a time, so it is not a snapshot */
+static inline size_t hmap_sharded_count(hmap_sharded *s)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < ((size_t)1 << s->shard_bits); i++) {
+        hmap_shard_lock(&s->shards[i]);
+        count += hmap_count(&s->shards[i].h);
+        hmap_shard_unlock(&s->shards[i]);
+    }
+    return count;
+}
+
+static inline void hmap_sharded_insert(hmap_sharded *s, void *key, void *val)
+{
+    size_t hash = hmap_sharded_hash(s, key);
+    hmap_shard *shard = hmap_sharded_shard(s, hash);
+
+    hmap_shard_lock(shard);
+    hmap_insert_hashed(&shard->h, key, val, hash);
+    hmap_shard_unlock(shard);
+}
+
+/* copies the value for key into val if it is present, val may be NULL */
+static inline int hmap_sharded_find(hmap_sharded *s, void *key, void *val)
+{
+    size_t hash = hmap_sharded_hash(s, key);
+    hmap_shard *shard = hmap_sharded_shard(s, hash);
+    int found;
+
+    hmap_shard_lock(shard);
+    hmap_iter i = hmap_find_hashed(&shard->h, key, hash);
+    found = hmap_iter_neq(i, hmap_iter_end(&shard->h));
+    if (found && val) memcpy(val, hmap_iter_val(i), shard->h.val_size);
+    hmap_shard_unlock(shard);
+
+    return found;
+}
+
+static inline int hmap_sharded_erase(hmap_sharded *s, void *key)
+{
+    size_t hash = hmap_sharded_hash(s, key);
+    hmap_shard *shard = hmap_sharded_shard(s, hash);
+    size_t used;
+
+    hmap_shard_lock(shard);
+    used = hmap_count(&shard->h);
+    hmap_erase_hashed(&shard->h, key, hash);
+    used -= hmap_count(&shard->h);
+    hmap_shard_unlock(shard);
+
+    return used != 0;
+}
+
+/*
+ * visits every entry one shard at a time with that shard locked. fn must
+ * not call back into the map. returns the first non-zero result of fn.
+ */
+static inline int hmap_sharded_foreach(hmap_sharded *s,
+    hmap_sharded_visit_fn fn, void *ctx)
+{
+    for (size_t n = 0; n < ((size_t)1 << s->shard_bits); n++) {
+        hmap_shard *shard = &s->shards[n];
+
+        hmap_shard_lock(shard);
+        int r = hmap_foreach(&shard->h, fn, ctx);
+        hmap_shard_unlock(shard);
+        if (r) return r;
+    }
+    return 0;
+}
@@ -0,0 +1,301 @@
+/*
+ * PLEASE LICENSE 2023, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "hashmap.h"
+
+/*
+ * vhmap variable-length key hash table interface
+ *
+ * vhmap is an hmap whose fixed-size key is a vhmap_key record holding the
+ * full hash, the key length and the first VHMAP_PREFIX bytes of the key.
+ * keys that fit in the prefix are stored inline. longer keys are copied to
+ * a byte arena owned by the map and the record holds their offset, so
+ * memory is proportional to key bytes and a compare only reads the arena
+ * once hash, length and prefix all match. the hasher returns the stored
+ * hash, so resize never touches the arena.
+ *
+ * erasing a long key leaves its bytes dead in the arena. the arena is
+ * compacted when the table resizes, or before it would grow while at
+ * least a quarter of it is dead, and vhmap_compact compacts it on demand.
+ * compaction finishes any incremental migration first.
+ *
+ * value pointers are valid until the next insert or erase and key
+ * pointers until the next insert, erase or compaction. the hmap points
+ * back at the vhmap, so a vhmap must not be moved after init.
+ */
+
+typedef struct vhmap vhmap;
+typedef struct vhmap_key vhmap_key;
+
+/* visitor for vhmap_foreach, returns non-zero to stop */
+typedef int (*vhmap_visit_fn)(void *ctx, const void *key, size_t len, void *val);
+
+#define VHMAP_PREFIX 12
+
+static inline void vhmap_init_opts(vhmap *m, const hmap_opts *opts);
+static inline void vhmap_init(vhmap *m, size_t val_size);
+static inline void vhmap_destroy(vhmap *m);
+static inline size_t vhmap_count(vhmap *m);
+static inline size_t vhmap_key_bytes(vhmap *m);
+static inline size_t vhmap_arena_size(vhmap *m);
+static inline void* vhmap_insert(vhmap *m, const void *key, size_t len, void *val);
+static inline void* vhmap_find(vhmap *m, const void *key, size_t len);
+static inline int vhmap_erase(vhmap *m, const void *key, size_t len);
+static inline int vhmap_foreach(vhmap *m, vhmap_visit_fn fn, void *ctx);
+static inline void vhmap_compact(vhmap *m);
+
+/*
+ * vhmap implementation
+ */
+
+/*
+ * len has vhmap_probe_bit set in the records built for lookups, which
+ * point at the caller's key bytes instead of holding an arena offset.
+ */
+struct vhmap_key
+{
+    size_t hash;
+    uint32_t len;
+    unsigned char prefix[VHMAP_PREFIX];
+    union { uint64_t off; const void *ptr; } loc;
+};
+
+struct vhmap
+{
+    hmap h;
+    unsigned char *arena;
+    size_t arena_used;
+    size_t arena_size;
+    size_t arena_dead;
+};
+
+static const uint32_t vhmap_probe_bit = 0x80000000u;
+static const size_t vhmap_min_arena = 256;
+
+/* records are unaligned when the value size is not a multiple of 8 */
+static inline vhmap_key vhmap_key_load(const void *key)
+{
+    vhmap_key k;
+    memcpy(&k, key, sizeof(k));
+    return k;
+}
+
+static inline size_t vhmap_key_len(const vhmap_key *k)
+{
+    return k->len & ~vhmap_probe_bit;
+}
+
+static inline const unsigned char* vhmap_key_data(vhmap *m, const vhmap_key *k)
+{
+    if (vhmap_key_len(k) <= VHMAP_PREFIX) return k->prefix;
+    if (k->len & vhmap_probe_bit) return (const unsigned char*)k->loc.ptr;
+    return m->arena + k->loc.off;
+}
+
+static inline size_t vhmap_hash_fn(hmap *h, void *key)
+{
+    size_t hash;
+    (void)h;
+    memcpy(&hash, key, sizeof(hash));
+    return hash;
+}
+
+/* rejects on hash, length and prefix before reading key bytes */
+static inline int vhmap_compare_fn(hmap *h, void *key1, void *key2)
+{
+    vhmap *m = (vhmap*)h->userdata;
+    vhmap_key k1 = vhmap_key_load(key1), k2 = vhmap_key_load(key2);
+    size_t len = vhmap_key_len(&k1);
+
+    if (k1.hash != k2.hash || len != vhmap_key_len(&k2) ||
+        memcmp(k1.prefix, k2.prefix, VHMAP_PREFIX) != 0) return 0;
+    if (len <= VHMAP_PREFIX) return 1;
+    return memcmp(vhmap_key_data(m, &k1) + VHMAP_PREFIX,
+        vhmap_key_data(m, &k2) + VHMAP_PREFIX, len - VHMAP_PREFIX) == 0;
+}
+
+/* builds a lookup record pointing at the caller's key */
+static inline vhmap_key vhmap_probe(vhmap *m, const void *key, size_t len)
+{
+    vhmap_key k;
+    assert(len < vhmap_probe_bit);
+    memset(&k, 0, sizeof(k));
+    k.hash = (size_t)hmap_hash_bytes(key, len, m->h.seed);
+    k.len = (uint32_t)len | vhmap_probe_bit;
+    memcpy(k.prefix, key, len < VHMAP_PREFIX ? len : VHMAP_PREFIX);
+    k.loc.ptr = key;
+    return k;
+}
+
+static inline void vhmap_init_opts(vhmap *m, const hmap_opts *opts)
+{
+    hmap_opts o = *opts;
+    o.key_size = sizeof(vhmap_key);
+    o.hasher = vhmap_hash_fn;
+    o.compare = vhmap_compare_fn;
+    o.userdata = m;
+    hmap_init_opts(&m->h, &o);
+    m->arena = NULL;
+    m->arena_used = 0;
+    m->arena_size = 0;
+    m->arena_dead = 0;
+}
+
+static inline void vhmap_init(vhmap *m, size_t val_size)
+{
+    hmap_opts opts = hmap_opts_make(sizeof(vhmap_key), val_size);
+    vhmap_init_opts(m, &opts);
+}
+
+static inline void vhmap_destroy(vhmap *m)
+{
+    if (m->arena) {
+        m->h.allocator.free(m->h.allocator.userdata, m->arena, m->arena_size);
+    }
+    m->arena = NULL;
+    m->arena_used = m->arena_size = m->arena_dead = 0;
+    hmap_destroy(&m->h);
+}
+
+static inline size_t vhmap_count(vhmap *m)
+{
+    return hmap_count(&m->h);
+}
+
+/* bytes of live keys held in the arena */
+static inline size_t vhmap_key_bytes(vhmap *m)
+{
+    return m->arena_used - m->arena_dead;
+}
+
+static inline size_t vhmap_arena_size(vhmap *m)
+{
+    return m->arena_size;
+}
+
+/* moves the arena to a new block of size holding only live keys */
+static inline void vhmap_arena_rebuild(vhmap *m, size_t size)
+{
+    unsigned char *arena = size ? (unsigned char*)m->h.allocator.alloc(
+        m->h.allocator.userdata, size) : NULL;
+    size_t used = 0;
+
+    hmap_migrate(&m->h);
+    for (hmap_iter i = hmap_iter_begin(&m->h); hmap_iter_neq(i, hmap_iter_end(&m->h));
+         i = hmap_iter_next(i))
+    {
+        vhmap_key k = vhmap_key_load(hmap_iter_key(i));
+        size_t len = vhmap_key_len(&k);
+        if (len <= VHMAP_PREFIX) continue;
+        memcpy(arena + used, m->arena + k.loc.off, len);
+        k.loc.off = used;
+        memcpy(hmap_iter_key(i), &k, sizeof(k));
+        used += len;
+    }
+    if (m->arena) {
+        m->h.allocator.free(m->h.allocator.userdata, m->arena, m->arena_size);
+    }
+    m->arena = arena;
+    m->arena_used = used;
+    m->arena_size = size;
+    m->arena_dead = 0;
+}
+
+/* sizes the compacted arena at twice the live bytes */
+static inline void vhmap_compact(vhmap *m)
+{
+    size_t live = vhmap_key_bytes(m);
+    vhmap_arena_rebuild(m, live ? (live * 2 > vhmap_min_arena ? live * 2 : vhmap_min_arena) : 0);
+}
+
+static inline uint64_t vhmap_arena_append(vhmap *m, const void *key, size_t len)
+{
+    if (m->arena_used + len > m->arena_size) {
+        if (m->arena_dead && m->arena_dead >= m->arena_used / 4) vhmap_compact(m);
+    }
+    if (m->arena_used + len > m->arena_size) {
+        size_t size = m->arena_size ? m->arena_size * 2 : vhmap_min_arena;
+        while (size < m->arena_used + len) size *= 2;
+        vhmap_arena_rebuild(m, size);
+    }
+    uint64_t off = m->arena_used;
+    memcpy(m->arena + off, key, len);
+    m->arena_used += len;
+    return off;
+}
+
+/*
+ * inserts or replaces the value for key and returns a pointer to it. the
+ * key is only copied to the arena once it is known to be absent.
+ */
+static inline void* vhmap_insert(vhmap *m, const void *key, size_t len, void *val)
+{
+    vhmap_key k = vhmap_probe(m, key, len);
+    hmap_iter i = hmap_find_hashed(&m->h, &k, k.hash);
+
+    if (hmap_iter_neq(i, hmap_iter_end(&m->h))) {
+        memcpy(hmap_iter_val(i), val, m->h.val_size);
+        return hmap_iter_val(i);
+    }
+
+    size_t limit = hmap_capacity(&m->h);
+    k.len = (uint32_t)len;
+    k.loc.off = len > VHMAP_PREFIX ? vhmap_arena_append(m, key, len) : 0;
+    i = hmap_insert_hashed(&m->h, &k, val, k.hash);
+    if (hmap_capacity(&m->h) != limit && m->arena_dead) {
+        vhmap_compact(m);
+        k = vhmap_probe(m, key, len);
+        i = hmap_find_hashed(&m->h, &k, k.hash);
+    }
+    return hmap_iter_val(i);
+}
+
+/* returns a pointer to the value for key or NULL */
+static inline void* vhmap_find(vhmap *m, const void *key, size_t len)
+{
+    vhmap_key k = vhmap_probe(m, key, len);
+    hmap_iter i = hmap_find_hashed(&m->h, &k, k.hash);
+    return hmap_iter_eq(i, hmap_iter_end(&m->h)) ? NULL : hmap_iter_val(i);
+}
+
+static inline int vhmap_erase(vhmap *m, const void *key, size_t len)
+{
+    vhmap_key k = vhmap_probe(m, key, len);
+    size_t used = hmap_count(&m->h), limit = hmap_capacity(&m->h);
+
+    hmap_erase_hashed(&m->h, &k, k.hash);
+    if (hmap_count(&m->h) == used) return 0;
+    if (len > VHMAP_PREFIX) m->arena_dead += len;
+    if (hmap_capacity(&m->h) != limit && m->arena_dead) vhmap_compact(m);
+    return 1;
+}
+
+/*
+ * visits every entry with its key bytes and length. fn must not insert
+ * or erase. returns the first non-zero result of fn.
+ */
+static inline int vhmap_foreach(vhmap *m, vhmap_visit_fn fn, void *ctx)
+{
+    for (hmap_iter i = hmap_iter_begin(&m->h); hmap_iter_neq(i, hmap_iter_end(&m->h));
+         i = hmap_iter_next(i))
+    {
+        vhmap_key k = vhmap_key_load(hmap_iter_key(i));
+        int r = fn(ctx, vhmap_key_data(m, &k), vhmap_key_len(&k), hmap_iter_val(i));
+        if (r) return r;
+    }
+    return 0;
+}
@@ -0,0 +1,387 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include "hashmap.h"
+
+/*
+ * benchmark suite for regression tracking. runs each workload on hmap,
+ * hmap with control byte tags and lhmap, and optionally std::unordered_map,
+ * for sequential and random uint64_t keys with values of 0, 8, 64 and 256
+ * bytes. workloads are growth from empty and from a reserved table,
+ * uniform and zipf hits, 50% and 0% hit ratios, erase and insert churn and
+ * iteration.
+ *
+ * usage: bench_hmap [count] [std]
+ *
+ * prints one csv row per run with ns per op, throughput in Mops, peak
+ * table bytes from a counting allocator, and the mean and max probe
+ * length of the built map. probe length counts slots from the home slot,
+ * or groups from the home group for tags, and is zero for the baseline.
+ */
+
+struct timer
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    double ns_per(size_t n) const
+    {
+        auto t1 = std::chrono::steady_clock::now();
+        return std::chrono::duration<double,std::nano>(t1 - t0).count() / n;
+    }
+};
+
+static volatile uint64_t sink;
+
+static uint64_t xorshift(uint64_t &x)
+{
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    return x;
+}
+
+/* table memory in use and its high water mark, one map is live at a time */
+struct mem_stats { size_t cur, peak; };
+
+static mem_stats mem;
+
+static void mem_reset() { mem.cur = mem.peak = 0; }
+
+static void mem_add(size_t size)
+{
+    mem.cur += size;
+    if (mem.cur > mem.peak) mem.peak = mem.cur;
+}
+
+static void* count_alloc_fn(void *userdata, size_t size)
+{
+    (void)userdata;
+    mem_add(size);
+    return malloc(size);
+}
+
+static void count_free_fn(void *userdata, void *ptr, size_t size)
+{
+    (void)userdata;
+    mem.cur -= size;
+    free(ptr);
+}
+
+static const hmap_allocator count_allocator = { count_alloc_fn, count_free_fn, nullptr };
+
+template <typename T>
+struct count_std_alloc
+{
+    typedef T value_type;
+    count_std_alloc() {}
+    template <typename U> count_std_alloc(const count_std_alloc<U>&) {}
+    T* allocate(size_t n)
+    {
+        mem_add(n * sizeof(T));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t n)
+    {
+        mem.cur -= n * sizeof(T);
+        ::operator delete(p);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const count_std_alloc<T>&, const count_std_alloc<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const count_std_alloc<T>&, const count_std_alloc<U>&) { return false; }
+
+struct probe_stats { double mean; size_t max; };
+
+/*
+ * adapters give each map the same interface. find returns a pointer to
+ * the value or nullptr, and for zero length values any non-null pointer.
+ */
+
+struct hmap_adapter
+{
+    hmap h;
+    size_t val_size;
+
+    hmap_adapter(unsigned flags, size_t val_size) : val_size(val_size)
+    {
+        hmap_opts opts = hmap_opts_make(sizeof(uint64_t), val_size);
+        opts.flags = flags;
+        opts.allocator = count_allocator;
+        hmap_init_opts(&h, &opts);
+    }
+    ~hmap_adapter() { hmap_destroy(&h); }
+    void reserve(size_t n) { hmap_reserve(&h, n); }
+    void insert(uint64_t k, const unsigned char *v) { hmap_insert(&h, &k, (void*)v); }
+    void erase(uint64_t k) { hmap_erase(&h, &k); }
+    const void* find(uint64_t k)
+    {
+        hmap_iter i = hmap_find(&h, &k);
+        return hmap_iter_eq(i, hmap_iter_end(&h)) ? nullptr : hmap_iter_val(i);
+    }
+    uint64_t iterate()
+    {
+        uint64_t sum = 0;
+        for (hmap_iter i = hmap_iter_begin(&h); hmap_iter_neq(i, hmap_iter_end(&h));
+             i = hmap_iter_next(i)) {
+            sum += *(uint64_t*)hmap_iter_key(i);
+        }
+        return sum;
+    }
+    probe_stats probes(const std::vector<uint64_t> &keys)
+    {
+        size_t width = (h.flags & hmap_flag_tags) ? HMAP_GROUP_WIDTH : 1;
+        size_t sum = 0, max = 0;
+        for (uint64_t k : keys) {
+            size_t home = hmap_hash_index(&h, h.hasher(&h, &k)) & ~(width - 1);
+            size_t d = ((hmap_find(&h, &k).idx - home) & hmap_index_mask(&h)) / width;
+            sum += d;
+            max = std::max(max, d);
+        }
+        return probe_stats{ (double)sum / keys.size(), max };
+    }
+};
+
+struct lhmap_adapter
+{
+    lhmap h;
+    size_t val_size;
+
+    lhmap_adapter(unsigned flags, size_t val_size) : val_size(val_size)
+    {
+        lhmap_opts opts = lhmap_opts_make(sizeof(uint64_t), val_size);
+        opts.flags = flags;
+        opts.allocator = count_allocator;
+        lhmap_init_opts(&h, &opts);
+    }
+    ~lhmap_adapter() { lhmap_destroy(&h); }
+    void reserve(size_t n) { lhmap_reserve(&h, n); }
+    void insert(uint64_t k, const unsigned char *v)
+    {
+        lhmap_insert(&h, lhmap_iter_end(&h), &k, (void*)v);
+    }
+    void erase(uint64_t k) { lhmap_erase(&h, &k); }
+    const void* find(uint64_t k)
+    {
+        lhmap_iter i = lhmap_find(&h, &k);
+        return lhmap_iter_eq(i, lhmap_iter_end(&h)) ? nullptr : lhmap_iter_val(i);
+    }
+    uint64_t iterate()
+    {
+        uint64_t sum = 0;
+        for (lhmap_iter i = lhmap_iter_begin(&h); lhmap_iter_neq(i, lhmap_iter_end(&h));
+             i = lhmap_iter_next(i)) {
+            sum += *(uint64_t*)lhmap_iter_key(i);
+        }
+        return sum;
+    }
+    probe_stats probes(const std::vector<uint64_t> &keys)
+    {
+        size_t sum = 0, max = 0;
+        for (uint64_t k : keys) {
+            size_t home = lhmap_hash_index(&h, h.hasher(&h, &k));
+            size_t d = (lhmap_find(&h, &k).idx - home) & lhmap_index_mask(&h);
+            sum += d;
+            max = std::max(max, d);
+        }
+        return probe_stats{ (double)sum / keys.size(), max };
+    }
+};
+
+/* splitmix64 finalizer, as libstdc++ hashes integers to themselves */
+struct mix_hash
+{
+    size_t operator()(uint64_t k) const
+    {
+        k = (k ^ (k >> 30)) * 0xbf58476d1ce4e5b9ull;
+        k = (k ^ (k >> 27)) * 0x94d049bb133111ebull;
+        return (size_t)(k ^ (k >> 31));
+    }
+};
+
+template <size_t V>
+struct std_adapter
+{
+    struct val_type { unsigned char b[V ? V : 1]; };
+    typedef std::pair<const uint64_t, val_type> pair_type;
+    std::unordered_map<uint64_t, val_type, mix_hash, std::equal_to<uint64_t>,
+        count_std_alloc<pair_type>> m;
+    size_t val_size = V;
+
+    std_adapter(unsigned, size_t) {}
+    void reserve(size_t n) { m.reserve(n); }
+    void insert(uint64_t k, const unsigned char *v)
+    {
+        memcpy(m[k].b, v, V);
+    }
+    void erase(uint64_t k) { m.erase(k); }
+    const void* find(uint64_t k)
+    {
+        auto i = m.find(k);
+        return i == m.end() ? nullptr : i->second.b;
+    }
+    uint64_t iterate()
+    {
+        uint64_t sum = 0;
+        for (auto &e : m) sum += e.first;
+        return sum;
+    }
+    probe_stats probes(const std::vector<uint64_t>&) { return probe_stats{ 0, 0 }; }
+};
+
+struct key_set
+{
+    const char *name;
+    std::vector<uint64_t> keys, misses, fresh;
+    std::vector<uint32_t> uniform, zipf;
+};
+
+/* zipf with s=0.99 by inverting the cdf, rank r maps to keys[r] */
+static std::vector<uint32_t> make_zipf(size_t n, size_t count, uint64_t &x)
+{
+    std::vector<double> cdf(n);
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) cdf[i] = sum += 1.0 / pow((double)(i + 1), 0.99);
+    std::vector<uint32_t> out(count);
+    for (size_t i = 0; i < count; i++) {
+        double u = (double)(xorshift(x) >> 11) / (double)(1ull << 53) * sum;
+        out[i] = (uint32_t)std::min<size_t>(n - 1,
+            std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+    }
+    return out;
+}
+
+static key_set make_keys(const char *name, size_t n, bool sequential)
+{
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+    key_set ks;
+    ks.name = name;
+    ks.keys.resize(n);
+    ks.misses.resize(n);
+    ks.fresh.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        ks.keys[i] = sequential ? i + 1 : xorshift(x);
+        ks.misses[i] = sequential ? n + i + 1 : xorshift(x);
+        ks.fresh[i] = sequential ? 2 * n + i + 1 : xorshift(x);
+    }
+    ks.uniform.resize(n);
+    for (size_t i = 0; i < n; i++) ks.uniform[i] = (uint32_t)(xorshift(x) % n);
+    ks.zipf = make_zipf(n, n, x);
+    return ks;
+}
+
+static void report(const char *map, const char *workload, const key_set &ks,
+    size_t val_size, size_t n, size_t ops, double ns, probe_stats ps)
+{
+    printf("%s,%s,%s,%zu,%zu,%zu,%.2f,%.2f,%zu,%.3f,%zu\n", map, workload, ks.name,
+        val_size, n, ops, ns, 1e3 / ns, mem.peak, ps.mean, ps.max);
+}
+
+template <typename M>
+static double run_find(M &m, const key_set &ks, const std::vector<uint32_t> *idx,
+    size_t hit_every)
+{
+    size_t n = ks.keys.size();
+    uint64_t sum = 0;
+    timer t;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t k;
+        if (idx) k = ks.keys[(*idx)[i]];
+        else k = hit_every && i % hit_every == 0 ? ks.keys[ks.uniform[i]] : ks.misses[i];
+        const void *v = m.find(k);
+        sum += v ? (m.val_size ? *(const unsigned char*)v : 1) : 0;
+    }
+    double ns = t.ns_per(n);
+    sink = sum;
+    return ns;
+}
+
+template <typename M>
+static void bench(const char *name, unsigned flags, const key_set &ks, size_t val_size)
+{
+    size_t n = ks.keys.size();
+    std::vector<unsigned char> val(val_size > 8 ? val_size : 8, 0x5a);
+
+    {
+        mem_reset();
+        M m(flags, val_size);
+        timer t;
+        for (size_t i = 0; i < n; i++) m.insert(ks.keys[i], val.data());
+        double ns = t.ns_per(n);
+        probe_stats ps = m.probes(ks.keys);
+        report(name, "insert_empty", ks, val_size, n, n, ns, ps);
+
+        report(name, "find_uniform", ks, val_size, n, n,
+            run_find(m, ks, &ks.uniform, 0), ps);
+        report(name, "find_zipf", ks, val_size, n, n,
+            run_find(m, ks, &ks.zipf, 0), ps);
+        report(name, "find_hit50", ks, val_size, n, n,
+            run_find(m, ks, nullptr, 2), ps);
+        report(name, "find_miss", ks, val_size, n, n,
+            run_find(m, ks, nullptr, 0), ps);
+
+        const size_t rounds = 8;
+        uint64_t sum = 0;
+        timer ti;
+        for (size_t r = 0; r < rounds; r++) sum += m.iterate();
+        sink = sum;
+        report(name, "iterate", ks, val_size, n, n * rounds, ti.ns_per(n * rounds), ps);
+
+        /* replaces a random live key with a fresh one, keeping the count */
+        std::vector<uint64_t> live(ks.keys);
+        timer tc;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t &slot = live[ks.uniform[i]];
+            m.erase(slot);
+            slot = ks.fresh[i];
+            m.insert(slot, val.data());
+        }
+        double nc = tc.ns_per(n);
+        report(name, "churn", ks, val_size, n, n, nc, m.probes(live));
+    }
+
+    {
+        mem_reset();
+        M m(flags, val_size);
+        m.reserve(n);
+        timer t;
+        for (size_t i = 0; i < n; i++) m.insert(ks.keys[i], val.data());
+        double ns = t.ns_per(n);
+        report(name, "insert_reserved", ks, val_size, n, n, ns, m.probes(ks.keys));
+    }
+}
+
+template <size_t V>
+static void bench_std(const key_set &ks)
+{
+    bench<std_adapter<V>>("std", 0, ks, V);
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t val_sizes[] = { 0, 8, 64, 256 };
+    size_t n = argc > 1 ? (size_t)strtoull(argv[1], nullptr, 10) : 1000000;
+    bool with_std = argc > 2 && strcmp(argv[2], "std") == 0;
+    key_set sets[] = { make_keys("sequential", n, true), make_keys("random", n, false) };
+
+    printf("map,workload,keys,val_size,count,ops,ns_per_op,mops,"
+        "peak_bytes,probe_mean,probe_max\n");
+    for (const key_set &ks : sets) {
+        for (size_t v : val_sizes) {
+            bench<hmap_adapter>("hmap", hmap_flag_none, ks, v);
+            bench<hmap_adapter>("hmap_tags", hmap_flag_tags, ks, v);
+            bench<lhmap_adapter>("lhmap", hmap_flag_none, ks, v);
+        }
+        if (with_std) {
+            bench_std<0>(ks);
+            bench_std<8>(ks);
+            bench_std<64>(ks);
+            bench_std<256>(ks);
+        }
+    }
+}
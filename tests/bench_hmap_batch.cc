@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <vector>
+
+#include "hashmap.h"
+
+/*
+ * compares hmap_find one key at a time against hmap_find_batch on a
+ * uint64_t->uint64_t map, for random hits in tables of increasing size.
+ * prints ns per lookup and the speedup of the batched path.
+ */
+
+struct timer
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    double ns_per(size_t n) const
+    {
+        auto t1 = std::chrono::steady_clock::now();
+        return std::chrono::duration<double,std::nano>(t1 - t0).count() / n;
+    }
+};
+
+static volatile uint64_t sink;
+
+static uint64_t xorshift(uint64_t &x)
+{
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    return x;
+}
+
+static void bench(const char *name, unsigned flags, size_t n, size_t lookups)
+{
+    const size_t chunk = 1024;
+    std::vector<uint64_t> keys(n), probe(lookups);
+    std::vector<hmap_iter> iters(chunk);
+    uint64_t x = 0x9e3779b97f4a7c15ull, sum = 0;
+    hmap h;
+    hmap_opts opts = hmap_opts_make(sizeof(uint64_t), sizeof(uint64_t));
+    opts.flags = flags;
+    hmap_init_opts(&h, &opts);
+    hmap_reserve(&h, n);
+
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = xorshift(x);
+        hmap_insert(&h, &keys[i], &i);
+    }
+    for (size_t i = 0; i < lookups; i++) {
+        probe[i] = keys[xorshift(x) % n];
+    }
+
+    timer ts;
+    for (size_t i = 0; i < lookups; i++) {
+        sum += hmap_find(&h, &probe[i]).idx;
+    }
+    double single = ts.ns_per(lookups);
+
+    timer tb;
+    for (size_t i = 0; i < lookups; i += chunk) {
+        size_t m = lookups - i < chunk ? lookups - i : chunk;
+        hmap_find_batch(&h, &probe[i], m, iters.data());
+        for (size_t j = 0; j < m; j++) sum += iters[j].idx;
+    }
+    double batch = tb.ns_per(lookups);
+
+    hmap_destroy(&h);
+    sink = sum;
+    printf("%-10s %10zu %8.2f %8.2f %8.2fx\n", name, n, single, batch, single / batch);
+}
+
+int main(int argc, char **argv)
+{
+    size_t max = argc > 1 ? (size_t)strtoull(argv[1], nullptr, 10) : 8000000;
+    size_t lookups = 4000000;
+
+    printf("%-10s %10s %8s %8s %9s\n", "layout", "entries", "find", "batch", "speedup");
+    for (size_t n = 1000; n <= max; n *= 8) {
+        bench("bitmap", hmap_flag_none, n, lookups);
+        bench("tags", hmap_flag_tags, n, lookups);
+        bench("hashes", hmap_flag_hashes, n, lookups);
+    }
+}
@@ -0,0 +1,129 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <vector>
+
+#include "hashmap.hpp"
+
+/*
+ * compares the C API against the chashmap templates on int->int and
+ * uint64_t->struct maps. prints ns/op for insert, hit, miss and erase.
+ */
+
+struct payload { uint64_t a, b, c; };
+
+static std::vector<uint64_t> make_keys(size_t n, uint64_t seed)
+{
+    std::vector<uint64_t> keys(n);
+    uint64_t x = seed;
+    for (size_t i = 0; i < n; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        keys[i] = x;
+    }
+    return keys;
+}
+
+struct timer
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    double ns_per(size_t n) const
+    {
+        auto t1 = std::chrono::steady_clock::now();
+        return std::chrono::duration<double,std::nano>(t1 - t0).count() / n;
+    }
+};
+
+static volatile uint64_t sink;
+
+template <typename K, typename V>
+static void bench_c(const char *name, const std::vector<uint64_t> &keys,
+    const std::vector<uint64_t> &miss)
+{
+    size_t n = keys.size();
+    uint64_t sum = 0;
+    hmap h;
+    hmap_init(&h, sizeof(K), sizeof(V), hmap_default_size);
+
+    timer ti;
+    for (size_t i = 0; i < n; i++) {
+        K k = (K)keys[i]; V v = V();
+        hmap_insert(&h, &k, &v);
+    }
+    double insert = ti.ns_per(n);
+
+    timer th;
+    for (size_t i = 0; i < n; i++) {
+        K k = (K)keys[i];
+        hmap_iter it = hmap_find(&h, &k);
+        sum += it.idx;
+    }
+    double hit = th.ns_per(n);
+
+    timer tm;
+    for (size_t i = 0; i < n; i++) {
+        K k = (K)miss[i];
+        hmap_iter it = hmap_find(&h, &k);
+        sum += it.idx;
+    }
+    double missed = tm.ns_per(n);
+
+    timer te;
+    for (size_t i = 0; i < n; i++) {
+        K k = (K)keys[i];
+        hmap_erase(&h, &k);
+    }
+    double erase = te.ns_per(n);
+
+    hmap_destroy(&h);
+    sink = sum;
+    printf("%-8s %-24s %8.2f %8.2f %8.2f %8.2f\n", "c", name, insert, hit, missed, erase);
+}
+
+template <typename K, typename V>
+static void bench_cpp(const char *name, const std::vector<uint64_t> &keys,
+    const std::vector<uint64_t> &miss)
+{
+    size_t n = keys.size();
+    uint64_t sum = 0;
+    chashmap::hmap<K,V> h;
+
+    timer ti;
+    for (size_t i = 0; i < n; i++) h.emplace((K)keys[i]);
+    double insert = ti.ns_per(n);
+
+    timer th;
+    for (size_t i = 0; i < n; i++) sum += h.find((K)keys[i]).idx;
+    double hit = th.ns_per(n);
+
+    timer tm;
+    for (size_t i = 0; i < n; i++) sum += h.find((K)miss[i]).idx;
+    double missed = tm.ns_per(n);
+
+    timer te;
+    for (size_t i = 0; i < n; i++) h.erase((K)keys[i]);
+    double erase = te.ns_per(n);
+
+    sink = sum;
+    printf("%-8s %-24s %8.2f %8.2f %8.2f %8.2f\n", "cpp", name, insert, hit, missed, erase);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? (size_t)strtoull(argv[1], nullptr, 10) : 1000000;
+    std::vector<uint64_t> keys = make_keys(n, 0x9e3779b97f4a7c15ull);
+    std::vector<uint64_t> miss = make_keys(n, 0xd1b54a32d192ed03ull);
+    std::vector<uint64_t> ikeys(n), imiss(n);
+
+    /* distinct 32-bit keys for the int map, misses from the upper half */
+    for (size_t i = 0; i < n; i++) {
+        ikeys[i] = (uint32_t)(keys[i] & 0x7fffffff);
+        imiss[i] = (uint32_t)(miss[i] | 0x80000000);
+    }
+
+    printf("%-8s %-24s %8s %8s %8s %8s\n", "api", "map", "insert", "hit", "miss", "erase");
+    bench_c<int,int>("int->int", ikeys, imiss);
+    bench_cpp<int,int>("int->int", ikeys, imiss);
+    bench_c<uint64_t,payload>("uint64_t->payload", keys, miss);
+    bench_cpp<uint64_t,payload>("uint64_t->payload", keys, miss);
+}
@@ -0,0 +1,61 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "hashmap.h"
+
+/*
+ * measures per-insert latency while growing a uint64_t->uint64_t map from
+ * the default size, with synchronous and incremental resize. prints mean,
+ * percentiles and max in ns, plus total time. max is dominated by resize.
+ */
+
+typedef std::chrono::steady_clock clock_type;
+
+static void bench(const char *name, unsigned flags, const std::vector<uint64_t> &keys)
+{
+    size_t n = keys.size();
+    std::vector<uint32_t> lat(n);
+    hmap h;
+    hmap_opts opts = hmap_opts_make(sizeof(uint64_t), sizeof(uint64_t));
+    opts.flags = flags;
+    hmap_init_opts(&h, &opts);
+
+    clock_type::time_point t0 = clock_type::now(), t1 = t0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t k = keys[i], v = i;
+        hmap_insert(&h, &k, &v);
+        clock_type::time_point t2 = clock_type::now();
+        lat[i] = (uint32_t)std::min<int64_t>(UINT32_MAX,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count());
+        t1 = t2;
+    }
+    double total = std::chrono::duration<double,std::milli>(t1 - t0).count();
+    hmap_destroy(&h);
+
+    std::sort(lat.begin(), lat.end());
+    auto pct = [&](double p) { return lat[(size_t)(p * (n - 1))]; };
+    printf("%-12s %8.1f %8u %8u %8u %10u %10.1f\n", name,
+        total * 1e6 / n, pct(0.5), pct(0.99), pct(0.999), lat[n-1], total);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? (size_t)strtoull(argv[1], nullptr, 10) : 4000000;
+    std::vector<uint64_t> keys(n);
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < n; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        keys[i] = x;
+    }
+
+    printf("%-12s %8s %8s %8s %8s %10s %10s\n",
+        "resize", "mean", "p50", "p99", "p99.9", "max", "total_ms");
+    bench("sync", hmap_flag_none, keys);
+    bench("incremental", hmap_flag_incremental, keys);
+    bench("sync+hash", hmap_flag_hashes, keys);
+    bench("incr+hash", hmap_flag_incremental | hmap_flag_hashes, keys);
+}
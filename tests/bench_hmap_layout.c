@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "hashmap.h"
+
+/*
+ * compares the interleaved slot layout against hmap_flag_soa and
+ * hmap_flag_indirect for uint64_t keys with values of 0, 8, 64 and 256
+ * bytes. prints ns per insert, per random hit reading the first value
+ * word, and per random miss, with and without control byte tags.
+ */
+
+enum { num_keys = 1 << 17, num_lookups = 1 << 21 };
+
+static volatile uint64_t sink;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+    *x ^= *x << 13; *x ^= *x >> 7; *x ^= *x << 17;
+    return *x;
+}
+
+static void bench(const char *name, unsigned flags, size_t val_size,
+    uint64_t *keys, uint64_t *probe)
+{
+    unsigned char val[256] = { 0 };
+    uint64_t sum = 0;
+    hmap h;
+    hmap_opts opts = hmap_opts_make(sizeof(uint64_t), val_size);
+    opts.flags = flags;
+    hmap_init_opts(&h, &opts);
+
+    double t0 = now_ns();
+    for (size_t i = 0; i < num_keys; i++) {
+        memcpy(val, &i, val_size < 8 ? val_size : 8);
+        hmap_insert(&h, &keys[i], val);
+    }
+    double t1 = now_ns();
+    for (size_t i = 0; i < num_lookups; i++) {
+        hmap_iter it = hmap_find(&h, &probe[i]);
+        if (val_size >= 8) sum += *(uint64_t*)hmap_iter_val(it);
+        else sum += it.idx;
+    }
+    double t2 = now_ns();
+    for (size_t i = 0; i < num_lookups; i++) {
+        uint64_t k = probe[i] ^ 1;
+        sum += hmap_find(&h, &k).idx;
+    }
+    double t3 = now_ns();
+    sink = sum;
+
+    printf("%-12s %8zu %10.2f %10.2f %10.2f\n", name, val_size,
+        (t1 - t0) / num_keys, (t2 - t1) / num_lookups, (t3 - t2) / num_lookups);
+    hmap_destroy(&h);
+}
+
+int main()
+{
+    static const size_t val_sizes[] = { 0, 8, 64, 256 };
+    uint64_t *keys = (uint64_t*)malloc(sizeof(uint64_t) * num_keys);
+    uint64_t *probe = (uint64_t*)malloc(sizeof(uint64_t) * num_lookups);
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+
+    /* keys are even so key ^ 1 is always a miss */
+    for (size_t i = 0; i < num_keys; i++) keys[i] = xorshift(&x) & ~1ull;
+    for (size_t i = 0; i < num_lookups; i++) probe[i] = keys[xorshift(&x) % num_keys];
+
+    printf("%-12s %8s %10s %10s %10s\n", "layout", "val_size", "insert", "hit", "miss");
+    for (size_t v = 0; v < sizeof(val_sizes) / sizeof(val_sizes[0]); v++) {
+        bench("interleaved", hmap_flag_none, val_sizes[v], keys, probe);
+        bench("soa", hmap_flag_soa, val_sizes[v], keys, probe);
+        bench("tags", hmap_flag_tags, val_sizes[v], keys, probe);
+        bench("tags+soa", hmap_flag_tags | hmap_flag_soa, val_sizes[v], keys, probe);
+        bench("indirect", hmap_flag_indirect, val_sizes[v], keys, probe);
+        bench("tags+ind", hmap_flag_tags | hmap_flag_indirect, val_sizes[v], keys, probe);
+    }
+
+    free(probe);
+    free(keys);
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <threads.h>
+
+#include "hashmap_lockfree.h"
+#include "hashmap_sharded.h"
+
+/*
+ * throughput of hmap_lf against hmap_sharded with 64 shards. each run
+ * starts the given number of threads doing a random mix of finds, inserts
+ * and erases over a fixed key range for a fixed time, and prints total
+ * operations per second. the maps start small so the first run includes
+ * growth.
+ */
+
+enum { num_keys = 1 << 20, run_ms = 300, max_threads = 64 };
+
+typedef struct { int mode; int find_pct; uintptr_t id; size_t ops; uint64_t sum; } worker;
+
+static hmap_lf lm;
+static hmap_sharded sm;
+static atomic_int stop;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int worker_fn(void *arg)
+{
+    worker *w = (worker*)arg;
+    uint64_t x = w->id * 0x9e3779b97f4a7c15ull + 1, sum = 0;
+    size_t ops = 0;
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        for (int i = 0; i < 64; i++) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            uint64_t k = 1 + ((x >> 8) & (num_keys - 1)), v = 0;
+            int op = (int)(x % 100);
+            if (op < w->find_pct) {
+                if (w->mode) v = hmap_lf_find(&lm, k);
+                else hmap_sharded_find(&sm, &k, &v);
+            } else if (op < w->find_pct + (100 - w->find_pct) * 3 / 4) {
+                if (w->mode) hmap_lf_insert(&lm, k, k);
+                else hmap_sharded_insert(&sm, &k, &k);
+            } else {
+                if (w->mode) hmap_lf_erase(&lm, k);
+                else hmap_sharded_erase(&sm, &k);
+            }
+            sum += v;
+        }
+        ops += 64;
+    }
+    w->ops = ops;
+    w->sum = sum;
+    return 0;
+}
+
+static void run(const char *name, int mode, int threads, int find_pct)
+{
+    thrd_t thr[max_threads];
+    worker workers[max_threads];
+    size_t total = 0;
+
+    atomic_store(&stop, 0);
+    for (int i = 0; i < threads; i++) {
+        workers[i].mode = mode;
+        workers[i].find_pct = find_pct;
+        workers[i].id = (uintptr_t)i + 1;
+        workers[i].ops = 0;
+        thrd_create(&thr[i], worker_fn, &workers[i]);
+    }
+    double t0 = now_ms();
+    thrd_sleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = run_ms * 1000000L }, NULL);
+    atomic_store(&stop, 1);
+    for (int i = 0; i < threads; i++) thrd_join(thr[i], NULL);
+    double t1 = now_ms();
+
+    for (int i = 0; i < threads; i++) total += workers[i].ops;
+    printf("%-8s %8d %8d %12.2f\n", name, threads, find_pct, total / (t1 - t0) / 1e3);
+}
+
+int main(int argc, char **argv)
+{
+    int max = argc > 1 ? atoi(argv[1]) : 8;
+    if (max > max_threads) max = max_threads;
+
+    hmap_lf_init(&lm, hmap_default_size);
+    hmap_sharded_init(&sm, sizeof(uint64_t), sizeof(uint64_t), 64);
+
+    printf("%-8s %8s %8s %12s\n", "map", "threads", "find_pct", "mops");
+    for (int n = 1; n <= max; n <<= 1) {
+        run("sharded", 0, n, 90);
+        run("lockfree", 1, n, 90);
+        run("sharded", 0, n, 50);
+        run("lockfree", 1, n, 50);
+    }
+
+    hmap_sharded_destroy(&sm);
+    hmap_lf_destroy(&lm);
+}
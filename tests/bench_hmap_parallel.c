@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "hashmap_parallel.h"
+
+/*
+ * times building an hmap from arrays of uint64_t keys and values, 10M by
+ * default or the count given as the first argument: hmap_insert into an
+ * empty map, hmap_insert after hmap_reserve, and hmap_build_parallel with
+ * 2, 4 and so on up to the thread count given as the second argument,
+ * 8 by default. prints ns per entry and the speedup over insert.
+ *
+ * then times hmap_reserve growing a map holding those entries, serially
+ * and with hmap_parallel_resize or lhmap_parallel_resize set to the same
+ * thread counts, printing ns per entry moved.
+ */
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+    *x ^= *x << 13; *x ^= *x >> 7; *x ^= *x << 17;
+    return *x;
+}
+
+static double build(const char *name, unsigned flags, int reserve, size_t nthreads,
+    uint64_t *keys, uint64_t *vals, size_t n, double base)
+{
+    hmap h;
+    hmap_opts opts = hmap_opts_make(sizeof(uint64_t), sizeof(uint64_t));
+    opts.flags = flags;
+    hmap_init_opts(&h, &opts);
+
+    double t0 = now_ns();
+    if (nthreads) {
+        hmap_build_parallel(&h, keys, vals, n, nthreads);
+    } else {
+        if (reserve) hmap_reserve(&h, n);
+        for (size_t i = 0; i < n; i++) hmap_insert(&h, &keys[i], &vals[i]);
+    }
+    double t = now_ns() - t0;
+
+    if (hmap_count(&h) != n) {
+        fprintf(stderr, "count mismatch %zu != %zu\n", hmap_count(&h), n);
+        exit(1);
+    }
+    printf("%-8s %-10s %8zu %10.2f %8.2f\n", flags & hmap_flag_tags ? "tags" : "bitmap",
+        name, nthreads, t / n, base ? base / t : 1.0);
+    hmap_destroy(&h);
+    return t;
+}
+
+static double resize_hmap(unsigned flags, size_t nthreads,
+    uint64_t *keys, uint64_t *vals, size_t n, double base)
+{
+    hmap h;
+    hmap_opts opts = hmap_opts_make(sizeof(uint64_t), sizeof(uint64_t));
+    opts.flags = flags;
+    hmap_init_opts(&h, &opts);
+    hmap_build_parallel(&h, keys, vals, n, 1);
+    hmap_parallel_resize(&h, nthreads);
+
+    double t0 = now_ns();
+    hmap_reserve(&h, hmap_capacity(&h) * 2);
+    double t = now_ns() - t0;
+
+    printf("%-8s %-10s %8zu %10.2f %8.2f\n", flags & hmap_flag_tags ? "tags" : "bitmap",
+        "resize", nthreads, t / n, base ? base / t : 1.0);
+    hmap_destroy(&h);
+    return t;
+}
+
+static double resize_lhmap(size_t nthreads,
+    uint64_t *keys, uint64_t *vals, size_t n, double base)
+{
+    lhmap h;
+    lhmap_init(&h, sizeof(uint64_t), sizeof(uint64_t), 16);
+    for (size_t i = 0; i < n; i++) lhmap_insert(&h, lhmap_iter_end(&h), &keys[i], &vals[i]);
+    lhmap_parallel_resize(&h, nthreads);
+
+    double t0 = now_ns();
+    lhmap_reserve(&h, lhmap_capacity(&h) * 2);
+    double t = now_ns() - t0;
+
+    printf("%-8s %-10s %8zu %10.2f %8.2f\n", "linked", "resize", nthreads, t / n,
+        base ? base / t : 1.0);
+    lhmap_destroy(&h);
+    return t;
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned modes[] = { hmap_flag_none, hmap_flag_tags };
+    size_t n = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 10000000;
+    size_t max_threads = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 8;
+    uint64_t *keys = (uint64_t*)malloc(sizeof(uint64_t) * n);
+    uint64_t *vals = (uint64_t*)malloc(sizeof(uint64_t) * n);
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+
+    /* distinct keys, as xorshift does not repeat within its period */
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = xorshift(&x);
+        vals[i] = i;
+    }
+
+    printf("%-8s %-10s %8s %10s %8s\n", "layout", "build", "threads", "ns/entry", "speedup");
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        double base = build("insert", modes[m], 0, 0, keys, vals, n, 0);
+        build("reserve", modes[m], 1, 0, keys, vals, n, base);
+        for (size_t t = 2; t <= max_threads; t <<= 1) {
+            build("parallel", modes[m], 0, t, keys, vals, n, base);
+        }
+    }
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        double base = resize_hmap(modes[m], 0, keys, vals, n, 0);
+        for (size_t t = 2; t <= max_threads; t <<= 1) {
+            resize_hmap(modes[m], t, keys, vals, n, base);
+        }
+    }
+    double base = resize_lhmap(0, keys, vals, n, 0);
+    for (size_t t = 2; t <= max_threads; t <<= 1) resize_lhmap(t, keys, vals, n, base);
+
+    free(vals);
+    free(keys);
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <threads.h>
+
+#include "hashmap_rcu.h"
+
+/*
+ * read scaling of hmap_rcu against an hmap guarded by a mutex. each run
+ * starts the given number of reader threads doing random hits for a fixed
+ * time, optionally with one writer overwriting values, and prints total
+ * lookups per second.
+ */
+
+enum { num_keys = 1 << 16, run_ms = 300 };
+
+typedef struct { int mode; uintptr_t id; size_t ops; uint64_t sum; } worker;
+
+static hmap_rcu rh;
+static hmap mh;
+static mtx_t mlock;
+static atomic_int stop;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int reader_fn(void *arg)
+{
+    worker *w = (worker*)arg;
+    uint64_t x = w->id * 0x9e3779b97f4a7c15ull + 1, v, sum = 0;
+    int reader = w->mode ? hmap_rcu_reader_register(&rh) : -1;
+    size_t ops = 0;
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        for (int i = 0; i < 64; i++) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            uint64_t k = x & (num_keys - 1);
+            if (w->mode) {
+                hmap_rcu_find(&rh, reader, &k, &v);
+            } else {
+                mtx_lock(&mlock);
+                v = *(uint64_t*)hmap_iter_val(hmap_find(&mh, &k));
+                mtx_unlock(&mlock);
+            }
+            sum += v;
+        }
+        ops += 64;
+    }
+    if (w->mode) hmap_rcu_reader_unregister(&rh, reader);
+    w->ops = ops;
+    w->sum = sum;
+    return 0;
+}
+
+static int writer_fn(void *arg)
+{
+    worker *w = (worker*)arg;
+    uint64_t x = 0x2545f4914f6cdd1dull;
+    size_t ops = 0;
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        uint64_t k = x & (num_keys - 1), v = x;
+        if (w->mode) {
+            hmap_rcu_insert(&rh, &k, &v);
+        } else {
+            mtx_lock(&mlock);
+            hmap_insert(&mh, &k, &v);
+            mtx_unlock(&mlock);
+        }
+        ops++;
+    }
+    w->ops = ops;
+    return 0;
+}
+
+static void run(const char *name, int mode, int readers, int writer)
+{
+    thrd_t threads[HMAP_RCU_MAX_READERS + 1];
+    worker workers[HMAP_RCU_MAX_READERS + 1];
+    size_t total = 0;
+
+    atomic_store(&stop, 0);
+    for (int i = 0; i < readers + writer; i++) {
+        workers[i].mode = mode;
+        workers[i].id = (uintptr_t)i + 1;
+        workers[i].ops = 0;
+        thrd_create(&threads[i], i < readers ? reader_fn : writer_fn, &workers[i]);
+    }
+    double t0 = now_ms();
+    thrd_sleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = run_ms * 1000000L }, NULL);
+    atomic_store(&stop, 1);
+    for (int i = 0; i < readers + writer; i++) thrd_join(threads[i], NULL);
+    double t1 = now_ms();
+
+    for (int i = 0; i < readers; i++) total += workers[i].ops;
+    printf("%-8s %8d %8d %12.2f %12.2f\n", name, readers, writer,
+        total / (t1 - t0) / 1e3, writer ? workers[readers].ops / (t1 - t0) / 1e3 : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+    int max = argc > 1 ? atoi(argv[1]) : 8;
+    if (max > HMAP_RCU_MAX_READERS) max = HMAP_RCU_MAX_READERS;
+
+    hmap_rcu_init(&rh, sizeof(uint64_t), sizeof(uint64_t), hmap_default_size);
+    hmap_init(&mh, sizeof(uint64_t), sizeof(uint64_t), hmap_default_size);
+    mtx_init(&mlock, mtx_plain);
+    for (uint64_t k = 0; k < num_keys; k++) {
+        hmap_rcu_insert(&rh, &k, &k);
+        hmap_insert(&mh, &k, &k);
+    }
+
+    printf("%-8s %8s %8s %12s %12s\n", "map", "readers", "writer", "read_mops", "write_mops");
+    for (int n = 1; n <= max; n <<= 1) {
+        run("mutex", 0, n, 0);
+        run("rcu", 1, n, 0);
+        run("mutex", 0, n, 1);
+        run("rcu", 1, n, 1);
+    }
+
+    mtx_destroy(&mlock);
+    hmap_destroy(&mh);
+    hmap_rcu_destroy(&rh);
+}
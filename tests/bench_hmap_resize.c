@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "hashmap.h"
+
+/*
+ * times lhmap resize on large linked maps, 10M entries by default or the
+ * count given as the first argument. keys are inserted in random order so
+ * list order is unrelated to slot order, as in a long-lived map. each map
+ * is grown one doubling and shrunk back, first by following links from
+ * head as resize used to, then with the sequential two pass resize, and
+ * the list is checked against insertion order after every resize.
+ */
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+    *x ^= *x << 13; *x ^= *x >> 7; *x ^= *x << 17;
+    return *x;
+}
+
+/* the link chasing resize, visiting old slots in list order */
+static void resize_by_links(lhmap *h, size_t new_limit)
+{
+    unsigned char *old_data = h->data;
+    size_t *old_hashes = h->hashes, old_limit = h->limit;
+
+    h->data = lhmap_alloc_table(h, new_limit);
+    h->limit = new_limit;
+    lhmap_meta_init(h);
+
+    size_t k = hmap_empty_offset;
+    for (size_t i = h->head; i != hmap_empty_offset;
+         i = lhmap_old_data_link(h, old_data, i)->next)
+    {
+        void *key = lhmap_old_data_key(h, old_data, i);
+        size_t hash = old_hashes ? old_hashes[i] : h->hasher(h, key);
+        size_t j = lhmap_hash_index(h, hash);
+        while ((hmap_bitmap_get(h->bitmap, j) & hmap_occupied) == hmap_occupied) {
+            j = (j+1) & lhmap_index_mask(h);
+        }
+        hmap_bitmap_set(h->bitmap, j, hmap_occupied);
+        lhmap_slot_set_hash(h, j, hash);
+        memcpy(lhmap_data_key(h, j), key, h->key_size + h->val_size);
+        lhmap_data_link(h, j)->next = hmap_empty_offset;
+        lhmap_data_link(h, j)->prev = k;
+        if (k == hmap_empty_offset) h->head = j;
+        else lhmap_data_link(h, k)->next = j;
+        k = j;
+    }
+    h->tail = k;
+    h->tombs = 0;
+    lhmap_free_table(h, old_data, old_limit);
+}
+
+static void resize_sequential(lhmap *h, size_t new_limit)
+{
+    lhmap_rehash_internal(h, new_limit);
+}
+
+static void check_order(lhmap *h, uint64_t *keys, size_t n)
+{
+    size_t c = 0;
+    for (lhmap_iter i = lhmap_iter_begin(h); lhmap_iter_neq(i, lhmap_iter_end(h));
+         i = lhmap_iter_next(i), c++) {
+        if (*(uint64_t*)lhmap_iter_key(i) != keys[c] ||
+            *(uint64_t*)lhmap_iter_val(i) != c) {
+            fprintf(stderr, "order mismatch at %zu\n", c);
+            exit(1);
+        }
+    }
+    if (c != n) {
+        fprintf(stderr, "count mismatch %zu != %zu\n", c, n);
+        exit(1);
+    }
+}
+
+static void bench(const char *name, unsigned flags, uint64_t *keys, size_t n)
+{
+    static const struct {
+        const char *name;
+        void (*resize)(lhmap *h, size_t new_limit);
+    } methods[] = {
+        { "links", resize_by_links },
+        { "sequential", resize_sequential },
+    };
+    lhmap h;
+    lhmap_opts opts = lhmap_opts_make(sizeof(uint64_t), sizeof(uint64_t));
+    opts.flags = flags;
+    lhmap_init_opts(&h, &opts);
+    lhmap_reserve(&h, n);
+
+    for (uint64_t i = 0; i < n; i++) {
+        lhmap_insert(&h, lhmap_iter_end(&h), &keys[i], &i);
+    }
+    size_t limit = lhmap_capacity(&h);
+
+    for (size_t m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+        double t0 = now_ns();
+        methods[m].resize(&h, limit << 1);
+        double t1 = now_ns();
+        check_order(&h, keys, n);
+        double t2 = now_ns();
+        methods[m].resize(&h, limit);
+        double t3 = now_ns();
+        check_order(&h, keys, n);
+
+        printf("%-8s %-12s %10zu %10.2f %10.2f\n", name, methods[m].name, n,
+            (t1 - t0) / n, (t3 - t2) / n);
+    }
+    lhmap_destroy(&h);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 10000000;
+    uint64_t *keys = (uint64_t*)malloc(sizeof(uint64_t) * n);
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+
+    for (size_t i = 0; i < n; i++) keys[i] = xorshift(&x);
+
+    printf("%-8s %-12s %10s %10s %10s\n", "flags", "resize", "entries", "grow", "shrink");
+    bench("none", hmap_flag_none, keys, n);
+    bench("hashes", hmap_flag_hashes, keys, n);
+
+    free(keys);
+}
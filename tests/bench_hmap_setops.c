@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "hashmap_parallel.h"
+
+/*
+ * times set operations on two hash sets of uint64_t ids, 4M and 2M by
+ * default or the size of the larger given as the first argument, sharing
+ * half of the smaller. each operation runs as a loop over one set calling
+ * hmap_find on the other and hmap_insert on the result, then with the
+ * batched hmap_union, hmap_intersect and hmap_difference, then with the
+ * _parallel variants on 2, 4 and so on up to the thread count given as
+ * the second argument, 8 by default. prints ns per element walked.
+ */
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+    *x ^= *x << 13; *x ^= *x >> 7; *x ^= *x << 17;
+    return *x;
+}
+
+enum set_op { op_union, op_intersect, op_difference };
+
+static const char *op_names[] = { "union", "intersect", "difference" };
+
+static void naive(hmap *dst, hmap *a, hmap *b, enum set_op op)
+{
+    hmap *small = hmap_count(a) < hmap_count(b) ? a : b;
+    hmap *walk = op == op_intersect ? small : a, *other = walk == a ? b : a;
+
+    if (op == op_union) {
+        for (hmap_iter i = hmap_iter_begin(b); hmap_iter_neq(i, hmap_iter_end(b));
+             i = hmap_iter_next(i)) hmap_insert(dst, hmap_iter_key(i), NULL);
+    }
+    for (hmap_iter i = hmap_iter_begin(walk); hmap_iter_neq(i, hmap_iter_end(walk));
+         i = hmap_iter_next(i)) {
+        int found = hmap_iter_neq(hmap_find(other, hmap_iter_key(i)), hmap_iter_end(other));
+        if (op == op_union || found == (op == op_intersect)) {
+            hmap_insert(dst, hmap_iter_key(i), NULL);
+        }
+    }
+}
+
+static double run(enum set_op op, const char *name, size_t nthreads,
+    hmap *a, hmap *b, hmap_opts *opts, size_t expect, double base)
+{
+    hmap dst;
+    hmap_init_opts(&dst, opts);
+
+    double t0 = now_ns();
+    if (!strcmp(name, "loop")) {
+        naive(&dst, a, b, op);
+    } else if (op == op_union) {
+        hmap_union_parallel(&dst, a, b, nthreads);
+    } else if (op == op_intersect) {
+        hmap_intersect_parallel(&dst, a, b, nthreads);
+    } else {
+        hmap_difference_parallel(&dst, a, b, nthreads);
+    }
+    double t = now_ns() - t0;
+
+    if (hmap_count(&dst) != expect) {
+        fprintf(stderr, "count mismatch %zu != %zu\n", hmap_count(&dst), expect);
+        exit(1);
+    }
+    size_t walked = op == op_union ? hmap_count(a) + hmap_count(b) :
+        op == op_intersect ? hmap_count(b) : hmap_count(a);
+    printf("%-10s %-10s %8zu %10.2f %8.2f\n", op_names[op], name, nthreads,
+        t / walked, base ? base / t : 1.0);
+    hmap_destroy(&dst);
+    return t;
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 4000000;
+    size_t max_threads = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 8;
+    hmap_opts opts = hmap_opts_make(sizeof(uint64_t), 0);
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+    hmap a, b;
+
+    /* b takes every other id of a and as many new ones */
+    hmap_init_opts(&a, &opts);
+    hmap_init_opts(&b, &opts);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t k = xorshift(&x);
+        hmap_insert(&a, &k, NULL);
+        if (i & 1) hmap_insert(&b, &k, NULL);
+    }
+    for (size_t i = 0; i < n / 2; i++) {
+        uint64_t k = xorshift(&x);
+        hmap_insert(&b, &k, NULL);
+    }
+    size_t shared = n / 2, expect[] = { n + n / 2, shared, n - shared };
+
+    printf("%-10s %-10s %8s %10s %8s\n", "op", "method", "threads", "ns/elem", "speedup");
+    for (int op = op_union; op <= op_difference; op++) {
+        double base = run((enum set_op)op, "loop", 0, &a, &b, &opts, expect[op], 0);
+        run((enum set_op)op, "batch", 1, &a, &b, &opts, expect[op], base);
+        for (size_t t = 2; t <= max_threads; t <<= 1) {
+            run((enum set_op)op, "parallel", t, &a, &b, &opts, expect[op], base);
+        }
+    }
+
+    hmap_destroy(&b);
+    hmap_destroy(&a);
+}
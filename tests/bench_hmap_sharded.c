@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <threads.h>
+
+#include "hashmap_sharded.h"
+
+/*
+ * write-heavy scaling of hmap_sharded against an hmap guarded by a mutex.
+ * each thread runs a mix of 50% insert, 25% erase and 25% find on random
+ * keys for a fixed time. prints total operations per second for thread
+ * counts from 1 up to the given maximum, which defaults to the number of
+ * shards.
+ */
+
+enum { num_keys = 1 << 20, num_shards = 64, run_ms = 300 };
+
+typedef struct { int mode; uintptr_t id; size_t ops; } worker;
+
+static hmap_sharded sh;
+static hmap mh;
+static mtx_t mlock;
+static atomic_int stop;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int worker_fn(void *arg)
+{
+    worker *w = (worker*)arg;
+    uint64_t x = w->id * 0x9e3779b97f4a7c15ull + 1, v;
+    size_t ops = 0;
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        for (int i = 0; i < 64; i++) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            uint64_t k = x & (num_keys - 1), op = (x >> 32) & 3;
+            if (w->mode) {
+                if (op < 2) hmap_sharded_insert(&sh, &k, &x);
+                else if (op == 2) hmap_sharded_erase(&sh, &k);
+                else hmap_sharded_find(&sh, &k, &v);
+            } else {
+                mtx_lock(&mlock);
+                if (op < 2) hmap_insert(&mh, &k, &x);
+                else if (op == 2) hmap_erase(&mh, &k);
+                else hmap_find(&mh, &k);
+                mtx_unlock(&mlock);
+            }
+        }
+        ops += 64;
+    }
+    w->ops = ops;
+    return 0;
+}
+
+static void run(const char *name, int mode, int threads)
+{
+    thrd_t t[256];
+    worker workers[256];
+    size_t total = 0;
+
+    atomic_store(&stop, 0);
+    for (int i = 0; i < threads; i++) {
+        workers[i].mode = mode;
+        workers[i].id = (uintptr_t)i + 1;
+        workers[i].ops = 0;
+        thrd_create(&t[i], worker_fn, &workers[i]);
+    }
+    double t0 = now_ms();
+    thrd_sleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = run_ms * 1000000L }, NULL);
+    atomic_store(&stop, 1);
+    for (int i = 0; i < threads; i++) thrd_join(t[i], NULL);
+    double t1 = now_ms();
+
+    for (int i = 0; i < threads; i++) total += workers[i].ops;
+    printf("%-8s %8d %12.2f\n", name, threads, total / (t1 - t0) / 1e3);
+}
+
+int main(int argc, char **argv)
+{
+    int max = argc > 1 ? atoi(argv[1]) : num_shards;
+    if (max > 256) max = 256;
+
+    hmap_sharded_init(&sh, sizeof(uint64_t), sizeof(uint64_t), num_shards);
+    hmap_init(&mh, sizeof(uint64_t), sizeof(uint64_t), hmap_default_size);
+    mtx_init(&mlock, mtx_plain);
+
+    printf("%-8s %8s %12s\n", "map", "threads", "mops");
+    for (int n = 1; n <= max; n <<= 1) {
+        run("mutex", 0, n);
+        run("sharded", 1, n);
+    }
+
+    mtx_destroy(&mlock);
+    hmap_destroy(&mh);
+    hmap_sharded_destroy(&sh);
+}
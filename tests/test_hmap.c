@@ -1,8 +1,10 @@
 #undef NDEBUG
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
 
 #include "hashmap.h"
+#include "hashmap_alloc.h"
 
 void t1()
 {
@@ -70,8 +72,1165 @@ void t2()
     lhmap_destroy(&h);
 }
 
+void t3()
+{
+    hmap h;
+    hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(int));
+    int k, v;
+
+    opts.limit = 2;
+    opts.flags = hmap_flag_tags;
+    hmap_init_opts(&h, &opts);
+
+    for (k = 0; k < 1000; k++) {
+        v = k * 2;
+        hmap_insert(&h, &k, &v);
+    }
+    for (k = 0; k < 1000; k += 2) {
+        hmap_erase(&h, &k);
+    }
+    assert(hmap_count(&h) == 500);
+
+    for (k = 0; k < 1000; k++) {
+        hmap_iter i = hmap_find(&h, &k);
+        if (k & 1) {
+            assert(*(int*)hmap_iter_val(i) == k * 2);
+        } else {
+            assert(hmap_iter_eq(i, hmap_iter_end(&h)));
+        }
+    }
+
+    size_t n = 0;
+    for(hmap_iter i = hmap_iter_begin(&h);
+        hmap_iter_neq(i, hmap_iter_end(&h));
+        i = hmap_iter_next(i), n++)
+    {
+        k = *(int*)hmap_iter_key(i);
+        v = *(int*)hmap_iter_val(i);
+        assert(k * 2 == v);
+    }
+    assert(n == 500);
+
+    k = 2000;
+    *(int*)hmap_get(&h, &k) = 7;
+    assert(*(int*)hmap_iter_val(hmap_find(&h, &k)) == 7);
+
+    hmap_destroy(&h);
+}
+
+void t4()
+{
+    hmap h1, h2;
+    hmap_opts opts = hmap_opts_make(16, 0);
+    unsigned char k[16] = { 0 };
+
+    /* keys sharing an 8 byte prefix must not collide */
+    opts.seed = 1;
+    hmap_init_opts(&h1, &opts);
+    opts.seed = 2;
+    hmap_init_opts(&h2, &opts);
+
+    k[15] = 1;
+    size_t a = h1.hasher(&h1, k);
+    k[15] = 2;
+    size_t b = h1.hasher(&h1, k);
+    assert(a != b);
+    assert(h1.hasher(&h1, k) != h2.hasher(&h2, k));
+
+    for (int i = 0; i < 1000; i++) {
+        memcpy(k + 12, &i, sizeof(i));
+        hmap_insert(&h1, k, k);
+    }
+    assert(hmap_count(&h1) == 1000);
+
+    hmap_destroy(&h1);
+    hmap_destroy(&h2);
+}
+
+static size_t hash_calls;
+
+static size_t counting_hash_fn(hmap *h, void *key)
+{
+    hash_calls++;
+    return hmap_default_hash_fn(h, key);
+}
+
+static size_t counting_lhash_fn(lhmap *h, void *key)
+{
+    hash_calls++;
+    return lhmap_default_hash_fn(h, key);
+}
+
+void t5()
+{
+    hmap h;
+    lhmap lh;
+    hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(int));
+    lhmap_opts lopts = lhmap_opts_make(sizeof(int), sizeof(int));
+    int k, v;
+
+    /* with cached hashes, resize never calls the hasher */
+    opts.flags = hmap_flag_hashes;
+    opts.hasher = counting_hash_fn;
+    hmap_init_opts(&h, &opts);
+    lopts.flags = hmap_flag_hashes;
+    lopts.hasher = counting_lhash_fn;
+    lhmap_init_opts(&lh, &lopts);
+
+    hash_calls = 0;
+    for (k = 0; k < 1000; k++) {
+        v = -k;
+        hmap_insert(&h, &k, &v);
+        lhmap_insert(&lh, lhmap_iter_end(&lh), &k, &v);
+    }
+    assert(hash_calls == 2000);
+
+    for (k = 0; k < 1000; k++) {
+        assert(*(int*)hmap_iter_val(hmap_find(&h, &k)) == -k);
+        assert(*(int*)lhmap_iter_val(lhmap_find(&lh, &k)) == -k);
+    }
+
+    k = 0;
+    for(lhmap_iter i = lhmap_iter_begin(&lh);
+        lhmap_iter_neq(i, lhmap_iter_end(&lh));
+        i = lhmap_iter_next(i), k++)
+    {
+        assert(*(int*)lhmap_iter_key(i) == k);
+    }
+    assert(k == 1000);
+
+    hmap_destroy(&h);
+    lhmap_destroy(&lh);
+
+    opts.flags = hmap_flag_hashes | hmap_flag_tags;
+    hmap_init_opts(&h, &opts);
+    hash_calls = 0;
+    for (k = 0; k < 1000; k++) {
+        hmap_insert(&h, &k, &k);
+    }
+    assert(hash_calls == 1000);
+    for (k = 0; k < 1000; k++) {
+        assert(*(int*)hmap_iter_val(hmap_find(&h, &k)) == k);
+    }
+    hmap_destroy(&h);
+}
+
+void t6()
+{
+    for (int pass = 0; pass < 2; pass++) {
+        hmap h;
+        hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(int));
+        int k, v;
+
+        opts.flags = hmap_flag_robin_hood | (pass ? hmap_flag_hashes : 0);
+        hmap_init_opts(&h, &opts);
+
+        for (k = 0; k < 1000; k++) {
+            v = k * 2;
+            hmap_insert(&h, &k, &v);
+        }
+        size_t limit = hmap_capacity(&h);
+
+        /* churn: erase leaves no tombstones so the table never grows */
+        for (k = 0; k < 100000; k++) {
+            int e = k % 1000, n = k + 1000;
+            hmap_erase(&h, &e);
+            v = e * 2;
+            hmap_insert(&h, &n, &v);
+            hmap_erase(&h, &n);
+            hmap_insert(&h, &e, &v);
+        }
+        assert(h.tombs == 0);
+        assert(hmap_capacity(&h) == limit);
+        assert(hmap_count(&h) == 1000);
+
+        for (k = 0; k < 2000; k++) {
+            hmap_iter i = hmap_find(&h, &k);
+            if (k < 1000) {
+                assert(*(int*)hmap_iter_val(i) == k * 2);
+            } else {
+                assert(hmap_iter_eq(i, hmap_iter_end(&h)));
+            }
+        }
+        hmap_destroy(&h);
+    }
+}
+
+void t7()
+{
+    for (int flags = 0; flags < 4; flags++) {
+        hmap h;
+        hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(int));
+        int k, v;
+
+        opts.flags = flags;
+        opts.max_load = hmap_load_multiplier / 4 * 3; /* 0.75 */
+        opts.min_load = hmap_load_multiplier / 8;
+        hmap_init_opts(&h, &opts);
+
+        /* reserve up front so inserting never resizes */
+        hmap_reserve(&h, 1000);
+        size_t limit = hmap_capacity(&h);
+        assert(limit == 2048);
+        for (k = 0; k < 1000; k++) {
+            v = k;
+            hmap_insert(&h, &k, &v);
+        }
+        assert(hmap_capacity(&h) == limit);
+
+        /* churn purges tombstones in place instead of doubling */
+        for (k = 1000; k < 100000; k++) {
+            int e = k - 1000;
+            v = k;
+            hmap_erase(&h, &e);
+            hmap_insert(&h, &k, &v);
+        }
+        assert(hmap_capacity(&h) == limit);
+        assert(hmap_count(&h) == 1000);
+
+        /* erasing below min_load shrinks */
+        for (k = 99000; k < 99990; k++) hmap_erase(&h, &k);
+        assert(hmap_count(&h) == 10);
+        assert(hmap_capacity(&h) < limit);
+        for (k = 99990; k < 100000; k++) {
+            assert(*(int*)hmap_iter_val(hmap_find(&h, &k)) == k);
+        }
+
+        hmap_shrink_to_fit(&h);
+        assert(hmap_capacity(&h) <= 32);
+        assert(h.tombs == 0);
+        for (k = 99990; k < 100000; k++) {
+            assert(*(int*)hmap_iter_val(hmap_find(&h, &k)) == k);
+        }
+        hmap_destroy(&h);
+    }
+
+    for (int flags = 0; flags < 4; flags += 2) {
+        lhmap h;
+        lhmap_opts opts = lhmap_opts_make(sizeof(int), sizeof(int));
+        int k, v;
+
+        opts.flags = flags;
+        opts.max_load = hmap_load_multiplier / 4 * 3;
+        opts.min_load = hmap_load_multiplier / 8;
+        lhmap_init_opts(&h, &opts);
+
+        lhmap_reserve(&h, 1000);
+        size_t limit = lhmap_capacity(&h);
+        for (k = 0; k < 1000; k++) {
+            v = k;
+            lhmap_insert(&h, lhmap_iter_end(&h), &k, &v);
+        }
+        assert(lhmap_capacity(&h) == limit);
+
+        for (k = 1000; k < 100000; k++) {
+            int e = k - 1000;
+            v = k;
+            lhmap_erase(&h, &e);
+            lhmap_insert(&h, lhmap_iter_end(&h), &k, &v);
+        }
+        assert(lhmap_capacity(&h) == limit);
+
+        for (k = 99000; k < 99990; k++) lhmap_erase(&h, &k);
+        assert(lhmap_capacity(&h) < limit);
+        lhmap_shrink_to_fit(&h);
+        assert(h.tombs == 0);
+
+        /* insertion order survives purge and shrink */
+        k = 99990;
+        for (lhmap_iter i = lhmap_iter_begin(&h); lhmap_iter_neq(i, lhmap_iter_end(&h));
+            i = lhmap_iter_next(i), k++) {
+            assert(*(int*)lhmap_iter_key(i) == k);
+            assert(*(int*)lhmap_iter_val(i) == k);
+        }
+        assert(k == 100000);
+        lhmap_destroy(&h);
+    }
+}
+
+void t8()
+{
+    for (int pass = 0; pass < 2; pass++) {
+        hmap h;
+        hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(int));
+        int k, v, migrating = 0;
+
+        opts.flags = hmap_flag_incremental | (pass ? hmap_flag_hashes : 0);
+        opts.min_load = hmap_load_multiplier / 16;
+        hmap_init_opts(&h, &opts);
+
+        for (k = 0; k < 100000; k++) {
+            v = k * 3;
+            hmap_insert(&h, &k, &v);
+            migrating |= h.old_data != NULL;
+            /* keys still in the old table are found and moved */
+            int p = k / 2;
+            assert(*(int*)hmap_iter_val(hmap_find(&h, &p)) == p * 3);
+        }
+        assert(migrating);
+        assert(hmap_count(&h) == 100000);
+
+        /* erase even keys, some still in the old table */
+        for (k = 0; k < 100000; k += 2) hmap_erase(&h, &k);
+        assert(hmap_count(&h) == 50000);
+        for (k = 0; k < 100000; k++) {
+            hmap_iter i = hmap_find(&h, &k);
+            if (k & 1) {
+                assert(*(int*)hmap_iter_val(i) == k * 3);
+            } else {
+                assert(hmap_iter_eq(i, hmap_iter_end(&h)));
+            }
+        }
+
+        /* iteration finishes the migration and sees every key once */
+        size_t n = 0;
+        for (hmap_iter i = hmap_iter_begin(&h); hmap_iter_neq(i, hmap_iter_end(&h));
+            i = hmap_iter_next(i), n++) {
+            assert(*(int*)hmap_iter_key(i) & 1);
+        }
+        assert(h.old_data == NULL);
+        assert(n == 50000);
+
+        /* draining below min_load shrinks incrementally */
+        size_t limit = hmap_capacity(&h);
+        for (k = 1; k < 99990; k += 2) hmap_erase(&h, &k);
+        assert(hmap_count(&h) == 5);
+        assert(hmap_capacity(&h) < limit);
+        for (k = 99991; k < 100000; k += 2) {
+            assert(*(int*)hmap_get(&h, &k) == k * 3);
+        }
+
+        hmap_shrink_to_fit(&h);
+        assert(h.old_data == NULL);
+        assert(hmap_count(&h) == 5);
+        hmap_destroy(&h);
+    }
+}
+
+void t9()
+{
+    static const unsigned modes[] = { 0, 1, 2, 3, 4, 6, 8, 10, 16, 17, 20, 24 };
+    int keys[10000];
+    for (int k = 0; k < 10000; k++) keys[k] = k * 7;
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        hmap h;
+        hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(int));
+        static hmap_iter iters[10000];
+        static void *vals[10000];
+
+        opts.flags = modes[m];
+        hmap_init_opts(&h, &opts);
+        for (int k = 0; k < 5000; k++) {
+            int v = k + 1;
+            hmap_insert(&h, &keys[k * 2], &v);
+        }
+
+        /* 10000 is not a multiple of the batch width */
+        hmap_find_batch(&h, keys, 10000, iters);
+        hmap_get_batch(&h, keys, 10000, vals);
+        for (int k = 0; k < 10000; k++) {
+            if (k & 1) {
+                assert(hmap_iter_eq(iters[k], hmap_iter_end(&h)));
+                assert(vals[k] == NULL);
+            } else {
+                assert(*(int*)hmap_iter_key(iters[k]) == keys[k]);
+                assert(*(int*)hmap_iter_val(iters[k]) == k / 2 + 1);
+                assert(vals[k] == hmap_iter_val(iters[k]));
+            }
+        }
+        hmap_find_batch(&h, keys, 3, iters);
+        assert(*(int*)hmap_iter_val(iters[2]) == 2);
+        hmap_destroy(&h);
+    }
+
+    for (unsigned flags = 0; flags < 4; flags += 2) {
+        lhmap h;
+        lhmap_opts opts = lhmap_opts_make(sizeof(int), sizeof(int));
+        static lhmap_iter iters[10000];
+        static void *vals[10000];
+
+        opts.flags = flags;
+        lhmap_init_opts(&h, &opts);
+        for (int k = 0; k < 5000; k++) {
+            int v = k + 1;
+            lhmap_insert(&h, lhmap_iter_end(&h), &keys[k * 2], &v);
+        }
+        lhmap_find_batch(&h, keys, 10000, iters);
+        lhmap_get_batch(&h, keys, 10000, vals);
+        for (int k = 0; k < 10000; k++) {
+            if (k & 1) {
+                assert(lhmap_iter_eq(iters[k], lhmap_iter_end(&h)));
+                assert(vals[k] == NULL);
+            } else {
+                assert(*(int*)lhmap_iter_val(iters[k]) == k / 2 + 1);
+                assert(vals[k] == lhmap_iter_val(iters[k]));
+            }
+        }
+        lhmap_destroy(&h);
+    }
+}
+
+typedef struct { size_t allocs, frees, live; } alloc_count;
+
+static void* count_alloc(void *userdata, size_t size)
+{
+    alloc_count *c = (alloc_count*)userdata;
+    c->allocs++;
+    c->live += size;
+    return malloc(size);
+}
+
+static void count_free(void *userdata, void *ptr, size_t size)
+{
+    alloc_count *c = (alloc_count*)userdata;
+    c->frees++;
+    c->live -= size;
+    free(ptr);
+}
+
+void t10()
+{
+    static const unsigned modes[] = { 0, 1, 2, 4, 8 };
+    hmap_arena arena;
+    alloc_count c = { 0, 0, 0 };
+    hmap_allocator allocs[4];
+
+    hmap_arena_init(&arena, 4096);
+    allocs[0] = (hmap_allocator){ count_alloc, count_free, &c };
+    allocs[1] = hmap_aligned_allocator();
+    allocs[2] = hmap_arena_allocator(&arena);
+    allocs[3] = hmap_huge_allocator(8192);
+
+    for (size_t a = 0; a < 4; a++) {
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            hmap h;
+            hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(int));
+            opts.flags = modes[m];
+            opts.min_load = opts.max_load >> 2;
+            opts.allocator = allocs[a];
+            hmap_init_opts(&h, &opts);
+            for (int k = 0; k < 20000; k++) hmap_insert(&h, &k, &k);
+            if (a > 0) assert(((uintptr_t)h.data & 63) == 0);
+            for (int k = 0; k < 20000; k += 2) hmap_erase(&h, &k);
+            for (int k = 0; k < 20000; k++) {
+                hmap_iter it = hmap_find(&h, &k);
+                if (k & 1) assert(*(int*)hmap_iter_val(it) == k);
+                else assert(hmap_iter_eq(it, hmap_iter_end(&h)));
+            }
+            for (int k = 1; k < 20000; k += 2) hmap_erase(&h, &k);
+            hmap_shrink_to_fit(&h);
+            hmap_destroy(&h);
+        }
+
+        lhmap l;
+        lhmap_opts lopts = lhmap_opts_make(sizeof(int), sizeof(int));
+        lopts.allocator = allocs[a];
+        lhmap_init_opts(&l, &lopts);
+        for (int k = 0; k < 20000; k++) lhmap_insert(&l, lhmap_iter_end(&l), &k, &k);
+        for (int k = 0; k < 20000; k++) assert(*(int*)lhmap_get(&l, &k) == k);
+        lhmap_destroy(&l);
+
+        hmap_arena_reset(&arena);
+    }
+    assert(c.allocs == c.frees && c.live == 0 && c.allocs > 6);
+
+    hmap_arena_destroy(&arena);
+}
+
+void t11()
+{
+    static const unsigned modes[] = { 16, 17, 18, 19, 20, 22, 24, 26 };
+    typedef struct { unsigned char b[3]; } key3;
+    typedef struct { int n; char pad[116]; } val120;
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        hmap h;
+        hmap_opts opts = hmap_opts_make(sizeof(key3), sizeof(val120));
+        opts.flags = modes[m];
+        opts.limit = 2;
+        hmap_init_opts(&h, &opts);
+        for (int k = 0; k < 3000; k++) {
+            key3 key = { { (unsigned char)k, (unsigned char)(k >> 8), 7 } };
+            val120 val = { k, { 0 } };
+            hmap_insert(&h, &key, &val);
+        }
+        for (int k = 0; k < 3000; k += 2) {
+            key3 key = { { (unsigned char)k, (unsigned char)(k >> 8), 7 } };
+            hmap_erase(&h, &key);
+        }
+        assert(hmap_count(&h) == 1500);
+        for (int k = 0; k < 3000; k++) {
+            key3 key = { { (unsigned char)k, (unsigned char)(k >> 8), 7 } };
+            hmap_iter i = hmap_find(&h, &key);
+            if (k & 1) {
+                assert(((val120*)hmap_iter_val(i))->n == k);
+                assert(memcmp(hmap_iter_key(i), &key, sizeof(key)) == 0);
+            } else {
+                assert(hmap_iter_eq(i, hmap_iter_end(&h)));
+            }
+        }
+        /* values start at an aligned offset after the dense key array */
+        assert((uintptr_t)hmap_data_val(&h, 0) % 8 == 0);
+        assert((unsigned char*)hmap_data_key(&h, 1) == h.data + sizeof(key3));
+        hmap_destroy(&h);
+    }
+}
+
+typedef struct { int count; int last; } evict_log;
+
+static void log_evict(lhmap *h, void *key, void *val)
+{
+    evict_log *log = (evict_log*)lhmap_userdata(h);
+    assert(*(int*)val == *(int*)key * 10);
+    log->count++;
+    log->last = *(int*)key;
+}
+
+static size_t val_cost(lhmap *h, void *key, void *val)
+{
+    (void)h;
+    (void)key;
+    return (size_t)*(int*)val;
+}
+
+void t12()
+{
+    evict_log log = { 0, -1 };
+    lhmap h;
+    lhmap_opts opts = lhmap_opts_make(sizeof(int), sizeof(int));
+    opts.userdata = &log;
+    opts.max_entries = 1000;
+    opts.evict = log_evict;
+    lhmap_init_opts(&h, &opts);
+    size_t limit = lhmap_capacity(&h);
+
+    for (int k = 0; k < 1000; k++) {
+        int v = k * 10;
+        lhmap_insert_front(&h, &k, &v);
+    }
+    assert(lhmap_count(&h) == 1000 && log.count == 0);
+
+    /* touching 0 makes 1 the least recently used */
+    int k = 0;
+    assert(*(int*)lhmap_iter_val(lhmap_touch(&h, &k)) == 0);
+    assert(*(int*)lhmap_iter_key(lhmap_iter_begin(&h)) == 0);
+    k = 5000;
+    assert(lhmap_iter_eq(lhmap_touch(&h, &k), lhmap_iter_end(&h)));
+
+    k = 1000;
+    int v = k * 10;
+    lhmap_insert_front(&h, &k, &v);
+    assert(log.count == 1 && log.last == 1);
+    assert(lhmap_count(&h) == 1000);
+
+    /* churn far past capacity, the table must never grow */
+    for (k = 1001; k < 100000; k++) {
+        v = k * 10;
+        lhmap_insert_front(&h, &k, &v);
+        assert(lhmap_count(&h) == 1000);
+    }
+    assert(lhmap_capacity(&h) == limit);
+    assert(log.count == 100000 - 1000);
+
+    /* the survivors are the 1000 most recent, newest first */
+    int expect = 99999;
+    for (lhmap_iter i = lhmap_iter_begin(&h); lhmap_iter_neq(i, lhmap_iter_end(&h));
+         i = lhmap_iter_next(i), expect--) {
+        assert(*(int*)lhmap_iter_key(i) == expect);
+    }
+    assert(expect == 98999);
+
+    /* replacing a present key promotes it without evicting */
+    k = 99000;
+    v = k * 10;
+    lhmap_insert_front(&h, &k, &v);
+    assert(log.count == 100000 - 1000);
+    assert(*(int*)lhmap_iter_key(lhmap_iter_begin(&h)) == 99000);
+    assert(lhmap_evict(&h) && log.last == 99001);
+    lhmap_destroy(&h);
+
+    /* max_bytes charges each entry its value */
+    log.count = 0;
+    opts = lhmap_opts_make(sizeof(int), sizeof(int));
+    opts.userdata = &log;
+    opts.max_bytes = 1000;
+    opts.cost = val_cost;
+    opts.evict = log_evict;
+    lhmap_init_opts(&h, &opts);
+    for (k = 1; k <= 100; k++) {
+        v = k * 10;
+        lhmap_insert_front(&h, &k, &v);
+        assert(lhmap_bytes(&h) <= 1000);
+    }
+    /* 100*10 fits alone, everything older was evicted */
+    assert(lhmap_count(&h) == 1 && lhmap_bytes(&h) == 1000 && log.count == 99);
+    k = 50, v = 500;
+    lhmap_insert_front(&h, &k, &v);
+    assert(lhmap_count(&h) == 1 && lhmap_bytes(&h) == 500);
+    k = 100;
+    assert(lhmap_iter_eq(lhmap_find(&h, &k), lhmap_iter_end(&h)));
+    while (lhmap_evict(&h));
+    assert(lhmap_count(&h) == 0 && lhmap_bytes(&h) == 0);
+
+    /* inserting at the end evicts older entries ahead of the new tail */
+    log.count = 0;
+    for (k = 1; k <= 100; k++) {
+        v = k * 10;
+        lhmap_insert(&h, lhmap_iter_end(&h), &k, &v);
+        assert(lhmap_bytes(&h) <= 1000);
+        assert(*(int*)lhmap_data_key(&h, h.tail) == k);
+    }
+    assert(lhmap_count(&h) == 1 && lhmap_bytes(&h) == 1000 && log.count == 99);
+    lhmap_destroy(&h);
+
+    /* lhmap_get charges the default cost of each claimed entry */
+    opts = lhmap_opts_make(sizeof(int), sizeof(int));
+    opts.max_bytes = 10 * (2 * sizeof(int) + sizeof(lhmap_link));
+    lhmap_init_opts(&h, &opts);
+    for (k = 0; k < 100; k++) {
+        *(int*)lhmap_get(&h, &k) = k;
+        assert(lhmap_bytes(&h) <= opts.max_bytes);
+    }
+    assert(lhmap_count(&h) <= 10);
+    k = 99;
+    assert(*(int*)lhmap_iter_val(lhmap_find(&h, &k)) == 99);
+    lhmap_destroy(&h);
+}
+
+/* walks the list checking keys in order, then backwards from the tail */
+static void check_lhmap_order(lhmap *h, const int *order, size_t n)
+{
+    size_t c = 0;
+    for (lhmap_iter i = lhmap_iter_begin(h); lhmap_iter_neq(i, lhmap_iter_end(h));
+         i = lhmap_iter_next(i), c++) {
+        assert(*(int*)lhmap_iter_key(i) == order[c]);
+        assert(*(int*)lhmap_iter_val(i) == order[c] * 3);
+    }
+    assert(c == n && lhmap_count(h) == n);
+    for (size_t i = h->tail; i != hmap_empty_offset; i = lhmap_data_link(h, i)->prev) {
+        assert(*(int*)lhmap_data_key(h, i) == order[--c]);
+    }
+    assert(c == 0);
+}
+
+void t13()
+{
+    static const unsigned modes[] = { hmap_flag_none, hmap_flag_hashes };
+    enum { n = 20000 };
+    static int order[n];
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        lhmap h;
+        lhmap_opts opts = lhmap_opts_make(sizeof(int), sizeof(int));
+        opts.flags = modes[m];
+        lhmap_init_opts(&h, &opts);
+
+        /* mix front and back inserts so order differs from slot order */
+        for (int k = 0; k < n; k++) {
+            int v = k * 3;
+            lhmap_insert(&h, (k & 1) ? lhmap_iter_begin(&h) : lhmap_iter_end(&h), &k, &v);
+        }
+        for (int k = 0; k < n; k += 4) lhmap_erase(&h, &k);
+
+        size_t c = 0;
+        for (lhmap_iter i = lhmap_iter_begin(&h); lhmap_iter_neq(i, lhmap_iter_end(&h));
+             i = lhmap_iter_next(i)) {
+            order[c++] = *(int*)lhmap_iter_key(i);
+        }
+
+        lhmap_reserve(&h, n * 4);
+        check_lhmap_order(&h, order, c);
+        lhmap_shrink_to_fit(&h);
+        check_lhmap_order(&h, order, c);
+
+        /* a single entry is both head and tail */
+        while (lhmap_count(&h) > 1) lhmap_erase(&h, lhmap_iter_key(lhmap_iter_begin(&h)));
+        order[0] = *(int*)lhmap_iter_key(lhmap_iter_begin(&h));
+        lhmap_shrink_to_fit(&h);
+        check_lhmap_order(&h, order, 1);
+        lhmap_destroy(&h);
+    }
+}
+
+typedef struct visit_log { int seen[4000]; size_t count; int stop; } visit_log;
+
+static int log_visit(void *ctx, void *key, void *val)
+{
+    visit_log *log = (visit_log*)ctx;
+    int k = *(int*)key;
+    assert(*(int*)val == -k && log->seen[k] == 0);
+    log->seen[k] = 1;
+    log->count++;
+    return log->stop && k == log->stop ? k : 0;
+}
+
+void t14()
+{
+    static const unsigned modes[] = { 0, 1, 2, 4, 8, 16, 17 };
+    static visit_log log;
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        hmap h;
+        hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(int));
+        opts.flags = modes[m];
+        hmap_init_opts(&h, &opts);
+
+        /* sparse, with runs of empty words between entries */
+        hmap_reserve(&h, 100000);
+        for (int k = 0; k < 4000; k++) {
+            int v = -k;
+            hmap_insert(&h, &k, &v);
+        }
+        for (int k = 0; k < 4000; k += 3) hmap_erase(&h, &k);
+        size_t expect = hmap_count(&h);
+
+        memset(&log, 0, sizeof(log));
+        assert(hmap_foreach(&h, log_visit, &log) == 0);
+        assert(log.count == expect);
+        for (int k = 0; k < 4000; k++) assert(log.seen[k] == (k % 3 != 0));
+
+        /* uneven ranges cover each slot once, past capacity is clamped */
+        memset(&log, 0, sizeof(log));
+        size_t cap = hmap_capacity(&h), a = 0;
+        for (size_t b = 1; a < cap; a = b, b = b * 3 + 5) {
+            assert(hmap_foreach_range(&h, a, b, log_visit, &log) == 0);
+        }
+        assert(log.count == expect);
+
+        /* iterator ranges visit the same entries in slot order */
+        size_t count = 0, last = 0;
+        for (a = 0; a < cap; a += 1000) {
+            for (hmap_iter i = hmap_iter_from(&h, a); i.idx < a + 1000 &&
+                 hmap_iter_neq(i, hmap_iter_end(&h)); i = hmap_iter_next(i)) {
+                assert(count == 0 || i.idx > last);
+                assert(*(int*)hmap_iter_val(i) == -*(int*)hmap_iter_key(i));
+                last = i.idx;
+                count++;
+            }
+        }
+        assert(count == expect);
+        assert(hmap_iter_eq(hmap_iter_from(&h, cap + 5), hmap_iter_end(&h)));
+
+        /* a non-zero result stops the walk */
+        memset(&log, 0, sizeof(log));
+        log.stop = 3001;
+        assert(hmap_foreach(&h, log_visit, &log) == 3001);
+        assert(log.count <= expect && log.seen[3001]);
+
+        hmap_clear(&h);
+        assert(hmap_foreach(&h, log_visit, &log) == 0);
+        assert(hmap_iter_eq(hmap_iter_begin(&h), hmap_iter_end(&h)));
+        hmap_destroy(&h);
+    }
+}
+
+void t15()
+{
+    static const unsigned modes[] = { 32, 33, 34, 36, 40, 48, 49 };
+    typedef struct { int k; unsigned char pad[196]; } big;
+    enum { n = 5000 };
+    static big *ptrs[n];
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        hmap h;
+        hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(big));
+        opts.flags = modes[m];
+        opts.min_load = opts.max_load >> 2;
+        hmap_init_opts(&h, &opts);
+        assert(hmap_stride(&h) == sizeof(int) + sizeof(uint32_t));
+
+        /* value pointers stay put while the table grows */
+        for (int k = 0; k < n; k++) {
+            big v;
+            memset(&v, k & 0xff, sizeof(v));
+            v.k = k;
+            ptrs[k] = (big*)hmap_iter_val(hmap_insert(&h, &k, &v));
+        }
+        assert(hmap_count(&h) == n);
+        for (int k = 0; k < n; k++) {
+            assert(hmap_get(&h, &k) == ptrs[k] && ptrs[k]->k == k);
+            assert(ptrs[k]->pad[195] == (k & 0xff));
+        }
+
+        /* replacing writes through the same value */
+        for (int k = 0; k < n; k += 2) {
+            big v = *ptrs[k];
+            v.pad[0] = 0xaa;
+            assert(hmap_iter_val(hmap_insert(&h, &k, &v)) == ptrs[k]);
+        }
+
+        /* erasing shrinks the table, surviving values do not move */
+        for (int k = 0; k < n; k++) if (k % 8) hmap_erase(&h, &k);
+        assert(hmap_count(&h) == n / 8);
+        hmap_shrink_to_fit(&h);
+        for (int k = 0; k < n; k++) {
+            big *v;
+            hmap_get_batch(&h, &k, 1, (void**)&v);
+            assert((k % 8 == 0) == (v != NULL));
+            if (v) assert(v == ptrs[k] && v->k == k && v->pad[0] == 0xaa);
+        }
+
+        /* erased values are reused before the slab grows */
+        size_t slab = h.slab_chunks;
+        for (int r = 0; r < 4; r++) {
+            for (int k = 1; k < n; k += 8) {
+                big v;
+                v.k = k;
+                hmap_insert(&h, &k, &v);
+            }
+            for (int k = 1; k < n; k += 8) hmap_erase(&h, &k);
+        }
+        assert(h.slab_chunks == slab);
+
+        hmap_clear(&h);
+        int k = 7;
+        assert(hmap_count(&h) == 0 && hmap_iter_eq(hmap_find(&h, &k), hmap_iter_end(&h)));
+        big v = { 7, { 0 } };
+        assert(((big*)hmap_iter_val(hmap_insert(&h, &k, &v)))->k == 7);
+        hmap_destroy(&h);
+    }
+}
+
+typedef struct erase_ctx { size_t calls; int mod, rem; } erase_ctx;
+
+static int erase_mod(void *ctx, void *key, void *val)
+{
+    erase_ctx *e = (erase_ctx*)ctx;
+    int k = *(int*)key;
+    assert(*(int*)val == -k);
+    e->calls++;
+    return k % e->mod == e->rem;
+}
+
+static size_t count_tombs(uint64_t *bitmap, unsigned char *ctrl, size_t limit)
+{
+    size_t tombs = 0;
+    for (size_t i = 0; i < limit; i++) {
+        if (ctrl) tombs += ctrl[i] == hmap_ctrl_deleted;
+        else tombs += hmap_bitmap_get(bitmap, i) == hmap_deleted;
+    }
+    return tombs;
+}
+
+void t16()
+{
+    static const unsigned modes[] = { 0, 1, 2, 3, 4, 6, 8, 16, 17, 32, 33, 36 };
+    enum { n = 20000 };
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        hmap h;
+        hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(int));
+        opts.flags = modes[m];
+        opts.min_load = opts.max_load >> 2;
+        hmap_init_opts(&h, &opts);
+        for (int k = 0; k < n; k++) {
+            int v = -k;
+            hmap_insert(&h, &k, &v);
+        }
+        /* leave older tombstones for the sweep to reclaim as well */
+        for (int k = 3; k < n; k += 30) hmap_erase(&h, &k);
+
+        /* pred sees each entry once, tombstones are reclaimed or purged */
+        erase_ctx e = { 0, 3, 0 };
+        size_t before = hmap_count(&h);
+        assert(hmap_erase_if(&h, erase_mod, &e) == (n + 2) / 3 - (n + 26) / 30);
+        assert(e.calls == before && hmap_count(&h) == before - (n + 2) / 3 + (n + 26) / 30);
+        assert(h.tombs == count_tombs(h.bitmap, h.ctrl, h.limit));
+        assert(h.tombs * hmap_load_multiplier / h.limit <= h.max_load >> 2);
+        for (int k = 0; k < n; k++) {
+            hmap_iter i = hmap_find(&h, &k);
+            assert((k % 3 != 0) == hmap_iter_neq(i, hmap_iter_end(&h)));
+        }
+
+        /* erase while iterating, each entry is visited once */
+        size_t erased = 0, visited = 0;
+        before = hmap_count(&h);
+        for (hmap_iter i = hmap_iter_begin(&h); hmap_iter_neq(i, hmap_iter_end(&h));
+             visited++) {
+            int k = *(int*)hmap_iter_key(i);
+            assert(*(int*)hmap_iter_val(i) == -k);
+            if (k % 3 == 1) {
+                i = hmap_iter_erase(i);
+                erased++;
+            } else {
+                i = hmap_iter_next(i);
+            }
+        }
+        assert(visited == before);
+        assert(erased == (n + 1) / 3 && hmap_count(&h) == n / 3);
+        for (int k = 0; k < n; k++) {
+            hmap_iter i = hmap_find(&h, &k);
+            assert((k % 3 == 2) == hmap_iter_neq(i, hmap_iter_end(&h)));
+            if (k % 3 == 2) assert(*(int*)hmap_iter_val(i) == -k);
+        }
+        assert(h.tombs == count_tombs(h.bitmap, h.ctrl, h.limit));
+
+        /* refill over the tombstones, then erase all and shrink */
+        for (int k = 0; k < n; k++) {
+            int v = -k;
+            hmap_insert(&h, &k, &v);
+        }
+        assert(hmap_count(&h) == n);
+        e.mod = 1;
+        assert(hmap_erase_if(&h, erase_mod, &e) == n);
+        assert(hmap_count(&h) == 0 && hmap_capacity(&h) < n);
+        assert(hmap_iter_eq(hmap_iter_begin(&h), hmap_iter_end(&h)));
+        hmap_destroy(&h);
+    }
+
+    static const unsigned lmodes[] = { hmap_flag_none, hmap_flag_hashes };
+    static int order[n];
+    for (size_t m = 0; m < sizeof(lmodes) / sizeof(lmodes[0]); m++) {
+        lhmap h;
+        lhmap_opts opts = lhmap_opts_make(sizeof(int), sizeof(int));
+        opts.flags = lmodes[m];
+        opts.min_load = opts.max_load >> 2;
+        lhmap_init_opts(&h, &opts);
+        for (int k = 0; k < n; k++) {
+            int v = k * 3;
+            lhmap_insert(&h, (k & 1) ? lhmap_iter_begin(&h) : lhmap_iter_end(&h), &k, &v);
+        }
+
+        /* survivors keep their list order */
+        size_t c = 0;
+        for (lhmap_iter i = lhmap_iter_begin(&h); lhmap_iter_neq(i, lhmap_iter_end(&h));
+             i = lhmap_iter_next(i)) {
+            int k = *(int*)lhmap_iter_key(i);
+            if (k % 4 > 1) order[c++] = k;
+        }
+        erase_ctx e = { 0, 4, 0 };
+        for (int k = 0; k < n; k++) *(int*)lhmap_get(&h, &k) = -k;
+        assert(lhmap_erase_if(&h, erase_mod, &e) == n / 4 && e.calls == n);
+        for (lhmap_iter i = lhmap_iter_begin(&h); lhmap_iter_neq(i, lhmap_iter_end(&h)); ) {
+            int k = *(int*)lhmap_iter_key(i);
+            *(int*)lhmap_iter_val(i) = k * 3;
+            i = k % 4 == 1 ? lhmap_iter_erase(i) : lhmap_iter_next(i);
+        }
+        check_lhmap_order(&h, order, c);
+        assert(h.tombs == count_tombs(h.bitmap, NULL, h.limit));
+
+        e.mod = 1;
+        for (lhmap_iter i = lhmap_iter_begin(&h); lhmap_iter_neq(i, lhmap_iter_end(&h));
+             i = lhmap_iter_next(i)) {
+            *(int*)lhmap_iter_val(i) = -*(int*)lhmap_iter_key(i);
+        }
+        assert(lhmap_erase_if(&h, erase_mod, &e) == c);
+        assert(lhmap_count(&h) == 0 && lhmap_capacity(&h) < n);
+        assert(lhmap_iter_eq(lhmap_iter_begin(&h), lhmap_iter_end(&h)));
+        lhmap_destroy(&h);
+    }
+}
+
+/* multiples of step below limit, valued k + base when val_size is set */
+static void fill_multiples(hmap *h, const hmap_opts *opts, int step, int limit, int base)
+{
+    hmap_init_opts(h, opts);
+    for (int k = 0; k < limit; k += step) {
+        int v = k + base;
+        /* sets take no value */
+        hmap_insert(h, &k, h->val_size ? &v : NULL);
+    }
+}
+
+/* checks dst holds exactly the keys below limit for which in(k) is set */
+static void check_set(hmap *h, int limit, int (*in)(int), int (*val)(int))
+{
+    size_t count = 0;
+    for (int k = 0; k < limit; k++) {
+        hmap_iter i = hmap_find(h, &k);
+        assert(in(k) == hmap_iter_neq(i, hmap_iter_end(h)));
+        if (!in(k)) continue;
+        count++;
+        if (h->val_size) assert(*(int*)hmap_iter_val(i) == val(k));
+    }
+    assert(hmap_count(h) == count);
+}
+
+static int in_union(int k) { return k % 2 == 0 || k % 3 == 0; }
+static int in_inter(int k) { return k % 6 == 0; }
+static int in_diff(int k) { return k % 2 == 0 && k % 3 != 0; }
+static int val_a_first(int k) { return k % 2 == 0 ? k + 100000 : k + 200000; }
+static int val_sum(int k) { return k % 6 == 0 ? 2 * k + 300000 : val_a_first(k); }
+
+static void sum_vals(void *ctx, void *key, void *dst_val, void *src_val)
+{
+    (void)key;
+    ++*(size_t*)ctx;
+    *(int*)dst_val += *(int*)src_val;
+}
+
+static void count_keys(void *ctx, void *key, void *dst_val, void *src_val)
+{
+    (void)key; (void)dst_val; (void)src_val;
+    ++*(size_t*)ctx;
+}
+
+void t17()
+{
+    static const unsigned modes[] = { 0, 1, 2, 3, 4, 6, 8, 16, 17, 32, 33 };
+    enum { n = 30000 };
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]) * 4; m++) {
+        /* sets and maps, with shared or separate seeds */
+        hmap_opts opts = hmap_opts_make(sizeof(int), (m & 1) ? sizeof(int) : 0);
+        hmap_opts other = opts;
+        opts.flags = other.flags = modes[m >> 2];
+        if (m & 2) other.seed = opts.seed + 1;
+        hmap a, b, dst;
+
+        /* a is the smaller map for union and intersect, then the larger */
+        for (int swap = 0; swap < 2; swap++) {
+            int la = swap ? n : n / 2, lb = swap ? n / 2 : n;
+            fill_multiples(&a, &opts, 2, la, 100000);
+            fill_multiples(&b, &other, 3, lb, 200000);
+            int lim = la < lb ? la : lb;
+
+            /* keys already in dst are kept, or replaced by the result */
+            hmap_init_opts(&dst, &opts);
+            for (int k = 1; k <= 4; k++) {
+                int v = -k;
+                hmap_insert(&dst, &k, &v);
+            }
+            hmap_union(&dst, &a, &b);
+            size_t count = 0;
+            for (int k = 0; k < n; k++) {
+                hmap_iter i = hmap_find(&dst, &k);
+                int in_a = k < la && k % 2 == 0, in_b = k < lb && k % 3 == 0;
+                int in = in_a || in_b || (k >= 1 && k <= 4);
+                assert(in == hmap_iter_neq(i, hmap_iter_end(&dst)));
+                if (in && opts.val_size) {
+                    int v = in_a ? val_a_first(k) : in_b ? k + 200000 : -k;
+                    assert(*(int*)hmap_iter_val(i) == v);
+                }
+                count += in;
+            }
+            assert(hmap_count(&dst) == count);
+            hmap_destroy(&dst);
+
+            hmap_init_opts(&dst, &other);
+            hmap_intersect(&dst, &a, &b);
+            check_set(&dst, lim, in_inter, val_a_first);
+            hmap_destroy(&dst);
+            hmap_destroy(&b);
+            hmap_destroy(&a);
+        }
+
+        fill_multiples(&a, &opts, 2, n, 100000);
+        fill_multiples(&b, &other, 3, n, 200000);
+
+        hmap_init_opts(&dst, &other);
+        hmap_union(&dst, &a, &b);
+        check_set(&dst, n, in_union, val_a_first);
+        /* results add to what dst holds */
+        hmap_intersect(&dst, &a, &b);
+        check_set(&dst, n, in_union, val_a_first);
+        hmap_destroy(&dst);
+
+        hmap_init_opts(&dst, &opts);
+        hmap_difference(&dst, &a, &b);
+        check_set(&dst, n, in_diff, val_a_first);
+        hmap_destroy(&dst);
+
+        /* merging b into a copy of a sums the values of shared keys */
+        size_t calls = 0;
+        hmap_init_opts(&dst, &opts);
+        hmap_combine_fn combine = opts.val_size ? sum_vals : count_keys;
+        hmap_merge(&dst, &a, combine, &calls);
+        assert(calls == 0);
+        hmap_merge(&dst, &b, combine, &calls);
+        assert(calls == (n + 5) / 6);
+        check_set(&dst, n, in_union, val_sum);
+        hmap_merge(&dst, &a, NULL, NULL);
+        check_set(&dst, n, in_union, val_a_first);
+        hmap_destroy(&dst);
+
+        /* empty operands */
+        hmap_init_opts(&dst, &opts);
+        hmap_clear(&b);
+        hmap_intersect(&dst, &a, &b);
+        assert(hmap_count(&dst) == 0);
+        hmap_difference(&dst, &a, &b);
+        assert(hmap_count(&dst) == hmap_count(&a));
+        hmap_destroy(&dst);
+        hmap_destroy(&b);
+        hmap_destroy(&a);
+    }
+}
+
+/* homes keys at their low four bits, so runs can be placed to wrap */
+static size_t low_bits_hash_fn(hmap *h, void *key)
+{
+    (void)h;
+    return (size_t)(*(int*)key & 15);
+}
+
+void t18()
+{
+    /* erasing from runs that wrap into slot 0 visits each entry once */
+    static const unsigned modes[] = { hmap_flag_robin_hood,
+        hmap_flag_robin_hood | hmap_flag_hashes, hmap_flag_none };
+    /* 13, 29, 45 and 61 fill slots 13 to 0, pushing 14 to 1 */
+    static const int keys[] = { 13, 14, 29, 45, 61, 2 };
+    enum { num = sizeof(keys) / sizeof(keys[0]) };
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        for (size_t from = 13; from <= 16; from++) {
+            hmap h;
+            hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(int));
+            opts.flags = modes[m];
+            opts.hasher = low_bits_hash_fn;
+            hmap_init_opts(&h, &opts);
+            assert(hmap_capacity(&h) == 16);
+            for (size_t k = 0; k < num; k++) {
+                int v = -keys[k];
+                hmap_insert(&h, (void*)&keys[k], &v);
+            }
+
+            /* erases entries at slots from 13 on, or slot 1 when from is 16 */
+            int seen[64] = { 0 }, erased[64] = { 0 };
+            size_t count = 0;
+            for (hmap_iter i = hmap_iter_begin(&h); hmap_iter_neq(i, hmap_iter_end(&h)); ) {
+                int k = *(int*)hmap_iter_key(i);
+                assert(*(int*)hmap_iter_val(i) == -k && !seen[k]++);
+                if (i.idx >= from || (from == 16 && i.idx == 1)) {
+                    erased[k] = 1;
+                    count++;
+                    i = hmap_iter_erase(i);
+                } else {
+                    i = hmap_iter_next(i);
+                }
+            }
+            assert(count > 0 && hmap_count(&h) == num - count);
+            for (size_t k = 0; k < num; k++) {
+                hmap_iter i = hmap_find(&h, (void*)&keys[k]);
+                assert(seen[keys[k]] == 1);
+                assert(erased[keys[k]] == hmap_iter_eq(i, hmap_iter_end(&h)));
+                if (!erased[keys[k]]) assert(*(int*)hmap_iter_val(i) == -keys[k]);
+            }
+            hmap_destroy(&h);
+        }
+    }
+}
+
 int main()
 {
     t1();
     t2();
+    t3();
+    t4();
+    t5();
+    t6();
+    t7();
+    t8();
+    t9();
+    t10();
+    t11();
+    t12();
+    t13();
+    t14();
+    t15();
+    t16();
+    t17();
+    t18();
 }
@@ -0,0 +1,154 @@
+#undef NDEBUG
+#include <cstdio>
+#include <cassert>
+#include <string>
+#include <stdexcept>
+#include <memory>
+
+#include "hashmap.hpp"
+
+void t1()
+{
+    chashmap::hmap<int,int> h(2);
+
+    for (int k = 0; k < 1000; k++) h.insert(std::make_pair(k, k * 2));
+    for (int k = 0; k < 1000; k += 2) assert(h.erase(k) == 1);
+    assert(h.size() == 500);
+
+    for (int k = 0; k < 1000; k++) {
+        auto i = h.find(k);
+        if (k & 1) {
+            assert(i->second == k * 2);
+        } else {
+            assert(i == h.end());
+        }
+    }
+
+    size_t n = 0;
+    for (auto &kv : h) {
+        assert(kv.first * 2 == kv.second);
+        n++;
+    }
+    assert(n == 500);
+
+    h[2000] = 7;
+    assert(h.find(2000)->second == 7);
+}
+
+void t2()
+{
+    chashmap::lhmap<int,int> h(2);
+
+    for (int k = 0; k < 1000; k++) h.insert(std::make_pair(k, k * 2));
+    for (int k = 0; k < 1000; k += 2) h.erase(k);
+
+    int k = 1;
+    for (auto &kv : h) {
+        assert(kv.first == k && kv.second == k * 2);
+        k += 2;
+    }
+    assert(k == 1001);
+
+    /* insert before an existing entry */
+    h.insert(h.find(1), std::make_pair(-1, -2));
+    assert(h.begin()->first == -1);
+    assert((--h.end())->first == 999);
+}
+
+void t3()
+{
+    typedef chashmap::hmap<std::string,std::unique_ptr<std::string>> map_t;
+    map_t h;
+
+    for (int k = 0; k < 100; k++) {
+        std::string s = std::to_string(k);
+        h.emplace(s, new std::string(s + s));
+    }
+    assert(h.size() == 100);
+    assert(*h.find("42")->second == "4242");
+
+    map_t m(std::move(h));
+    assert(m.size() == 100);
+    assert(*m.find("7")->second == "77");
+    m.erase("7");
+    assert(m.find("7") == m.end());
+
+    chashmap::lhmap<std::string,std::string> l;
+    l["b"] = "2";
+    l["a"] = "1";
+    chashmap::lhmap<std::string,std::string> c = l;
+    assert(c.begin()->first == "b");
+    assert(c["a"] == "1");
+}
+
+struct throws_on_copy
+{
+    static int copies;
+    std::string s;
+    throws_on_copy(const char *s) : s(s) {}
+    throws_on_copy(const throws_on_copy &o) : s(o.s)
+    {
+        if (++copies == 50) throw std::runtime_error("copy");
+    }
+    throws_on_copy(throws_on_copy &&o) noexcept : s(std::move(o.s)) {}
+};
+
+int throws_on_copy::copies;
+
+void t4()
+{
+    /* moved-from maps stay usable as empty maps */
+    chashmap::hmap<int,int> h;
+    h[1] = 2;
+    chashmap::hmap<int,int> m(std::move(h));
+    assert(h.size() == 0 && h.load() == 0 && h.begin() == h.end());
+    assert(h.find(1) == h.end() && h.erase(1) == 0);
+    h.clear();
+    h[3] = 4;
+    assert(h.size() == 1 && h.find(3)->second == 4 && m.find(1)->second == 2);
+    chashmap::hmap<int,int> e(std::move(h)), c(h);
+    c.reserve(100);
+    c[5] = 6;
+    assert(c.size() == 1 && c.capacity() >= 128);
+    m = std::move(e);
+    assert(m.size() == 1 && e.size() == 0);
+
+    chashmap::lhmap<int,int> l;
+    l[1] = 2;
+    chashmap::lhmap<int,int> n(std::move(l));
+    assert(l.size() == 0 && l.load() == 0 && l.begin() == l.end());
+    assert(l.find(1) == l.end() && l.erase(1) == 0);
+    l.clear();
+    l[3] = 4;
+    l[5] = 6;
+    assert(l.begin()->first == 3 && l.find(5)->second == 6);
+    chashmap::lhmap<int,int> lc(n = std::move(l));
+    assert(lc.size() == 2 && l.size() == 0);
+
+    /* a copy that throws part way leaves nothing behind */
+    chashmap::hmap<int,throws_on_copy> t;
+    chashmap::lhmap<int,throws_on_copy> lt;
+    for (int k = 0; k < 100; k++) {
+        t.emplace(k, "value");
+        lt.emplace(k, "value");
+    }
+    for (int r = 0; r < 2; r++) {
+        throws_on_copy::copies = 0;
+        bool thrown = false;
+        try {
+            if (r) { chashmap::lhmap<int,throws_on_copy> lcopy(lt); }
+            else { chashmap::hmap<int,throws_on_copy> copy(t); }
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        assert(thrown && throws_on_copy::copies == 50);
+    }
+}
+
+int main()
+{
+    t1();
+    t2();
+    t3();
+    t4();
+}
@@ -0,0 +1,83 @@
+#undef NDEBUG
+#include <stdio.h>
+#include <assert.h>
+
+#include "hashmap_file.h"
+
+/*
+ * saves hmap in each layout and an lhmap, maps them back and checks
+ * contents and iteration order. a corrupt or missing file fails to map
+ * and an indirect map fails to save.
+ */
+
+void t1()
+{
+    static const unsigned modes[] = { 0, 1, 2, 3, 4, 8, 16, 17 };
+    const char *path = "test_hmap.snap";
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        hmap h, s;
+        hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(int));
+        opts.flags = modes[m];
+        hmap_init_opts(&h, &opts);
+        for (int k = 0; k < 10000; k++) hmap_insert(&h, &k, &k);
+        for (int k = 0; k < 10000; k += 3) hmap_erase(&h, &k);
+
+        assert(hmap_save(&h, path) == 0);
+        assert(hmap_map(&s, path) == 0);
+        assert(hmap_count(&s) == hmap_count(&h));
+        assert(s.seed == h.seed && s.flags == h.flags);
+        for (int k = 0; k < 10000; k++) {
+            hmap_iter i = hmap_find(&s, &k);
+            if (k % 3 == 0) assert(hmap_iter_eq(i, hmap_iter_end(&s)));
+            else assert(*(int*)hmap_iter_val(i) == k);
+        }
+        size_t n = 0;
+        for (hmap_iter i = hmap_iter_begin(&s); hmap_iter_neq(i, hmap_iter_end(&s));
+             i = hmap_iter_next(i)) n++;
+        assert(n == hmap_count(&h));
+        hmap_destroy(&s);
+        hmap_destroy(&h);
+    }
+
+    hmap hs;
+    lhmap h, s;
+    lhmap_opts lopts = lhmap_opts_make(sizeof(int), sizeof(int));
+    lopts.flags = hmap_flag_hashes;
+    lhmap_init_opts(&h, &lopts);
+    for (int k = 0; k < 10000; k++) lhmap_insert(&h, lhmap_iter_end(&h), &k, &k);
+    for (int k = 0; k < 10000; k += 3) lhmap_erase(&h, &k);
+
+    assert(lhmap_save(&h, path) == 0);
+    assert(hmap_map(&hs, path) == -1);
+    assert(lhmap_map(&s, path) == 0);
+    lhmap_iter i = lhmap_iter_begin(&h), j = lhmap_iter_begin(&s);
+    for (; lhmap_iter_neq(i, lhmap_iter_end(&h)); i = lhmap_iter_next(i), j = lhmap_iter_next(j)) {
+        assert(*(int*)lhmap_iter_key(j) == *(int*)lhmap_iter_key(i));
+    }
+    assert(lhmap_iter_eq(j, lhmap_iter_end(&s)));
+    int k = 5;
+    assert(*(int*)lhmap_iter_val(lhmap_find(&s, &k)) == 5);
+    lhmap_destroy(&s);
+    lhmap_destroy(&h);
+
+    FILE *f = fopen(path, "r+b");
+    fputc('x', f);
+    fclose(f);
+    assert(lhmap_map(&s, path) == -1);
+    remove(path);
+    assert(lhmap_map(&s, path) == -1);
+
+    /* indirect values are not in the table */
+    hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(int));
+    opts.flags = hmap_flag_indirect;
+    hmap_init_opts(&hs, &opts);
+    hmap_insert(&hs, &k, &k);
+    assert(hmap_save(&hs, path) == -1 && errno == EINVAL);
+    hmap_destroy(&hs);
+}
+
+int main()
+{
+    t1();
+}
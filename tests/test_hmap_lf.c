@@ -0,0 +1,142 @@
+#undef NDEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <threads.h>
+
+#include "hashmap_lockfree.h"
+
+/*
+ * threads insert, overwrite, find and erase concurrently on a map that
+ * starts at the minimum size, so many migrations run under them. each
+ * thread owns a key range it checks exactly against a private model, and
+ * all threads race on a shared range where every value found must encode
+ * its key. values are key << 16 | tag. single-threaded inserts with
+ * several seeds must leave the map promoted to a table that fits them.
+ */
+
+enum { num_threads = 4, own_keys = 20000, shared_keys = 4096, num_ops = 400000 };
+
+static hmap_lf m;
+
+static uint64_t own_key(uintptr_t t, uint64_t k) { return 1 + shared_keys + t * own_keys + k; }
+
+static int worker_fn(void *arg)
+{
+    uintptr_t t = (uintptr_t)arg;
+    uint64_t x = t * 0x9e3779b97f4a7c15ull + 1;
+    uint64_t *model = calloc(own_keys, sizeof(uint64_t));
+
+    for (size_t n = 0; n < num_ops; n++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        uint64_t r = x >> 32, k = r % own_keys, key = own_key(t, k);
+        switch (x & 7) {
+        case 0: case 1: case 2: {
+            uint64_t val = key << 16 | (n & 0xffff) | 1;
+            assert(hmap_lf_insert(&m, key, val) == (model[k] == 0));
+            model[k] = val;
+            break;
+        }
+        case 3:
+            assert(hmap_lf_erase(&m, key) == (model[k] != 0));
+            model[k] = 0;
+            break;
+        case 4: case 5:
+            assert(hmap_lf_find(&m, key) == model[k]);
+            break;
+        case 6: {
+            uint64_t skey = 1 + r % shared_keys;
+            hmap_lf_insert(&m, skey, skey << 16 | (t + 1));
+            break;
+        }
+        case 7: {
+            uint64_t skey = 1 + r % shared_keys, v = hmap_lf_find(&m, skey);
+            assert(v == 0 || v >> 16 == skey);
+            uint64_t okey = own_key(r % num_threads, r % own_keys);
+            v = hmap_lf_find(&m, okey);
+            assert(v == 0 || v >> 16 == okey);
+            break;
+        }
+        }
+    }
+
+    for (uint64_t k = 0; k < own_keys; k++) {
+        assert(hmap_lf_find(&m, own_key(t, k)) == model[k]);
+    }
+    free(model);
+    return 0;
+}
+
+void t1()
+{
+    thrd_t threads[num_threads];
+
+    hmap_lf_init(&m, 16);
+    for (uintptr_t i = 0; i < num_threads; i++) {
+        assert(thrd_create(&threads[i], worker_fn, (void*)i) == thrd_success);
+    }
+    for (int i = 0; i < num_threads; i++) thrd_join(threads[i], NULL);
+
+    size_t count = 0;
+    for (uint64_t key = 1; key < own_key(num_threads, 0); key++) {
+        uint64_t v = hmap_lf_find(&m, key);
+        assert(v == 0 || v >> 16 == key);
+        count += v != 0;
+    }
+    assert(count == hmap_lf_count(&m));
+
+    hmap_lf_quiesce(&m);
+    for (uint64_t key = 1; key < own_key(num_threads, 0); key++) {
+        if (hmap_lf_erase(&m, key)) count--;
+    }
+    assert(count == 0 && hmap_lf_count(&m) == 0);
+    printf("capacity %zu\n", hmap_lf_capacity(&m));
+    hmap_lf_destroy(&m);
+}
+
+void t2()
+{
+    hmap_lf_init(&m, 16);
+    assert(hmap_lf_find(&m, 1) == 0);
+    assert(hmap_lf_erase(&m, 1) == 0);
+    for (uint64_t k = 1; k <= 100000; k++) assert(hmap_lf_insert(&m, k, k));
+    for (uint64_t k = 1; k <= 100000; k++) assert(hmap_lf_find(&m, k) == k);
+    for (uint64_t k = 1; k <= 100000; k += 2) assert(hmap_lf_erase(&m, k));
+    assert(hmap_lf_count(&m) == 50000);
+    for (uint64_t k = 1; k <= 100000; k++) {
+        assert(hmap_lf_find(&m, k) == (k & 1 ? 0 : k));
+    }
+    assert(!hmap_lf_insert(&m, 2, 3) && hmap_lf_find(&m, 2) == 3);
+    hmap_lf_destroy(&m);
+}
+
+void t3()
+{
+    /* single-threaded inserts must finish each copy and promote the map */
+    for (uint64_t seed = 1; seed <= 16; seed++) {
+        hmap_lf_init(&m, 16);
+        m.seed = seed * 0x9e3779b97f4a7c15ull;
+        for (uint64_t k = 1; k <= 100000; k++) assert(hmap_lf_insert(&m, k, k));
+        size_t chain = 0;
+        for (hmap_lf_table *t = atomic_load(&m.table); t; t = atomic_load(&t->next)) {
+            chain++;
+        }
+        assert(chain <= 2 && hmap_lf_capacity(&m) >= 100000);
+        /* no table holds keys in more than three quarters of its slots */
+        for (hmap_lf_table *t = m.first; t; t = atomic_load(&t->next)) {
+            size_t keys = 0;
+            for (size_t i = 0; i < t->limit; i++) keys += atomic_load(&t->slots[i].key) != 0;
+            assert(keys <= t->limit - t->limit / 4);
+        }
+        for (uint64_t k = 1; k <= 100000; k++) assert(hmap_lf_find(&m, k) == k);
+        hmap_lf_destroy(&m);
+    }
+}
+
+int main()
+{
+    t2();
+    t3();
+    t1();
+}
@@ -0,0 +1,335 @@
+#undef NDEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+
+#include "hashmap_parallel.h"
+
+/*
+ * builds maps in each layout from key arrays with repeated keys, with
+ * the default and a high load factor so that many probe runs leave their
+ * partition, and checks that every key holds the value of its last
+ * occurrence. an unsupported layout or a non-empty map is built serially.
+ * maps with parallel resize enabled are grown past the threshold, shrunk
+ * and reserved, keeping their contents and, for lhmap, insertion order.
+ * parallel set operations match the serial ones into empty and non-empty
+ * destination maps. a parallel rehash whose allocation fails leaves the
+ * map unchanged for the serial one, which here allocates successfully.
+ */
+
+enum { num_keys = 200000, num_distinct = 150000 };
+
+static uint64_t keys[num_keys], vals[num_keys];
+
+static void check_build(unsigned flags, size_t max_load, size_t nthreads, size_t n)
+{
+    hmap h;
+    hmap_opts opts = hmap_opts_make(sizeof(uint64_t), sizeof(uint64_t));
+    opts.flags = flags;
+    if (max_load) opts.max_load = max_load;
+    hmap_init_opts(&h, &opts);
+    hmap_build_parallel(&h, keys, vals, n, nthreads);
+
+    /* the reference keeps the last value of each key */
+    hmap ref;
+    hmap_init(&ref, sizeof(uint64_t), sizeof(uint64_t), 16);
+    for (size_t i = 0; i < n; i++) hmap_insert(&ref, &keys[i], &vals[i]);
+
+    assert(hmap_count(&h) == hmap_count(&ref));
+    for (hmap_iter i = hmap_iter_begin(&ref); hmap_iter_neq(i, hmap_iter_end(&ref));
+         i = hmap_iter_next(i)) {
+        uint64_t *v = (uint64_t*)hmap_get(&h, hmap_iter_key(i));
+        assert(*v == *(uint64_t*)hmap_iter_val(i));
+    }
+    size_t count = 0;
+    for (hmap_iter i = hmap_iter_begin(&h); hmap_iter_neq(i, hmap_iter_end(&h));
+         i = hmap_iter_next(i)) count++;
+    assert(count == hmap_count(&ref));
+
+    /* the map stays usable for inserts and erases */
+    for (size_t i = 0; i < n; i += 2) hmap_erase(&h, &keys[i]);
+    for (size_t i = 0; i < n; i += 2) hmap_insert(&h, &keys[i], &vals[i]);
+    assert(hmap_count(&h) == hmap_count(&ref));
+
+    hmap_destroy(&ref);
+    hmap_destroy(&h);
+}
+
+void t1()
+{
+    static const unsigned modes[] = { 0, 1, 2, 3, 4, 8, 16, 17, 32, 33, 49 };
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+
+    for (size_t i = 0; i < num_keys; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        keys[i] = x % num_distinct;
+        vals[i] = i;
+    }
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        check_build(modes[m], 0, 4, num_keys);
+        check_build(modes[m], hmap_load_multiplier * 15 / 16, 3, num_keys);
+    }
+    check_build(0, 0, 1, num_keys);
+    check_build(1, 0, 16, 100);
+    check_build(0, 0, 4, 0);
+}
+
+void t2()
+{
+    /* a map that already has entries keeps them */
+    hmap h;
+    uint64_t k = num_distinct + 1, v = 99;
+    hmap_init(&h, sizeof(uint64_t), sizeof(uint64_t), 16);
+    hmap_insert(&h, &k, &v);
+    hmap_build_parallel(&h, keys, vals, num_keys, 4);
+    assert(hmap_count(&h) <= num_distinct + 1 && *(uint64_t*)hmap_get(&h, &k) == 99);
+    hmap_destroy(&h);
+
+    /* an emptied map that still has tombstones is built in parallel */
+    static const unsigned modes[] = { 0, 1, 32, 33 };
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        hmap_opts opts = hmap_opts_make(sizeof(uint64_t), sizeof(uint64_t));
+        opts.flags = modes[m];
+        opts.min_load = 0;
+        hmap_init_opts(&h, &opts);
+        for (k = 0; k < num_keys; k++) hmap_insert(&h, &k, &v);
+        for (k = 0; k < num_keys; k++) hmap_erase(&h, &k);
+        assert(hmap_count(&h) == 0 && h.tombs > 0);
+        hmap_build_parallel(&h, keys, vals, num_keys, 4);
+        assert(h.tombs == 0);
+        size_t count = 0;
+        for (hmap_iter i = hmap_iter_begin(&h); hmap_iter_neq(i, hmap_iter_end(&h));
+             i = hmap_iter_next(i), count++) {
+            assert(hmap_iter_neq(hmap_find(&h, hmap_iter_key(i)), hmap_iter_end(&h)));
+        }
+        assert(count == hmap_count(&h));
+        for (size_t i = 0; i < num_keys; i++) {
+            assert(hmap_iter_neq(hmap_find(&h, &keys[i]), hmap_iter_end(&h)));
+        }
+        hmap_destroy(&h);
+    }
+}
+
+enum { num_resize = 300000 };
+
+void t3()
+{
+    static const unsigned modes[] = { 0, 1, 2, 3, 4, 8, 16, 17, 32 };
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        hmap h;
+        hmap_opts opts = hmap_opts_make(sizeof(uint64_t), sizeof(uint64_t));
+        opts.flags = modes[m];
+        opts.min_load = opts.max_load >> 2;
+        hmap_init_opts(&h, &opts);
+        hmap_parallel_resize(&h, 4);
+
+        for (uint64_t k = 0; k < num_resize; k++) {
+            uint64_t v = k * 3;
+            hmap_insert(&h, &k, &v);
+        }
+        for (uint64_t k = 0; k < num_resize; k += 4) hmap_erase(&h, &k);
+        hmap_reserve(&h, num_resize * 4);
+        for (uint64_t k = 1; k < num_resize; k += 4) hmap_erase(&h, &k);
+        hmap_shrink_to_fit(&h);
+
+        assert(hmap_count(&h) == num_resize / 2);
+        for (uint64_t k = 0; k < num_resize; k++) {
+            hmap_iter i = hmap_find(&h, &k);
+            assert((k % 4 > 1) == hmap_iter_neq(i, hmap_iter_end(&h)));
+            if (k % 4 > 1) assert(*(uint64_t*)hmap_iter_val(i) == k * 3);
+        }
+        hmap_destroy(&h);
+    }
+
+    for (unsigned flags = 0; flags <= hmap_flag_hashes; flags += hmap_flag_hashes) {
+        lhmap h;
+        lhmap_opts opts = lhmap_opts_make(sizeof(uint64_t), sizeof(uint64_t));
+        opts.flags = flags;
+        lhmap_init_opts(&h, &opts);
+        lhmap_parallel_resize(&h, 3);
+
+        /* keys in an order unrelated to their slots */
+        for (uint64_t i = 0; i < num_resize; i++) {
+            uint64_t k = i * 0x9e3779b97f4a7c15ull;
+            lhmap_insert(&h, lhmap_iter_end(&h), &k, &i);
+        }
+        for (uint64_t i = 0; i < num_resize; i += 3) {
+            uint64_t k = i * 0x9e3779b97f4a7c15ull;
+            lhmap_erase(&h, &k);
+        }
+        lhmap_reserve(&h, num_resize * 2);
+        lhmap_shrink_to_fit(&h);
+
+        uint64_t last = 0, count = 0;
+        for (lhmap_iter i = lhmap_iter_begin(&h); lhmap_iter_neq(i, lhmap_iter_end(&h));
+             i = lhmap_iter_next(i)) {
+            uint64_t v = *(uint64_t*)lhmap_iter_val(i);
+            assert(v % 3 != 0 && (count == 0 || v > last));
+            last = v;
+            count++;
+        }
+        assert(count == lhmap_count(&h) && count == num_resize - (num_resize + 2) / 3);
+        lhmap_destroy(&h);
+    }
+}
+
+static void check_equal(hmap *h, hmap *ref)
+{
+    assert(hmap_count(h) == hmap_count(ref));
+    for (hmap_iter i = hmap_iter_begin(ref); hmap_iter_neq(i, hmap_iter_end(ref));
+         i = hmap_iter_next(i)) {
+        hmap_iter j = hmap_find(h, hmap_iter_key(i));
+        assert(hmap_iter_neq(j, hmap_iter_end(h)));
+        assert(memcmp(hmap_iter_val(j), hmap_iter_val(i), h->val_size) == 0);
+    }
+}
+
+static void add_vals(void *ctx, void *key, void *dst_val, void *src_val)
+{
+    (void)ctx; (void)key;
+    *(uint64_t*)dst_val += *(uint64_t*)src_val;
+}
+
+enum { num_set = 40000 };
+
+void t4()
+{
+    static const unsigned modes[] = { 0, 1, 2, 3, 4, 6, 8, 16, 17, 32, 33 };
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]) * 2; m++) {
+        hmap_opts opts = hmap_opts_make(sizeof(uint64_t), (m & 1) ? sizeof(uint64_t) : 0);
+        opts.flags = modes[m >> 1];
+        hmap a, b, h, ref;
+        hmap_init_opts(&a, &opts);
+        hmap_init_opts(&b, &opts);
+        for (uint64_t k = 0; k < num_set * 2; k += 2) {
+            uint64_t v = k + 1;
+            hmap_insert(&a, &k, &v);
+        }
+        for (uint64_t k = 0; k < num_set * 4; k += 3) {
+            uint64_t v = k + 2;
+            hmap_insert(&b, &k, &v);
+        }
+
+        /*
+         * an empty dst is built in parallel, a non-empty one serially. the
+         * seeded keys 1 to 4 are in neither map, a only, b only and a only.
+         */
+        for (int seeded = 0; seeded < 2; seeded++) {
+            for (int op = 0; op < 5; op++) {
+                hmap_init_opts(&h, &opts);
+                hmap_init_opts(&ref, &opts);
+                for (uint64_t k = 1; seeded && k <= 4; k++) {
+                    uint64_t v = 7;
+                    hmap_insert(&h, &k, &v);
+                    hmap_insert(&ref, &k, &v);
+                }
+                switch (op) {
+                case 0:
+                    hmap_union_parallel(&h, &a, &b, 4);
+                    hmap_union(&ref, &a, &b);
+                    break;
+                case 1:
+                    hmap_intersect_parallel(&h, &b, &a, 3);
+                    hmap_intersect(&ref, &b, &a);
+                    break;
+                case 2:
+                    hmap_difference_parallel(&h, &a, &b, 4);
+                    hmap_difference(&ref, &a, &b);
+                    break;
+                case 3:
+                    hmap_merge(&h, &a, NULL, NULL);
+                    hmap_merge(&ref, &a, NULL, NULL);
+                    hmap_merge_parallel(&h, &b, opts.val_size ? add_vals : NULL, NULL, 4);
+                    hmap_merge(&ref, &b, opts.val_size ? add_vals : NULL, NULL);
+                    break;
+                case 4:
+                    /* the second operand is the smaller */
+                    hmap_union_parallel(&h, &b, &a, 4);
+                    hmap_union(&ref, &b, &a);
+                    break;
+                }
+                check_equal(&h, &ref);
+                hmap_destroy(&ref);
+                hmap_destroy(&h);
+            }
+        }
+        hmap_destroy(&b);
+        hmap_destroy(&a);
+    }
+}
+
+/* passes skip allocations through, then fails the next fail of them */
+typedef struct { int skip; int fail; } fail_alloc;
+
+static void* fail_alloc_fn(void *userdata, size_t size)
+{
+    fail_alloc *f = (fail_alloc*)userdata;
+    if (f->skip) f->skip--;
+    else if (f->fail) return f->fail--, NULL;
+    return malloc(size);
+}
+
+static void fail_free_fn(void *userdata, void *ptr, size_t size)
+{
+    (void)userdata; (void)size;
+    free(ptr);
+}
+
+void t5()
+{
+    /* the parallel rehash backs out of a failed allocation untouched */
+    fail_alloc f = { 0, 0 };
+    hmap_allocator allocator = { fail_alloc_fn, fail_free_fn, &f };
+
+    hmap h;
+    hmap_opts opts = hmap_opts_make(sizeof(uint64_t), sizeof(uint64_t));
+    opts.allocator = allocator;
+    hmap_init_opts(&h, &opts);
+    hmap_parallel_resize(&h, 4);
+    for (uint64_t k = 0; k < num_resize; k++) hmap_insert(&h, &k, &k);
+    size_t limit = hmap_capacity(&h);
+    f.fail = 1;
+    hmap_reserve(&h, num_resize * 4);
+    assert(f.fail == 0 && hmap_capacity(&h) > limit);
+    for (uint64_t k = 0; k < num_resize; k++) {
+        assert(*(uint64_t*)hmap_iter_val(hmap_find(&h, &k)) == k);
+    }
+    hmap_destroy(&h);
+
+    /* the remap and then the table allocation fail */
+    for (int skip = 0; skip < 2; skip++) {
+        lhmap lh;
+        lhmap_opts lopts = lhmap_opts_make(sizeof(uint64_t), sizeof(uint64_t));
+        lopts.allocator = allocator;
+        lhmap_init_opts(&lh, &lopts);
+        lhmap_parallel_resize(&lh, 3);
+        for (uint64_t k = 0; k < num_resize; k++) {
+            lhmap_insert(&lh, lhmap_iter_end(&lh), &k, &k);
+        }
+        limit = lhmap_capacity(&lh);
+        f.skip = skip;
+        f.fail = 1;
+        lhmap_reserve(&lh, num_resize * 4);
+        assert(f.fail == 0 && lhmap_capacity(&lh) > limit);
+        uint64_t expect = 0;
+        for (lhmap_iter i = lhmap_iter_begin(&lh); lhmap_iter_neq(i, lhmap_iter_end(&lh));
+             i = lhmap_iter_next(i), expect++) {
+            assert(*(uint64_t*)lhmap_iter_key(i) == expect);
+        }
+        assert(expect == num_resize);
+        lhmap_destroy(&lh);
+    }
+}
+
+int main()
+{
+    t1();
+    t2();
+    t3();
+    t4();
+    t5();
+}
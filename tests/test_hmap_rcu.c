@@ -0,0 +1,86 @@
+#undef NDEBUG
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <threads.h>
+
+#include "hashmap_rcu.h"
+
+/*
+ * one writer inserts, overwrites and erases while reader threads check
+ * that every value they copy out is consistent with its key. the map
+ * starts small so the writer resizes many times under the readers.
+ */
+
+typedef struct { uint64_t key, gen, check; } entry;
+
+enum { num_readers = 4, num_keys = 20000, num_rounds = 20 };
+
+static hmap_rcu h;
+static atomic_int done;
+static atomic_size_t lookups, hits;
+
+static int reader_fn(void *arg)
+{
+    uint64_t x = (uint64_t)(uintptr_t)arg * 0x9e3779b97f4a7c15ull + 1;
+    int reader = hmap_rcu_reader_register(&h);
+    size_t n = 0, found = 0;
+
+    assert(reader >= 0);
+    while (!atomic_load(&done)) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        uint64_t k = x % num_keys;
+        entry e;
+        if (hmap_rcu_find(&h, reader, &k, &e)) {
+            assert(e.key == k);
+            assert(e.check == e.key * 31 + e.gen);
+            found++;
+        }
+        n++;
+    }
+    hmap_rcu_reader_unregister(&h, reader);
+    atomic_fetch_add(&lookups, n);
+    atomic_fetch_add(&hits, found);
+    return 0;
+}
+
+void t1()
+{
+    thrd_t threads[num_readers];
+
+    hmap_rcu_init(&h, sizeof(uint64_t), sizeof(entry), hmap_default_size);
+    for (uintptr_t i = 0; i < num_readers; i++) {
+        assert(thrd_create(&threads[i], reader_fn, (void*)i) == thrd_success);
+    }
+
+    for (uint64_t g = 0; g < num_rounds; g++) {
+        for (uint64_t k = 0; k < num_keys; k++) {
+            entry e = { k, g, k * 31 + g };
+            hmap_rcu_insert(&h, &k, &e);
+        }
+        for (uint64_t k = g % 3; k < num_keys; k += 3) {
+            assert(hmap_rcu_erase(&h, &k));
+        }
+        thrd_yield();
+    }
+    atomic_store(&done, 1);
+    for (int i = 0; i < num_readers; i++) thrd_join(threads[i], NULL);
+
+    /* the last round erased keys congruent to (num_rounds - 1) % 3 */
+    int reader = hmap_rcu_reader_register(&h);
+    for (uint64_t k = 0; k < num_keys; k++) {
+        entry e;
+        int found = hmap_rcu_find(&h, reader, &k, &e);
+        assert(found == (k % 3 != (num_rounds - 1) % 3));
+        if (found) assert(e.gen == num_rounds - 1);
+    }
+    hmap_rcu_reader_unregister(&h, reader);
+    hmap_rcu_destroy(&h);
+
+    printf("lookups %zu hits %zu\n", (size_t)lookups, (size_t)hits);
+}
+
+int main()
+{
+    t1();
+}
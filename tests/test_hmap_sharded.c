@@ -0,0 +1,82 @@
+#undef NDEBUG
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <threads.h>
+
+#include "hashmap_sharded.h"
+
+/*
+ * threads insert disjoint key ranges into a shared sharded map, erase
+ * half of their keys, and look up keys of the other threads while they
+ * run. the final contents are checked from the main thread.
+ */
+
+enum { num_threads = 4, keys_per_thread = 50000 };
+
+static hmap_sharded s;
+
+static int worker_fn(void *arg)
+{
+    uint64_t base = (uint64_t)(uintptr_t)arg * keys_per_thread, v;
+
+    for (uint64_t k = base; k < base + keys_per_thread; k++) {
+        v = k * 2;
+        hmap_sharded_insert(&s, &k, &v);
+        uint64_t other = (k + keys_per_thread) % (num_threads * keys_per_thread);
+        if (hmap_sharded_find(&s, &other, &v)) assert(v == other * 2);
+    }
+    for (uint64_t k = base; k < base + keys_per_thread; k += 2) {
+        assert(hmap_sharded_erase(&s, &k));
+        assert(!hmap_sharded_erase(&s, &k));
+    }
+    return 0;
+}
+
+static int sum_fn(void *ctx, void *key, void *val)
+{
+    assert(*(uint64_t*)key & 1);
+    assert(*(uint64_t*)val == *(uint64_t*)key * 2);
+    (*(size_t*)ctx)++;
+    return 0;
+}
+
+static int stop_fn(void *ctx, void *key, void *val)
+{
+    (void)key; (void)val;
+    return ++*(size_t*)ctx == 10 ? 7 : 0;
+}
+
+void t1()
+{
+    thrd_t threads[num_threads];
+    size_t n = 0;
+
+    hmap_sharded_init(&s, sizeof(uint64_t), sizeof(uint64_t), 16);
+    for (uintptr_t i = 0; i < num_threads; i++) {
+        assert(thrd_create(&threads[i], worker_fn, (void*)i) == thrd_success);
+    }
+    for (int i = 0; i < num_threads; i++) thrd_join(threads[i], NULL);
+
+    assert(hmap_sharded_count(&s) == num_threads * keys_per_thread / 2);
+    for (uint64_t k = 0, v; k < num_threads * keys_per_thread; k++) {
+        assert(hmap_sharded_find(&s, &k, &v) == (int)(k & 1));
+    }
+    assert(hmap_sharded_foreach(&s, sum_fn, &n) == 0);
+    assert(n == num_threads * keys_per_thread / 2);
+    n = 0;
+    assert(hmap_sharded_foreach(&s, stop_fn, &n) == 7);
+    assert(n == 10);
+
+    /* shards grow independently and stay balanced */
+    for (size_t i = 0; i < 16; i++) {
+        size_t c = hmap_count(&s.shards[i].h);
+        assert(c > 5000 && c < 7500);
+    }
+    hmap_sharded_destroy(&s);
+}
+
+int main()
+{
+    t1();
+}
@@ -0,0 +1,132 @@
+#undef NDEBUG
+#if !defined(HMAP_STATS)
+#define HMAP_STATS
+#endif
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+
+#include "hashmap.h"
+
+/*
+ * checks the HMAP_STATS counters and the cluster scan, first on a map
+ * with an identity hash where every probe length is known, then on each
+ * layout with the default hash.
+ */
+
+static uint64_t sum_buckets(const uint64_t *b)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < HMAP_STATS_BUCKETS; i++) sum += b[i];
+    return sum;
+}
+
+static size_t identity_hash(hmap *h, void *key)
+{
+    (void)h;
+    return (size_t)*(int*)key;
+}
+
+void t1()
+{
+    hmap h;
+    hmap_statistics s;
+    hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(int));
+    opts.hasher = identity_hash;
+    hmap_init_opts(&h, &opts);
+
+    /* slots 0-3 and 10 in a table of 16 */
+    int keys[] = { 0, 1, 2, 10, 16 };
+    for (int n = 0; n < 5; n++) hmap_insert(&h, &keys[n], &keys[n]);
+    hmap_stats_reset(&h);
+
+    for (int n = 0; n < 4; n++) hmap_find(&h, &keys[n]);
+    int k = 16;
+    hmap_find(&h, &k);
+    hmap_stats_scan(&h, &s);
+    assert(s.used == 5 && s.limit == 16 && s.tombs == 0);
+    assert(s.counters.hit_probes[0] == 4 && s.counters.hit_probes[2] == 1);
+    assert(sum_buckets(s.counters.hit_probes) == 5);
+    assert(sum_buckets(s.counters.miss_probes) == 0);
+    assert(s.counters.compares == 5 + 3);
+    assert(s.clusters[3] == 1 && s.clusters[1] == 1 && s.max_cluster == 4);
+
+    /* a miss homed at 0 steps over the four slot run */
+    k = 32;
+    hmap_find(&h, &k);
+    hmap_stats(&h, &s);
+    assert(s.counters.miss_probes[3] == 1 && s.max_cluster == 0);
+
+    /* a tombstone keeps the run together */
+    k = 1;
+    hmap_erase(&h, &k);
+    hmap_stats_scan(&h, &s);
+    assert(s.tombs == 1 && s.tomb_load == hmap_load_multiplier / 16);
+    assert(s.max_cluster == 4);
+    hmap_destroy(&h);
+}
+
+void t2()
+{
+    static const unsigned modes[] = { 0, 1, 2, 4, 8, 16 };
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        hmap h;
+        hmap_statistics s;
+        hmap_opts opts = hmap_opts_make(sizeof(int), sizeof(int));
+        opts.flags = modes[m];
+        hmap_init_opts(&h, &opts);
+
+        for (int k = 0; k < 10000; k++) hmap_insert(&h, &k, &k);
+        hmap_migrate(&h);
+        hmap_stats(&h, &s);
+        assert(sum_buckets(s.counters.miss_probes) == 10000);
+        assert(s.counters.resizes > 5 && s.counters.alloc_bytes > s.table_bytes);
+
+        hmap_stats_reset(&h);
+        for (int k = 0; k < 20000; k++) hmap_find(&h, &k);
+        hmap_stats_scan(&h, &s);
+        assert(sum_buckets(s.counters.hit_probes) == 10000);
+        assert(sum_buckets(s.counters.miss_probes) == 10000);
+        assert(s.counters.compares >= 10000 && s.counters.resizes == 0);
+        assert(s.used == 10000 && s.load == hmap_load(&h));
+        assert(s.max_cluster > 0 && s.max_cluster < s.limit);
+        assert(sum_buckets(s.clusters) > 0);
+        hmap_destroy(&h);
+    }
+}
+
+void t3()
+{
+    static const unsigned modes[] = { 0, 2 };
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        lhmap h;
+        hmap_statistics s;
+        lhmap_opts opts = lhmap_opts_make(sizeof(int), sizeof(int));
+        opts.flags = modes[m];
+        lhmap_init_opts(&h, &opts);
+
+        for (int k = 0; k < 10000; k++) lhmap_insert(&h, lhmap_iter_end(&h), &k, &k);
+        lhmap_stats(&h, &s);
+        assert(s.counters.resizes > 5 && s.counters.alloc_bytes > s.table_bytes);
+
+        lhmap_stats_reset(&h);
+        for (int k = 0; k < 20000; k++) lhmap_find(&h, &k);
+        for (int k = 0; k < 10000; k += 2) lhmap_erase(&h, &k);
+        lhmap_stats_scan(&h, &s);
+        assert(sum_buckets(s.counters.hit_probes) == 15000);
+        assert(sum_buckets(s.counters.miss_probes) == 10000);
+        assert(s.used == 5000 && s.tombs == 5000);
+        assert(s.tomb_load == 5000 * hmap_load_multiplier / s.limit);
+        assert(s.max_cluster > 0 && sum_buckets(s.clusters) > 0);
+        lhmap_destroy(&h);
+    }
+}
+
+int main()
+{
+    t1();
+    t2();
+    t3();
+}
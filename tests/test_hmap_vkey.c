@@ -0,0 +1,146 @@
+#undef NDEBUG
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+
+#include "hashmap_vkey.h"
+
+/*
+ * string keys from 1 to over 40 bytes, many sharing a prefix longer than
+ * the inline one, are inserted, replaced, found, visited and erased on
+ * each layout. erasing most long keys and shrinking checks that the arena
+ * is compacted to the live key bytes.
+ */
+
+enum { num_keys = 20000 };
+
+static size_t make_key(char *buf, int k)
+{
+    if (k % 3 == 0) return (size_t)sprintf(buf, "%d", k);
+    if (k % 3 == 1) return (size_t)sprintf(buf, "a-shared-long-prefix/%d", k);
+    return (size_t)sprintf(buf, "another-even-longer-shared-prefix/%08d/tail", k);
+}
+
+typedef struct { size_t count, bytes; } visit_sum;
+
+static int check_visit(void *ctx, const void *key, size_t len, void *val)
+{
+    visit_sum *sum = (visit_sum*)ctx;
+    char buf[64];
+    int k = *(int*)val;
+    assert(make_key(buf, k) == len && memcmp(buf, key, len) == 0);
+    sum->count++;
+    if (len > VHMAP_PREFIX) sum->bytes += len;
+    return 0;
+}
+
+void t1()
+{
+    static const unsigned modes[] = { 0, 1, 2, 4, 8, 16 };
+    char buf[64];
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        vhmap h;
+        hmap_opts opts = hmap_opts_make(0, sizeof(int));
+        opts.flags = modes[m];
+        opts.min_load = opts.max_load >> 2;
+        vhmap_init_opts(&h, &opts);
+
+        size_t long_bytes = 0;
+        for (int k = 0; k < num_keys; k++) {
+            size_t len = make_key(buf, k);
+            int v = -k;
+            vhmap_insert(&h, buf, len, &v);
+            if (len > VHMAP_PREFIX) long_bytes += len;
+        }
+        assert(vhmap_count(&h) == num_keys);
+        assert(vhmap_key_bytes(&h) == long_bytes);
+
+        /* replacing keeps the key bytes */
+        for (int k = 0; k < num_keys; k++) {
+            size_t len = make_key(buf, k);
+            int *v = (int*)vhmap_insert(&h, buf, len, &k);
+            assert(*v == k);
+        }
+        assert(vhmap_count(&h) == num_keys && vhmap_key_bytes(&h) == long_bytes);
+
+        for (int k = 0; k < num_keys; k++) {
+            size_t len = make_key(buf, k);
+            int *v = (int*)vhmap_find(&h, buf, len);
+            assert(v && *v == k);
+            /* same prefix and a different length or tail misses */
+            buf[len] = 'x';
+            assert(!vhmap_find(&h, buf, len + 1));
+            buf[len - 1] ^= 1;
+            assert(!vhmap_find(&h, buf, len));
+        }
+
+        visit_sum sum = { 0, 0 };
+        assert(vhmap_foreach(&h, check_visit, &sum) == 0);
+        assert(sum.count == num_keys && sum.bytes == long_bytes);
+
+        /* erase all but every 16th key, the table shrinks and compacts */
+        size_t arena = vhmap_arena_size(&h);
+        for (int k = 0; k < num_keys; k++) {
+            size_t len = make_key(buf, k);
+            if (k % 16 == 0) continue;
+            assert(vhmap_erase(&h, buf, len));
+            assert(!vhmap_erase(&h, buf, len));
+            if (len > VHMAP_PREFIX) long_bytes -= len;
+        }
+        assert(vhmap_count(&h) == num_keys / 16);
+        assert(vhmap_arena_size(&h) < arena / 4);
+        vhmap_compact(&h);
+        assert(h.arena_used == long_bytes && vhmap_key_bytes(&h) == long_bytes);
+
+        sum.count = sum.bytes = 0;
+        assert(vhmap_foreach(&h, check_visit, &sum) == 0);
+        assert(sum.count == num_keys / 16 && sum.bytes == long_bytes);
+        for (int k = 0; k < num_keys; k++) {
+            size_t len = make_key(buf, k);
+            int *v = (int*)vhmap_find(&h, buf, len);
+            assert((k % 16 == 0) == (v != NULL));
+            if (v) assert(*v == k);
+        }
+        vhmap_destroy(&h);
+    }
+}
+
+void t2()
+{
+    vhmap h;
+    char none = 0;
+    vhmap_init(&h, 0);
+
+    /* empty and binary keys, an empty key is stored inline */
+    const char bin[] = { 0, 1, 0, 2, 0, 3, 0, 4, 0, 5, 0, 6, 0, 7, 0, 8 };
+    vhmap_insert(&h, "", 0, &none);
+    vhmap_insert(&h, bin, sizeof(bin), &none);
+    vhmap_insert(&h, bin, sizeof(bin) - 1, &none);
+    assert(vhmap_count(&h) == 3 && vhmap_key_bytes(&h) == 31);
+    assert(vhmap_find(&h, "", 0) && vhmap_find(&h, bin, 16) && vhmap_find(&h, bin, 15));
+    assert(!vhmap_find(&h, bin, 14));
+
+    /* erase and reinsert churn reuses the arena without growing it */
+    char buf[64];
+    for (int k = 0; k < 1000; k++) {
+        size_t len = make_key(buf, k * 3 + 2);
+        vhmap_insert(&h, buf, len, &none);
+    }
+    size_t arena = vhmap_arena_size(&h);
+    for (int r = 0; r < 20; r++) {
+        for (int k = 0; k < 1000; k++) {
+            size_t len = make_key(buf, k * 3 + 2);
+            assert(vhmap_erase(&h, buf, len));
+            vhmap_insert(&h, buf, len, &none);
+        }
+    }
+    assert(vhmap_count(&h) == 1003 && vhmap_arena_size(&h) <= arena * 2);
+    vhmap_destroy(&h);
+}
+
+int main()
+{
+    t1();
+    t2();
+}